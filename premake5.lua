@@ -9,12 +9,34 @@ project "REASM"
 	targetdir "bin/%{cfg.buildcfg}"
 	objdir "bin/obj/%{cfg.buildcfg}"
 
-	files { "src/**.h", "src/**.cpp" }
+	files { "src/main.cpp", "src/BuildCache.h", "src/BuildCache.cpp", "src/File.h", "src/File.cpp", "src/FileWatcher.h", "src/FileWatcher.cpp", "src/Server.h", "src/Server.cpp", "src/Log/**.h", "src/Log/**.cpp" }
 
 	includedirs {
+		"src",
 		"libs/spdlog/include",
 	}
 
+	links { "REASMLib" }
+
+	filter "configurations:Debug"
+        defines { "REASM_DEBUG" }
+        symbols "On"
+    filter "configurations:Release"
+        defines { "REASM_RELEASE" }
+        optimize "On"
+
+-- Everything except the command line front end: no filesystem access, no
+-- logging, no process exit. Embedders include Assemble.h and link this.
+project "REASMLib"
+	kind "StaticLib"
+	language "C++"
+    cppdialect "C++20"
+	targetdir "bin/%{cfg.buildcfg}"
+	objdir "bin/obj/%{cfg.buildcfg}/%{prj.name}"
+
+	files { "src/**.h", "src/**.cpp" }
+	removefiles { "src/main.cpp", "src/BuildCache.h", "src/BuildCache.cpp", "src/File.h", "src/File.cpp", "src/FileWatcher.h", "src/FileWatcher.cpp", "src/Server.h", "src/Server.cpp", "src/Log/**" }
+
 	filter "configurations:Debug"
         defines { "REASM_DEBUG" }
         symbols "On"
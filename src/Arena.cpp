@@ -0,0 +1,52 @@
+#include "Arena.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <iterator>
+
+namespace REASM {
+
+Arena::Arena(size_t blockSize)
+	: m_BlockSize(blockSize) {}
+
+void *Arena::Allocate(size_t size, size_t align) {
+	uintptr_t cursor = (reinterpret_cast<uintptr_t>(m_Cursor) + align - 1) & ~(static_cast<uintptr_t>(align) - 1);
+	if (!m_Cursor || cursor + size > reinterpret_cast<uintptr_t>(m_End)) {
+		size_t blockSize = std::max(m_BlockSize, size + align);
+		m_Blocks.push_back(Block { .data = std::unique_ptr<char[]>(new char[blockSize]), .size = blockSize });
+		m_BytesReserved += blockSize;
+
+		m_Cursor = m_Blocks.back().data.get();
+		m_End = m_Cursor + blockSize;
+		cursor = (reinterpret_cast<uintptr_t>(m_Cursor) + align - 1) & ~(static_cast<uintptr_t>(align) - 1);
+	}
+
+	m_Cursor = reinterpret_cast<char *>(cursor + size);
+	return reinterpret_cast<void *>(cursor);
+}
+
+void Arena::Adopt(Arena &other) {
+	// Keep bumping into our own current block, which stays last.
+	auto position = m_Blocks.empty() ? m_Blocks.end() : m_Blocks.end() - 1;
+	m_Blocks.insert(position, std::make_move_iterator(other.m_Blocks.begin()),
+		std::make_move_iterator(other.m_Blocks.end()));
+	m_BytesReserved += other.m_BytesReserved;
+
+	other.m_Blocks.clear();
+	other.m_Cursor = nullptr;
+	other.m_End = nullptr;
+	other.m_BytesReserved = 0;
+}
+
+// Keeps the first block so an arena reused per job doesn't go back to the
+// allocator every time.
+void Arena::Reset() {
+	if (m_Blocks.empty()) return;
+
+	m_Blocks.erase(m_Blocks.begin() + 1, m_Blocks.end());
+	m_BytesReserved = m_Blocks.front().size;
+	m_Cursor = m_Blocks.front().data.get();
+	m_End = m_Cursor + m_Blocks.front().size;
+}
+
+}
\ No newline at end of file
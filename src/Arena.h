@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace REASM {
+
+// Bump allocator. Nothing is freed individually; every block goes at once
+// when the arena is destroyed, and all but the first when it is reset.
+class Arena {
+public:
+	Arena(size_t blockSize = 1024 * 1024);
+
+	Arena(const Arena &) = delete;
+	Arena &operator=(const Arena &) = delete;
+
+	void *Allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+	template<typename T>
+	T *Allocate(size_t count) {
+		return static_cast<T *>(Allocate(sizeof(T) * count, alignof(T)));
+	}
+
+	// Takes ownership of every block in other, leaving it empty.
+	void Adopt(Arena &other);
+	void Reset();
+
+	size_t GetBytesReserved() const { return m_BytesReserved; }
+private:
+	struct Block {
+		std::unique_ptr<char[]> data;
+		size_t size;
+	};
+private:
+	size_t m_BlockSize;
+	std::vector<Block> m_Blocks;
+	char *m_Cursor = nullptr;
+	char *m_End = nullptr;
+	size_t m_BytesReserved = 0;
+};
+
+}
\ No newline at end of file
@@ -1,969 +1,1100 @@
 #include "Assemble.h"
 
-#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <functional>
 
-#include "Defines/Opcodes.h"
-#include "Defines/Registers.h"
+#include "ISA.h"
+#include "ThreadPool.h"
 
 namespace REASM {
 
-uint16_t StringToU16(std::string number) {
-	char *end;
-	uint16_t value = (uint16_t)std::stoul(number, nullptr, 16);
-
-	return value;
-}
-	
-uint8_t StringToU8(std::string number) {
-	char *end;
-	uint8_t value = (uint8_t)std::strtol(number.c_str(), &end, 10);
-
-	return value;
-}
-
-uint8_t StringToRegister(std::string reg) {
-	if (reg == "R0") return R0;
-	if (reg == "R1") return R1;
-	if (reg == "R2") return R2;
-	if (reg == "R3") return R3;
-	if (reg == "R4") return R4;
-	if (reg == "R5") return R5;
-	if (reg == "R6") return R6;
-	if (reg == "R7") return R7;
-	if (reg == "R8") return R8;
-	if (reg == "R9") return R9;
-	if (reg == "R10") return R10;
-	if (reg == "R11") return R11;
-
-	ERROR("Invalid Register: {0}", reg);
-	exit(1);
-}
-
-void PushU16(std::vector<uint8_t> &binSource, uint16_t number) {
-	binSource.push_back((number >> 8) & 0xFF);
-	binSource.push_back(number & 0xFF);
-}
-
-void PushNumberU16(std::vector<uint8_t> &binSource, Token number) {
-	if (number.type == IMMEDIATE) {
-		char *end;
-		uint16_t value = (uint16_t)std::strtol(number.value.c_str(), &end, 10);
-		binSource.push_back(value & 0xFF);
-		binSource.push_back((value >> 8) & 0xFF);
-	} else if (number.type == HEX) {
-		uint16_t value = static_cast<uint16_t>(std::stoul(number.value, nullptr, 16));
-		binSource.push_back(value & 0xFF);
-		binSource.push_back((value >> 8) & 0xFF);
-	} else {
-		ERROR("Invalid VALUE for translation!");
-		exit(1);
+static void WriteU16(uint8_t *dest, uint16_t number) {
+	dest[0] = number & 0xFF;
+	dest[1] = (number >> 8) & 0xFF;
+}
+
+[[noreturn]] static void Fail(const TokenStream &tokens, uint32_t offset, std::string message) {
+	SourceLocation location = tokens.Locate(offset);
+	throw DiagnosticError(Diagnostic { .line = location.line, .column = location.column, .message = std::move(message) });
+}
+
+static void NextToken(TokenStream::Cursor &cursor, const TokenStream &tokens) {
+	TokenStream::Cursor last = cursor;
+	cursor.Advance();
+	if (cursor.AtEnd()) {
+		Fail(tokens, last.Offset(), "NextToken: Out of range! last token: " + TokenTypeToString(last.Type()));
+	}
+}
+
+static void ExpectNextToken(TokenStream::Cursor &cursor, const TokenStream &tokens, TokenType expect) {
+	NextToken(cursor, tokens);
+
+	if (cursor.Type() != expect) {
+		Fail(tokens, cursor.Offset(), "Expected: " + TokenTypeToString(expect) + ", got: " + TokenTypeToString(cursor.Type()));
+	}
+}
+
+static void NextTokenC(TokenStream::Cursor &cursor, const TokenStream &tokens) {
+	ExpectNextToken(cursor, tokens, COMMA);
+	NextToken(cursor, tokens);
+}
+
+// An INVALID token is a bad number or a character that starts no token.
+static std::string UnexpectedToken(const TokenStream &tokens, const TokenStream::Cursor &cursor) {
+	std::string text(tokens.Text(cursor));
+	if (cursor.Type() != INVALID) return "Unexpected token: " + text;
+	return std::string((text[0] >= '0' && text[0] <= '9') || text[0] == '#' ? "Invalid number: " : "Unexpected character: ") + text;
+}
+
+static bool StartsExpression(TokenType type) {
+	switch (type) {
+	case IMMEDIATE:
+	case HEX:
+	case NUMBER:
+	case INVALID:
+	case LABEL:
+	case UNKNOWN:
+	case LPAREN:
+	case PLUS:
+	case MINUS:
+	case TILDE: return true;
+	default: return false;
+	}
+}
+
+// Binding strength of a binary operator, 0 for any other token.
+static int BinaryPrecedence(TokenType type, ExprOp &op) {
+	switch (type) {
+	case PIPE: op = ExprOp::Or; return 1;
+	case CARET: op = ExprOp::Xor; return 2;
+	case AMPERSAND: op = ExprOp::And; return 3;
+	case SHIFTLEFT: op = ExprOp::ShiftLeft; return 4;
+	case SHIFTRIGHT: op = ExprOp::ShiftRight; return 4;
+	case PLUS: op = ExprOp::Add; return 5;
+	case MINUS: op = ExprOp::Subtract; return 5;
+	case STAR: op = ExprOp::Multiply; return 6;
+	case SLASH: op = ExprOp::Divide; return 6;
+	case PERCENT: op = ExprOp::Modulo; return 6;
+	default: return 0;
 	}
 }
 
-void PushNumberU8(std::vector<uint8_t> &binSource, std::string number) {
-	char *end;
-	uint8_t value = (uint8_t)std::strtol(number.c_str(), &end, 10);
-	binSource.push_back(value);
+static bool NextIsBinary(const TokenStream::Cursor &cursor) {
+	TokenStream::Cursor next = cursor;
+	next.Advance();
+	ExprOp op;
+	return !next.AtEnd() && BinaryPrecedence(next.Type(), op) > 0;
 }
 
-static Token NextToken(int &iter, std::vector<Token> &tokens) {
-	if (iter + 1 >= tokens.size()) {
-		ERROR("NextToken: Out of range! last token: {0}", TokenTypeToString(tokens[iter].type));
-		exit(1);
-	} else iter++;
-	return tokens[iter];
+static constexpr int MaxExpressionNesting = 64;
+
+static std::string DescribeFailure(EvalStatus status) {
+	switch (status) {
+	case EvalStatus::DivideByZero: return "Division by zero";
+	case EvalStatus::BadShift: return "Shift count out of range";
+	case EvalStatus::NotRelocatable: return "Expression is not relocatable";
+	default: return "Unresolved expression";
+	}
 }
 
-static Token ExpectNextToken(int &iter, std::vector<Token> &tokens, TokenType expect) {
-	if (iter + 1 >= tokens.size()) {
-		ERROR("NextToken: Out of range! last token: {0}", TokenTypeToString(tokens[iter].type));
-		exit(1);
-	} else iter++;
+// Operands are 16 bits, read as either signed or unsigned.
+static bool InRange(int64_t value) {
+	return value >= -32768 && value <= 0xFFFF;
+}
+
+// DB values and DS fills are bytes, read the same way.
+static bool InByteRange(int64_t value) {
+	return value >= -128 && value <= 0xFF;
+}
+
+static bool IsByteData(const Instruction &instruction) {
+	return instruction.kind == IRKind::Data && instruction.width == ImmediateWidth::Byte;
+}
 
-	if (tokens[iter].type != expect) {
-		ERROR("Expected: {0}, got: {1}", TokenTypeToString(expect), TokenTypeToString(tokens[iter].type));
-		exit(1);
+static ValueRange OperandRange(const Instruction &instruction, uint8_t operand) {
+	if (IsByteData(instruction)) return ValueRange::Byte;
+	if (instruction.kind == IRKind::Space) return operand == 0 ? ValueRange::Count : ValueRange::Fill;
+	return ValueRange::Word;
+}
+
+static void CheckRange(const TokenStream &tokens, uint32_t offset, int64_t value, ValueRange range) {
+	if (range == ValueRange::Count && (value < 0 || value > 0xFFFF)) Fail(tokens, offset, "DS count must be 0..65535");
+	if (range == ValueRange::Byte && !InByteRange(value)) Fail(tokens, offset, "Value out of range for DB");
+	if (range == ValueRange::Fill && !InByteRange(value)) Fail(tokens, offset, "Value out of range for DS fill");
+	if (!InRange(value)) Fail(tokens, offset, "Value out of range: " + std::to_string(value));
+}
+
+enum class Fit {
+	Yes,
+	No,
+	Later,	// a value needs label addresses
+};
+
+// Whether the immediates that instruction's short form narrows fit a byte.
+static Fit FitsShortForm(const Instruction &instruction) {
+	const InstructionDesc &narrow = ISA::Instructions[ISA::ShortForms[instruction.desc]];
+	Fit fit = Fit::Yes;
+	for (uint8_t i = 0; i < narrow.operandCount; i++) {
+		if (narrow.operands[i] != OperandKind::Imm8) continue;
+		if (instruction.operands[i] != OperandKind::Imm) fit = Fit::Later;
+		else if (instruction.values[i] > 0xFF) return Fit::No;
 	}
-	return tokens[iter];
+	return fit;
 }
 
-static Token NextTokenC(int &iter, std::vector<Token> &tokens) {
-	ExpectNextToken(iter, tokens, COMMA);
-	if (iter + 1 >= tokens.size()) {
-		ERROR("NextToken: Out of range! last token: {0}", TokenTypeToString(tokens[iter].type));
-		exit(1);
-	} else iter++;
-	return tokens[iter];
+Assembler::Assembler(const AssembleOptions &options)
+	: m_Options(options) {}
+
+AssembleResult Assembler::Assemble(std::string_view source) {
+	Reset();
+
+	AssembleResult result;
+	try {
+		TokenStream tokens = Lexer::Lex(source, m_Symbols, m_Arena, m_Options.jobs);
+
+		m_Instructions.reserve(tokens.GetStatementCount());
+		Parse(tokens, m_Symbols, m_Instructions, 0);
+		ResolveConstants(tokens);
+		if (m_Options.optimize) Optimize(m_Instructions, m_Symbols, m_Expressions, tokens, m_Options.relocatable, result.rewrites);
+		std::vector<uint8_t> &bytes = result.image.bytes;
+		bytes.resize(Relax(tokens));
+		Encode(bytes);
+
+		if (m_Options.relocatable) {
+			result.object = EmitObject(bytes);
+			bytes.clear();
+		} else {
+			result.image.segments = m_Segments;
+		}
+	} catch (const DiagnosticError &error) {
+		result.image = SegmentedImage {};
+		result.rewrites.clear();
+		result.diagnostics.push_back(error.GetDiagnostic());
+		return result;
+	}
+
+	for (SymbolID id = 0; id < m_Symbols.Size(); id++) {
+		const Symbol &symbol = m_Symbols.Get(id);
+		if (symbol.defined) result.symbols.push_back(AssembledSymbol { .name = std::string(symbol.name), .value = symbol.value });
+	}
+	if (m_Options.sourceMap && !m_Options.relocatable) result.map = MapSource(source);
+	result.included = m_Included;
+	result.success = true;
+	return result;
+}
+
+void Assembler::Reset() {
+	m_Incremental = false;
+	m_CrossLine = false;
+	m_Arena.Reset();
+	m_Symbols.Clear();
+	m_Instructions.clear();
+	m_Offsets.clear();
+	m_Segments.clear();
+	m_Blobs.clear();
+	m_Included.clear();
+	m_Expressions.Clear();
+	m_Constants.clear();
+	m_ConstantOrder.clear();
+	m_LabelConstants.clear();
+}
+
+// Records are in source order, so one pass over the newlines numbers them.
+SourceMap Assembler::MapSource(std::string_view source) const {
+	SourceMap map;
+	uint16_t org = 0x0000;
+	uint32_t segmentStart = 0;
+	size_t position = 0;
+	uint32_t line = 1;
+	for (size_t i = 0; i < m_Instructions.size(); i++) {
+		const Instruction &instruction = m_Instructions[i];
+		for (; position < instruction.offset && position < source.size(); position++) line += source[position] == '\n';
+
+		uint16_t address = static_cast<uint16_t>(org + m_Offsets[i] - segmentStart);
+		switch (instruction.kind) {
+		case IRKind::Org: {
+			org = static_cast<uint16_t>(instruction.values[0]);
+			segmentStart = m_Offsets[i];
+		} break;
+		case IRKind::Label: {
+			map.labels.push_back(SourceLabel { .name = std::string(m_Symbols.Get(instruction.values[0]).name), .address = address });
+		} break;
+		case IRKind::Instruction: {
+			map.lines.push_back(SourceLine { .address = address, .line = line });
+		} break;
+		default: break;
+		}
+	}
+	return map;
+}
+
+// base is added to every record's source offset, for tokens lexed from a
+// slice of the source.
+void Assembler::Parse(const TokenStream &tokens, SymbolTable &symbols, std::vector<Instruction> &records, uint32_t base) {
+	for (TokenStream::Cursor cursor = tokens.Begin(); !cursor.AtEnd(); cursor.Advance()) {
+		switch (cursor.Type()) {
+		case ORG: {
+			uint32_t offset = cursor.Offset();
+			NextToken(cursor, tokens);
+			uint32_t value;
+			OperandKind kind = ParseConstantOperand(cursor, tokens, symbols, value);
+			CheckLine(tokens, offset, cursor);
+			records.push_back(Instruction { .kind = IRKind::Org, .operands = { kind }, .values = { value }, .offset = base + offset });
+		} break;
+		case DB:
+		case DW:
+		case DS: {
+			ParseData(cursor, tokens, symbols, records, base);
+		} break;
+		case INCBIN: {
+			ParseBinary(cursor, tokens, symbols, records, base);
+		} break;
+		case LABEL:
+		case UNKNOWN: {
+			TokenStream::Cursor next = cursor;
+			next.Advance();
+			if (!next.AtEnd() && next.Type() == EQU) {
+				ParseConstant(cursor, tokens, symbols);
+			} else if (cursor.Type() == LABEL) {
+				records.push_back(Instruction { .kind = IRKind::Label, .values = { cursor.Payload() }, .offset = base + cursor.Offset() });
+			} else {
+				// Would become a label definition if the name were defined
+				// anywhere else in the file.
+				m_CrossLine = true;
+			}
+		} break;
+		case OPCODE: {
+			ParseInstruction(cursor, tokens, symbols, records, base);
+		} break;
+		default: {
+			Fail(tokens, cursor.Offset(), UnexpectedToken(tokens, cursor));
+		}
+		}
+	}
+}
+
+void Assembler::ParseInstruction(TokenStream::Cursor &cursor, const TokenStream &tokens, SymbolTable &symbols,
+		std::vector<Instruction> &records, uint32_t base) {
+	TokenStream::Cursor mnemonic = cursor;
+	uint8_t index = static_cast<uint8_t>(mnemonic.Payload());
+	uint8_t count = ISA::Instructions[ISA::Mnemonics[index].first].operandCount;
+
+	Instruction instruction { .kind = IRKind::Instruction, .offset = base + mnemonic.Offset() };
+	for (uint8_t i = 0; i < count; i++) {
+		if (i == 0) NextToken(cursor, tokens);
+		else NextTokenC(cursor, tokens);
+
+		instruction.operands[i] = ParseOperand(cursor, tokens, symbols, instruction.values[i]);
+	}
+
+	const InstructionDesc *desc = ISA::FindInstruction(index, instruction.operands, count);
+	if (!desc) {
+		Fail(tokens, mnemonic.Offset(), "invalid operands for " + std::string(tokens.Text(mnemonic)) + "!");
+	}
+	instruction.desc = static_cast<uint8_t>(desc - ISA::Instructions);
+	instruction.width = static_cast<ImmediateWidth>(mnemonic.Payload() >> WidthShift);
+	CheckLine(tokens, mnemonic.Offset(), cursor);
+
+	// Values known now take their short form straight away; the rest wait
+	// for Relax, which needs the whole file.
+	uint8_t shortForm = ISA::ShortForms[instruction.desc];
+	if (instruction.width == ImmediateWidth::Byte && shortForm == ISA::NoInstruction) {
+		Fail(tokens, mnemonic.Offset(), "No .B form of " + std::string(desc->mnemonic) + " with these operands");
+	}
+	if (shortForm != ISA::NoInstruction && instruction.width != ImmediateWidth::Word) {
+		Fit fit = FitsShortForm(instruction);
+		if (fit == Fit::No && instruction.width == ImmediateWidth::Byte) {
+			Fail(tokens, mnemonic.Offset(), "Value out of range for .B");
+		}
+		if (fit == Fit::Yes) instruction.desc = shortForm;
+		if (fit == Fit::Later) m_CrossLine = true;
+	}
+
+	records.push_back(instruction);
 }
 
-static void ExpectNextTokenV(int &iter, std::vector<Token> &tokens, TokenType expect) {
-	if (iter + 1 >= tokens.size()) {
-		ERROR("NextToken: Out of range! last token: {0}", TokenTypeToString(tokens[iter].type));
-		exit(1);
+// NAME EQU expression. The value may use constants and labels defined
+// anywhere in the file; ResolveConstants works it out.
+void Assembler::ParseConstant(TokenStream::Cursor &cursor, const TokenStream &tokens, SymbolTable &symbols) {
+	uint32_t start = cursor.Offset();
+	SymbolID symbol = cursor.Payload() != InvalidSymbol ? cursor.Payload() : symbols.Intern(tokens.Text(cursor));
+	NextToken(cursor, tokens);
+	NextToken(cursor, tokens);
+
+	uint32_t offset = cursor.Offset();
+	m_ExpressionNodes.clear();
+	m_ExpressionDepth = 0;
+	ParseExpression(cursor, tokens, symbols, 1, 0);
+	CheckLine(tokens, start, cursor);
+	m_CrossLine = true;
+
+	if (symbol >= m_Constants.size()) m_Constants.resize(symbol + 1, NoExpression);
+	if (m_Constants[symbol] != NoExpression) {
+		Fail(tokens, start, "Duplicate EQU: " + std::string(symbols.Get(symbol).name));
 	}
+	m_Constants[symbol] = m_Expressions.Add(m_ExpressionNodes, offset);
+}
+
+static bool NextIsComma(const TokenStream::Cursor &cursor) {
+	TokenStream::Cursor next = cursor;
+	next.Advance();
+	return !next.AtEnd() && next.Type() == COMMA;
+}
 
-	if (tokens[iter + 1].type == expect) {
+// DB and DW take a list of values, each a record of its own so that labels
+// and expressions work as they do in operands; DB also takes strings, a byte
+// per character. DS count[, fill] reserves count bytes of fill, 0 unless
+// given.
+void Assembler::ParseData(TokenStream::Cursor &cursor, const TokenStream &tokens, SymbolTable &symbols,
+		std::vector<Instruction> &records, uint32_t base) {
+	TokenStream::Cursor directive = cursor;
+	if (directive.Type() == DS) {
+		Instruction space { .kind = IRKind::Space, .offset = base + directive.Offset() };
+		NextToken(cursor, tokens);
+		space.operands[0] = ParseConstantOperand(cursor, tokens, symbols, space.values[0], ValueRange::Count);
+		if (NextIsComma(cursor)) {
+			NextTokenC(cursor, tokens);
+			space.operands[1] = ParseConstantOperand(cursor, tokens, symbols, space.values[1], ValueRange::Fill);
+		}
+		CheckLine(tokens, directive.Offset(), cursor);
+		if (space.operands[0] == OperandKind::Imm && space.operands[1] != OperandKind::Expr) CheckExtent(tokens, space);
+		records.push_back(space);
 		return;
-	} else {
-		ERROR("Expected: {0}, got: {1}", TokenTypeToString(expect), TokenTypeToString(tokens[iter].type));
-		exit(1);
+	}
+
+	ImmediateWidth width = directive.Type() == DB ? ImmediateWidth::Byte : ImmediateWidth::Word;
+	ValueRange range = directive.Type() == DB ? ValueRange::Byte : ValueRange::Word;
+	for (bool first = true; first || NextIsComma(cursor); first = false) {
+		if (first) NextToken(cursor, tokens);
+		else NextTokenC(cursor, tokens);
+
+		if (cursor.Type() == STRING) {
+			std::string_view text = tokens.Text(cursor);
+			if (text.size() < 2 || text.back() != '"') Fail(tokens, cursor.Offset(), "Unterminated string");
+			if (width != ImmediateWidth::Byte) Fail(tokens, cursor.Offset(), "Strings are only allowed in DB");
+			for (char c : text.substr(1, text.size() - 2)) {
+				records.push_back(Instruction { .kind = IRKind::Data, .operands = { OperandKind::Imm }, .width = width,
+					.values = { static_cast<uint8_t>(c) }, .offset = base + cursor.Offset() });
+			}
+			continue;
+		}
+
+		uint32_t offset = cursor.Offset();
+		Instruction data { .kind = IRKind::Data, .width = width, .offset = base + offset };
+		data.operands[0] = ParseOperand(cursor, tokens, symbols, data.values[0], range);
+		if (data.operands[0] == OperandKind::None || data.operands[0] == OperandKind::Reg) {
+			Fail(tokens, cursor.Offset(), "Expected: expression, got: " + TokenTypeToString(cursor.Type()));
+		}
+		// Checked once Relax has placed the labels.
+		if (width == ImmediateWidth::Byte && data.operands[0] != OperandKind::Imm) m_CrossLine = true;
+		records.push_back(data);
+	}
+	CheckLine(tokens, directive.Offset(), cursor);
+}
+
+// INCBIN "file"[, offset[, length]] places length bytes of the file from
+// offset on, by default the rest of it. The file is read through readFile as
+// the line is parsed, and only copied when the image is encoded.
+void Assembler::ParseBinary(TokenStream::Cursor &cursor, const TokenStream &tokens, SymbolTable &symbols,
+		std::vector<Instruction> &records, uint32_t base) {
+	uint32_t start = cursor.Offset();
+	ExpectNextToken(cursor, tokens, STRING);
+	std::string_view text = tokens.Text(cursor);
+	if (text.size() < 2 || text.back() != '"') Fail(tokens, cursor.Offset(), "Unterminated string");
+	std::string_view path = text.substr(1, text.size() - 2);
+
+	std::string_view contents;
+	std::string error;
+	if (!m_Options.readFile) Fail(tokens, cursor.Offset(), "INCBIN needs files, which this assembler can't read");
+	if (!m_Options.readFile(path, contents, error)) Fail(tokens, cursor.Offset(), error);
+
+	Instruction binary { .kind = IRKind::Binary, .values = { static_cast<uint32_t>(m_Blobs.size()) }, .offset = base + start };
+	m_Blobs.push_back(contents);
+	m_Included.emplace_back(path);
+	for (uint8_t i = 1; i < 3 && NextIsComma(cursor); i++) {
+		NextTokenC(cursor, tokens);
+		binary.operands[i] = ParseConstantOperand(cursor, tokens, symbols, binary.values[i]);
+	}
+	CheckLine(tokens, start, cursor);
+	if (binary.operands[1] != OperandKind::Expr && binary.operands[2] != OperandKind::Expr) CheckExtent(tokens, binary);
+	// The file can change without the source doing so.
+	m_CrossLine = true;
+	records.push_back(binary);
+}
+
+// An operand that must be known before Layout. A name becomes an expression
+// too, as it is only known once every constant is.
+OperandKind Assembler::ParseConstantOperand(TokenStream::Cursor &cursor, const TokenStream &tokens, SymbolTable &symbols, uint32_t &value,
+		ValueRange range) {
+	OperandKind kind = ParseOperand(cursor, tokens, symbols, value, range);
+	if (kind == OperandKind::None || kind == OperandKind::Reg) {
+		Fail(tokens, cursor.Offset(), "Expected: expression, got: " + TokenTypeToString(cursor.Type()));
+	}
+	if (kind == OperandKind::Addr) {
+		ExprNode node { .op = ExprOp::Symbol, .value = value };
+		kind = OperandKind::Expr;
+		value = m_Expressions.Add(std::span<const ExprNode>(&node, 1), cursor.Offset());
+	}
+	if (kind != OperandKind::Imm) m_CrossLine = true;
+	return kind;
+}
+
+// Reads the operand at cursor and leaves cursor on its last token. A lone
+// literal or name is taken as is; anything longer is parsed into reverse
+// Polish order and folded to an immediate unless it names a symbol, in which
+// case it is kept as an expression for later. Immediates are checked against
+// range before they are narrowed to 16 bits.
+OperandKind Assembler::ParseOperand(TokenStream::Cursor &cursor, const TokenStream &tokens, SymbolTable &symbols, uint32_t &value,
+		ValueRange range) {
+	TokenType type = cursor.Type();
+	if (type == REG) {
+		value = cursor.Payload();
+		return OperandKind::Reg;
+	}
+	if (!StartsExpression(type)) return OperandKind::None;
+
+	if (!NextIsBinary(cursor)) {
+		switch (type) {
+		case IMMEDIATE:
+		case HEX:
+		case NUMBER: {
+			value = cursor.Payload();
+			CheckRange(tokens, cursor.Offset(), value, range);
+			return OperandKind::Imm;
+		}
+		case LABEL:
+		case UNKNOWN: {
+			value = cursor.Payload() != InvalidSymbol ? cursor.Payload() : symbols.Intern(tokens.Text(cursor));
+			return OperandKind::Addr;
+		}
+		default: break;
+		}
+	}
+
+	uint32_t offset = cursor.Offset();
+	m_ExpressionNodes.clear();
+	m_ExpressionDepth = 0;
+	ParseExpression(cursor, tokens, symbols, 1, 0);
+
+	bool named = std::any_of(m_ExpressionNodes.begin(), m_ExpressionNodes.end(), [](const ExprNode &node) { return node.op == ExprOp::Symbol; });
+	if (named) {
+		m_CrossLine = true;
+		value = m_Expressions.Add(m_ExpressionNodes, offset);
+		return OperandKind::Expr;
+	}
+
+	int64_t result;
+	EvalStatus status = Evaluate(m_ExpressionNodes, [](SymbolID, int64_t &) { return false; }, result);
+	if (status != EvalStatus::Ok) Fail(tokens, offset, DescribeFailure(status));
+	CheckRange(tokens, offset, result, range);
+	value = static_cast<uint16_t>(result);
+	return OperandKind::Imm;
+}
+
+// Precedence climbing, emitting reverse Polish order as it goes.
+void Assembler::ParseExpression(TokenStream::Cursor &cursor, const TokenStream &tokens, SymbolTable &symbols, int precedence, int nesting) {
+	ParsePrimary(cursor, tokens, symbols, nesting);
+	while (true) {
+		TokenStream::Cursor next = cursor;
+		next.Advance();
+		ExprOp op;
+		int binding = next.AtEnd() ? 0 : BinaryPrecedence(next.Type(), op);
+		if (binding == 0 || binding < precedence) return;
+
+		cursor = next;
+		uint32_t offset = cursor.Offset();
+		NextToken(cursor, tokens);
+		ParseExpression(cursor, tokens, symbols, binding + 1, nesting);
+		EmitNode(tokens, offset, ExprNode { .op = op });
+	}
+}
+
+void Assembler::ParsePrimary(TokenStream::Cursor &cursor, const TokenStream &tokens, SymbolTable &symbols, int nesting) {
+	if (nesting > MaxExpressionNesting) Fail(tokens, cursor.Offset(), "Expression nested too deeply");
+
+	switch (cursor.Type()) {
+	case IMMEDIATE:
+	case HEX:
+	case NUMBER: {
+		EmitNode(tokens, cursor.Offset(), ExprNode { .op = ExprOp::Number, .value = cursor.Payload() });
+	} break;
+	case LABEL:
+	case UNKNOWN: {
+		SymbolID symbol = cursor.Payload() != InvalidSymbol ? cursor.Payload() : symbols.Intern(tokens.Text(cursor));
+		EmitNode(tokens, cursor.Offset(), ExprNode { .op = ExprOp::Symbol, .value = symbol });
+	} break;
+	case INVALID: {
+		Fail(tokens, cursor.Offset(), UnexpectedToken(tokens, cursor));
+	}
+	case LPAREN: {
+		NextToken(cursor, tokens);
+		ParseExpression(cursor, tokens, symbols, 1, nesting + 1);
+		ExpectNextToken(cursor, tokens, RPAREN);
+	} break;
+	case PLUS:
+	case MINUS:
+	case TILDE: {
+		TokenType type = cursor.Type();
+		uint32_t offset = cursor.Offset();
+		NextToken(cursor, tokens);
+		ParsePrimary(cursor, tokens, symbols, nesting + 1);
+		if (type != PLUS) EmitNode(tokens, offset, ExprNode { .op = type == MINUS ? ExprOp::Negate : ExprOp::Complement });
+	} break;
+	default:
+		Fail(tokens, cursor.Offset(), "Expected: expression, got: " + TokenTypeToString(cursor.Type()));
+	}
+}
+
+void Assembler::EmitNode(const TokenStream &tokens, uint32_t offset, ExprNode node) {
+	if (node.op == ExprOp::Number || node.op == ExprOp::Symbol) m_ExpressionDepth++;
+	else if (node.op != ExprOp::Negate && node.op != ExprOp::Complement) m_ExpressionDepth--;
+	if (m_ExpressionDepth > MaxExpressionDepth) Fail(tokens, offset, "Expression too complex");
+
+	m_ExpressionNodes.push_back(node);
+}
+
+// Ends the statement at last: anything after it on the same line is left
+// over. Incremental updates re-parse whole lines, which only works while no
+// statement continues onto the next line.
+void Assembler::CheckLine(const TokenStream &tokens, uint32_t start, const TokenStream::Cursor &last) {
+	const char *source = tokens.GetSource().data();
+	uint32_t end = last.Offset() + last.Length();
+	if (end > start && std::memchr(source + start, '\n', end - start)) m_CrossLine = true;
+
+	TokenStream::Cursor next = last;
+	next.Advance();
+	if (!next.AtEnd() && !std::memchr(source + end, '\n', next.Offset() - end)) Fail(tokens, next.Offset(), UnexpectedToken(tokens, next));
+}
+
+// Orders the EQU constants so each comes after the ones it uses, rejecting
+// cycles, and folds every value that doesn't need a label address: such
+// operands become immediates and ORG must be one by now.
+void Assembler::ResolveConstants(const TokenStream &tokens) {
+	if (m_Expressions.Size() == 0) return;
+
+	size_t count = m_Symbols.Size();
+	m_Constants.resize(count, NoExpression);
+	m_ConstantValues.assign(count, 0);
+	m_ConstantKnown.assign(count, 0);
+	auto constant = [this](SymbolID symbol) { return m_Constants[symbol] != NoExpression; };
+	auto resolve = [this](SymbolID symbol, int64_t &value) { return ConstantValue(symbol, false, value); };
+
+	// Depth-first with an explicit stack, since generated sources can chain
+	// constants arbitrarily deep.
+	std::vector<uint8_t> state(count, 0);	// 1 while on the stack, 2 once ordered
+	std::vector<std::pair<SymbolID, uint32_t>> stack;
+	for (SymbolID root = 0; root < count; root++) {
+		if (!constant(root) || state[root]) continue;
+
+		state[root] = 1;
+		stack.emplace_back(root, 0);
+		while (!stack.empty()) {
+			SymbolID symbol = stack.back().first;
+			std::span<const ExprNode> nodes = m_Expressions.Nodes(m_Constants[symbol]);
+			if (stack.back().second < nodes.size()) {
+				const ExprNode &node = nodes[stack.back().second++];
+				if (node.op != ExprOp::Symbol || !constant(node.value)) continue;
+				if (state[node.value] == 1) {
+					Fail(tokens, m_Expressions.Get(m_Constants[symbol]).offset, "Circular EQU: " + std::string(m_Symbols.Get(node.value).name));
+				}
+				if (state[node.value] == 0) {
+					state[node.value] = 1;
+					stack.emplace_back(node.value, 0);
+				}
+				continue;
+			}
+
+			EvalStatus status = Evaluate(nodes, resolve, m_ConstantValues[symbol]);
+			if (status == EvalStatus::Ok) m_ConstantKnown[symbol] = 1;
+			else if (status == EvalStatus::Unresolved) m_LabelConstants.push_back(symbol);
+			else Fail(tokens, m_Expressions.Get(m_Constants[symbol]).offset, DescribeFailure(status));
+			state[symbol] = 2;
+			m_ConstantOrder.push_back(symbol);
+			stack.pop_back();
+		}
+	}
+
+	for (Instruction &instruction : m_Instructions) {
+		for (uint8_t i = 0; i < 3; i++) {
+			OperandKind kind = instruction.operands[i];
+			if (kind != OperandKind::Expr && (kind != OperandKind::Addr || !constant(instruction.values[i]))) continue;
+
+			int64_t value;
+			EvalStatus status = kind == OperandKind::Addr
+				? (ConstantValue(instruction.values[i], false, value) ? EvalStatus::Ok : EvalStatus::Unresolved)
+				: Evaluate(m_Expressions.Nodes(instruction.values[i]), resolve, value);
+			if (status == EvalStatus::Ok) {
+				CheckRange(tokens, instruction.offset, value, OperandRange(instruction, i));
+				instruction.operands[i] = OperandKind::Imm;
+				instruction.values[i] = static_cast<uint16_t>(value);
+			} else if (status != EvalStatus::Unresolved) {
+				Fail(tokens, instruction.offset, DescribeFailure(status));
+			} else if (kind == OperandKind::Addr) {
+				// A constant defined from a label; evaluated with the other
+				// expressions after Layout.
+				ExprNode node { .op = ExprOp::Symbol, .value = instruction.values[i] };
+				instruction.operands[i] = OperandKind::Expr;
+				instruction.values[i] = m_Expressions.Add(std::span<const ExprNode>(&node, 1), instruction.offset);
+			}
+		}
+
+		if (instruction.kind == IRKind::Org && instruction.operands[0] != OperandKind::Imm) {
+			Fail(tokens, instruction.offset, "ORG needs a constant expression");
+		}
+		if (instruction.kind == IRKind::Space || instruction.kind == IRKind::Binary) CheckExtent(tokens, instruction);
 	}
 }
 
-static bool ExpectNextTokenB(int &iter, std::vector<Token> &tokens, TokenType expect) {
-	if (iter + 1 >= tokens.size()) {
-		ERROR("NextToken: Out of range! last token: {0}", TokenTypeToString(tokens[iter].type));
-		exit(1);
+// Layout needs the size of every DS and INCBIN, so their operands must be
+// constants by now. Fills in the length an INCBIN left out.
+void Assembler::CheckExtent(const TokenStream &tokens, Instruction &instruction) const {
+	bool space = instruction.kind == IRKind::Space;
+	for (uint8_t i = 0; i < 3; i++) {
+		OperandKind kind = instruction.operands[i];
+		if (kind != OperandKind::None && kind != OperandKind::Imm) {
+			Fail(tokens, instruction.offset, std::string(space ? "DS" : "INCBIN") + " needs a constant expression");
+		}
+	}
+	if (space) return;
+
+	size_t size = m_Blobs[instruction.values[0]].size();
+	if (instruction.values[1] > size) Fail(tokens, instruction.offset, "INCBIN offset is past the end of the file");
+	if (instruction.operands[2] == OperandKind::None) {
+		if (size - instruction.values[1] > 0x10000) Fail(tokens, instruction.offset, "INCBIN file doesn't fit in memory; give a length");
+		instruction.operands[2] = OperandKind::Imm;
+		instruction.values[2] = static_cast<uint32_t>(size - instruction.values[1]);
+	} else if (instruction.values[1] + instruction.values[2] > size) {
+		Fail(tokens, instruction.offset, "INCBIN reads past the end of the file");
 	}
+}
 
-	if (tokens[iter + 1].type == expect) {
+// The value of an EQU constant or, once Layout has placed them, a label.
+// Constants that use labels are filled in by ResolveExpressions.
+bool Assembler::ConstantValue(SymbolID symbol, bool labelsKnown, int64_t &value) {
+	if (symbol < m_Constants.size() && m_Constants[symbol] != NoExpression) {
+		if (!m_ConstantKnown[symbol]) return false;
+		value = m_ConstantValues[symbol];
 		return true;
 	}
 
-	return false;
+	const Symbol &label = m_Symbols.Get(symbol);
+	if (!labelsKnown || !label.defined) return false;
+	value = label.value;
+	return true;
 }
 
-static std::vector<Token> GetOperands(std::vector<Token>& tokens, int& pos) {
-	std::vector<Token> operands;
-	
-	pos += 1;
+// Evaluates what ResolveConstants left for after Layout. A flat image gets
+// every value; an object gets constants and label differences within a
+// section, while label plus offset becomes a relocation in EmitObject.
+void Assembler::ResolveExpressions(const TokenStream &tokens) {
+	if (m_Expressions.Size() == 0) return;
+
+	m_ExpressionValues.assign(m_Expressions.Size(), 0);
+	for (SymbolID symbol : m_LabelConstants) m_ConstantKnown[symbol] = 0;
+	SymbolID missing = InvalidSymbol;
+	auto resolve = [this, &missing](SymbolID symbol, int64_t &value) {
+		if (ConstantValue(symbol, true, value)) return true;
+		missing = symbol;
+		return false;
+	};
+	auto evaluate = [&](uint32_t expression, uint32_t offset, int64_t &value) {
+		EvalStatus status = Evaluate(m_Expressions.Nodes(expression), resolve, value);
+		if (status == EvalStatus::Unresolved) Fail(tokens, offset, "Invalid LABEL: " + std::string(m_Symbols.Get(missing).name));
+		if (status != EvalStatus::Ok) Fail(tokens, offset, DescribeFailure(status));
+	};
 
-	bool end = false;
-	while (!end) {
-		if (pos >= tokens.size()) {
-			end = true;
-			break;
+	if (m_Options.relocatable) {
+		m_LabelPlaces.assign(m_Symbols.Size(), LabelPlace { .section = NoSection, .offset = 0 });
+		m_SectionLabels.assign(1, InvalidSymbol);
+		uint32_t sectionStart = 0;
+		for (size_t i = 0; i < m_Instructions.size(); i++) {
+			const Instruction &instruction = m_Instructions[i];
+			if (instruction.kind == IRKind::Org) {
+				m_SectionLabels.push_back(InvalidSymbol);
+				sectionStart = m_Offsets[i];
+			} else if (instruction.kind == IRKind::Label) {
+				uint32_t section = static_cast<uint32_t>(m_SectionLabels.size() - 1);
+				m_LabelPlaces[instruction.values[0]] = LabelPlace { .section = section, .offset = m_Offsets[i] - sectionStart };
+				if (m_SectionLabels[section] == InvalidSymbol) m_SectionLabels[section] = instruction.values[0];
+			}
+		}
+	} else {
+		for (SymbolID symbol : m_LabelConstants) {
+			evaluate(m_Constants[symbol], m_Expressions.Get(m_Constants[symbol]).offset, m_ConstantValues[symbol]);
+			m_ConstantKnown[symbol] = 1;
 		}
+	}
 
-		operands.push_back(tokens[pos]);
+	for (const Instruction &instruction : m_Instructions) {
+		for (uint8_t i = 0; i < 3; i++) {
+			if (instruction.operands[i] != OperandKind::Expr) continue;
 
-		if (pos + 1 < tokens.size()) {
-			if (ExpectNextTokenB(pos, tokens, COMMA)) {
-				pos += 1;
+			int64_t value = 0;
+			if (m_Options.relocatable) {
+				SymbolID symbol;
+				EvalStatus status = Relocate(instruction.values[i], symbol, value);
+				if (status != EvalStatus::Ok) Fail(tokens, instruction.offset, DescribeFailure(status));
+				if (symbol != InvalidSymbol) continue;
 			} else {
-				end = true;
+				evaluate(instruction.values[i], instruction.offset, value);
 			}
+			if (!InRange(value)) Fail(tokens, instruction.offset, "Value out of range: " + std::to_string(value));
+			m_ExpressionValues[instruction.values[i]] = static_cast<int32_t>(value);
+		}
+	}
+
+	for (SymbolID symbol : m_ConstantOrder) {
+		if (!m_ConstantKnown[symbol]) continue;
+
+		Symbol &constant = m_Symbols.Get(symbol);
+		constant.value = static_cast<uint16_t>(m_ConstantValues[symbol]);
+		constant.defined = true;
+	}
+}
+
+// Reduces an expression to symbol + addend for a relocation, or to a plain
+// value with symbol left as InvalidSymbol. Labels of this module count as
+// their section's base plus an offset, so differences within one section
+// cancel out; a leftover section base is expressed through a label in it.
+EvalStatus Assembler::Relocate(uint32_t expression, SymbolID &symbol, int64_t &addend) const {
+	SymbolID sectionBase = static_cast<SymbolID>(m_Symbols.Size());
+	std::function<bool(SymbolID, LinearValue &)> resolve = [&](SymbolID id, LinearValue &value) {
+		if (id < m_Constants.size() && m_Constants[id] != NoExpression) {
+			if (m_ConstantKnown[id]) {
+				value.constant = m_ConstantValues[id];
+				return true;
+			}
+			return EvaluateLinear(m_Expressions.Nodes(m_Constants[id]), resolve, value) == EvalStatus::Ok;
+		}
+
+		const LabelPlace &place = m_LabelPlaces[id];
+		if (place.section == NoSection) {
+			value.terms.emplace_back(id, 1);
 		} else {
-			end = true;
+			value.constant = place.offset;
+			value.terms.emplace_back(sectionBase + place.section, 1);
 		}
+		return true;
+	};
 
-		pos++;
+	LinearValue value;
+	EvalStatus status = EvaluateLinear(m_Expressions.Nodes(expression), resolve, value);
+	if (status != EvalStatus::Ok) return status == EvalStatus::Unresolved ? EvalStatus::NotRelocatable : status;
+
+	symbol = InvalidSymbol;
+	addend = value.constant;
+	if (value.terms.empty()) return EvalStatus::Ok;
+	if (value.terms.size() != 1 || value.terms[0].second != 1) return EvalStatus::NotRelocatable;
+
+	symbol = value.terms[0].first;
+	if (symbol >= sectionBase) {
+		symbol = m_SectionLabels[symbol - sectionBase];
+		addend -= m_LabelPlaces[symbol].offset;
 	}
+	return EvalStatus::Ok;
+}
+
+// Picks the short form of every instruction whose immediates fit a byte, then
+// lays out and evaluates expressions. Values that need label addresses start
+// out short and are widened wherever they turn out not to fit, which moves
+// the labels after them; since instructions only ever grow, this settles in
+// at most one round per candidate. Objects keep such values wide, as the
+// linker patches 16-bit fields.
+size_t Assembler::Relax(const TokenStream &tokens) {
+	struct Candidate {
+		size_t index;
+		uint8_t wide;
+	};
+	std::vector<Candidate> pending;
+	for (size_t i = 0; i < m_Instructions.size(); i++) {
+		Instruction &instruction = m_Instructions[i];
+		if (instruction.kind != IRKind::Instruction || instruction.width == ImmediateWidth::Word) continue;
+		uint8_t shortForm = ISA::ShortForms[instruction.desc];
+		if (shortForm == ISA::NoInstruction) continue;
 
-	return operands;
+		Fit fit = FitsShortForm(instruction);
+		if (fit == Fit::Later && m_Options.relocatable) {
+			if (instruction.width == ImmediateWidth::Byte) Fail(tokens, instruction.offset, "Relocated value can't be .B");
+			continue;
+		}
+		if (fit == Fit::No && instruction.width == ImmediateWidth::Byte) {
+			Fail(tokens, instruction.offset, "Value out of range for .B");
+		}
+		if (fit == Fit::No) continue;
+
+		if (fit == Fit::Later) pending.push_back(Candidate { .index = i, .wide = instruction.desc });
+		instruction.desc = shortForm;
+	}
+
+	while (true) {
+		size_t size = Layout(tokens);
+		ResolveExpressions(tokens);
+
+		bool widened = false;
+		for (size_t c = 0; c < pending.size();) {
+			Instruction &instruction = m_Instructions[pending[c].index];
+			const InstructionDesc &desc = instruction.GetDesc();
+			bool fits = true;
+			for (uint8_t i = 0; i < desc.operandCount; i++) {
+				if (desc.operands[i] == OperandKind::Imm8 && OperandValue(instruction, i) > 0xFF) fits = false;
+			}
+			if (fits) {
+				c++;
+				continue;
+			}
+
+			if (instruction.width == ImmediateWidth::Byte) Fail(tokens, instruction.offset, "Value out of range for .B");
+			instruction.desc = pending[c].wide;
+			pending[c] = pending.back();
+			pending.pop_back();
+			widened = true;
+		}
+		if (!widened) {
+			// DB values that needed labels; the linker only patches words.
+			for (const Instruction &instruction : m_Instructions) {
+				if (!IsByteData(instruction) || instruction.operands[0] == OperandKind::Imm) continue;
+
+				if (m_Options.relocatable) {
+					SymbolID symbol = InvalidSymbol;
+					int64_t addend;
+					if (instruction.operands[0] == OperandKind::Addr || Relocate(instruction.values[0], symbol, addend) != EvalStatus::Ok ||
+						symbol != InvalidSymbol) {
+						Fail(tokens, instruction.offset, "Relocated value can't be DB");
+					}
+				}
+				int64_t value = instruction.operands[0] == OperandKind::Expr ? m_ExpressionValues[instruction.values[0]] : OperandValue(instruction, 0);
+				if (!InByteRange(value)) Fail(tokens, instruction.offset, "Value out of range for DB");
+			}
+			return size;
+		}
+
+		for (const Instruction &instruction : m_Instructions) {
+			if (instruction.kind == IRKind::Label) m_Symbols.Get(instruction.values[0]).defined = false;
+		}
+	}
 }
 
-Assemble::Assemble(std::string filePath) {
-	std::vector<Token> tokens = Lexer::LexFile(filePath);
-	
-	std::vector<uint8_t> program;
+// Every ORG starts a segment of the image, whose labels count from its
+// origin; the bytes of all segments are laid out back to back.
+size_t Assembler::Layout(const TokenStream &tokens) {
+	uint16_t org = 0x0000;
+	size_t offset = 0, segmentStart = 0;
+	uint32_t orgOffset = 0;
+	std::vector<uint32_t> orgOffsets;	// per segment, where its ORG is in the source
+	m_Segments.clear();
+	auto closeSegment = [&]() {
+		if (offset == segmentStart) return;
+		m_Segments.push_back(ImageSegment { .origin = org, .offset = static_cast<uint32_t>(segmentStart),
+			.size = static_cast<uint32_t>(offset - segmentStart) });
+		orgOffsets.push_back(orgOffset);
+	};
 
-	int pos = 0;
-	while (pos < tokens.size()) {
-		Token tok = tokens[pos];
-		switch (tok.type) {
-		case ORG: {
-			m_OrgAddr = StringToU16(ExpectNextToken(pos, tokens, HEX).value);
+	m_Offsets.resize(m_Instructions.size());
+	for (size_t i = 0; i < m_Instructions.size(); i++) {
+		const Instruction &instruction = m_Instructions[i];
+		m_Offsets[i] = static_cast<uint32_t>(offset);
+
+		switch (instruction.kind) {
+		case IRKind::Org: {
+			closeSegment();
+			org = static_cast<uint16_t>(instruction.values[0]);
+			segmentStart = offset;
+			orgOffset = instruction.offset;
 		} break;
-		case LABEL: {
-			m_Labels.push_back(Label { .name = tok.value, .addr = static_cast<uint16_t>(m_OrgAddr + program.size()) });
+		case IRKind::Label: {
+			SymbolID id = instruction.values[0];
+			Symbol &label = m_Symbols.Get(id);
+			if (label.defined || (id < m_Constants.size() && m_Constants[id] != NoExpression)) {
+				Fail(tokens, instruction.offset, "Duplicate LABEL: " + std::string(label.name));
+			}
+			if (org + offset - segmentStart > 0xFFFF) {
+				Fail(tokens, instruction.offset, "LABEL past the end of the address space: " + std::string(label.name));
+			}
+			label.value = static_cast<uint16_t>(org + offset - segmentStart);
+			label.defined = true;
 		} break;
-		case OPCODE: {
-			if (tok.value == "MOV") {
-				Token dest = NextToken(pos, tokens);
-				switch (dest.type) {
-				case REG: {
-					Token value = NextTokenC(pos, tokens);
-					switch (value.type) {
-					case IMMEDIATE:
-					case HEX: {
-						program.push_back(MOV_IM);
-						program.push_back(StringToRegister(dest.value));
-						PushNumberU16(program, value);
-					} break;
-					case REG: {
-						program.push_back(MOV_R);
-						program.push_back(StringToRegister(dest.value));
-						program.push_back(StringToRegister(value.value));
-					} break;
-					}
-				} break;
-				default: {
-					ERROR("invalid MOV destination!");
-					exit(1);
-				} break;
-				}
-			} else if (tok.value == "ADD") {
-				Token dest = NextToken(pos, tokens);
-				switch (dest.type) {
-				case REG: {
-					Token value1 = NextTokenC(pos, tokens);
-					switch (value1.type) {
-					case REG: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(ADD_R);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(ADD_RI);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					case IMMEDIATE:
-					case HEX: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(ADD_IR);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(ADD_I);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					}
-				} break;
-				default: {
-					ERROR("invalid ADD destination!");
-					exit(1);
-				} break;
-				}
-			} else if (tok.value == "SUB") {
-				Token dest = NextToken(pos, tokens);
-				switch (dest.type) {
-				case REG: {
-					Token value1 = NextTokenC(pos, tokens);
-					switch (value1.type) {
-					case REG: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(SUB_R);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(SUB_RI);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					case IMMEDIATE:
-					case HEX: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(SUB_IR);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(SUB_I);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					}
-				} break;
-				default: {
-					ERROR("invalid SUB destination!");
-					exit(1);
-				} break;
-				}
-			} else if (tok.value == "MUL") {
-				Token dest = NextToken(pos, tokens);
-				switch (dest.type) {
-				case REG: {
-					Token value1 = NextTokenC(pos, tokens);
-					switch (value1.type) {
-					case REG: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(MUL_R);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(MUL_RI);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					case IMMEDIATE:
-					case HEX: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(MUL_IR);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(MUL_I);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					}
-				} break;
-				default: {
-					ERROR("invalid MUL destination!");
-					exit(1);
-				} break;
-				}
-			} else if (tok.value == "DIV") {
-				Token dest = NextToken(pos, tokens);
-				switch (dest.type) {
-				case REG: {
-					Token value1 = NextTokenC(pos, tokens);
-					switch (value1.type) {
-					case REG: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(DIV_R);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(DIV_RI);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					case IMMEDIATE:
-					case HEX: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(DIV_IR);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(DIV_I);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					}
-				} break;
-				default: {
-					ERROR("invalid DIV destination!");
-					exit(1);
-				} break;
-				}
-			} else if (tok.value == "ADC") {
-				Token dest = NextToken(pos, tokens);
-				switch (dest.type) {
-				case REG: {
-					Token value1 = NextTokenC(pos, tokens);
-					switch (value1.type) {
-					case REG: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(ADC_R);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(ADC_RI);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					case IMMEDIATE:
-					case HEX: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(ADC_IR);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(ADC_I);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					}
-				} break;
-				default: {
-					ERROR("invalid ADC destination!");
-					exit(1);
-				} break;
-				}
-			} else if (tok.value == "SBC") {
-				Token dest = NextToken(pos, tokens);
-				switch (dest.type) {
-				case REG: {
-					Token value1 = NextTokenC(pos, tokens);
-					switch (value1.type) {
-					case REG: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(SBC_R);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(SBC_RI);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					case IMMEDIATE:
-					case HEX: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(SBC_IR);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(SBC_I);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					}
-				} break;
-				default: {
-					ERROR("invalid SBC destination!");
-					exit(1);
-				} break;
-				}
-			} else if (tok.value == "INC") {
-				Token reg = NextToken(pos, tokens);
-
-				program.push_back(INC_R);
-				program.push_back(StringToRegister(reg.value));
-			} else if (tok.value == "DEC") {
-				Token reg = NextToken(pos, tokens);
-
-				program.push_back(DEC_R);
-				program.push_back(StringToRegister(reg.value));
-			} else if (tok.value == "AND") {
-				Token dest = NextToken(pos, tokens);
-				switch (dest.type) {
-				case REG: {
-					Token value1 = NextTokenC(pos, tokens);
-					switch (value1.type) {
-					case REG: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(AND_R);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(AND_RI);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					case IMMEDIATE:
-					case HEX: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(AND_IR);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(AND_I);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					}
-				} break;
-				default: {
-					ERROR("invalid AND destination!");
-					exit(1);
-				} break;
-				}
-			} else if (tok.value == "OR") {
-				Token dest = NextToken(pos, tokens);
-				switch (dest.type) {
-				case REG: {
-					Token value1 = NextTokenC(pos, tokens);
-					switch (value1.type) {
-					case REG: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(OR_R);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(OR_RI);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					case IMMEDIATE:
-					case HEX: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(OR_IR);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(OR_I);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					}
-				} break;
-				default: {
-					ERROR("invalid OR destination!");
-					exit(1);
-				} break;
-				}
-			} else if (tok.value == "XOR") {
-				Token dest = NextToken(pos, tokens);
-				switch (dest.type) {
-				case REG: {
-					Token value1 = NextTokenC(pos, tokens);
-					switch (value1.type) {
-					case REG: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(XOR_R);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(XOR_RI);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					case IMMEDIATE:
-					case HEX: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(XOR_IR);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(XOR_I);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					}
-				} break;
-				default: {
-					ERROR("invalid XOR destination!");
-					exit(1);
-				} break;
-				}
-			} else if (tok.value == "NOT") {
-				Token dest = NextToken(pos, tokens);
-				Token reg = NextTokenC(pos, tokens);
-
-				program.push_back(NOT_R);
-				program.push_back(StringToRegister(dest.value));
-				program.push_back(StringToRegister(reg.value));
-			} else if (tok.value == "SHL") {
-				Token dest = NextToken(pos, tokens);
-				switch (dest.type) {
-				case REG: {
-					Token value1 = NextTokenC(pos, tokens);
-					switch (value1.type) {
-					case REG: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(SHL_R);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(SHL_RI);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					case IMMEDIATE:
-					case HEX: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(SHL_IR);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(SHL_I);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					}
-				} break;
-				default: {
-					ERROR("invalid SHL destination!");
-					exit(1);
-				} break;
-				}
-			} else if (tok.value == "SHR") {
-				Token dest = NextToken(pos, tokens);
-				switch (dest.type) {
-				case REG: {
-					Token value1 = NextTokenC(pos, tokens);
-					switch (value1.type) {
-					case REG: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(SHR_R);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(SHR_RI);
-							program.push_back(StringToRegister(dest.value));
-							program.push_back(StringToRegister(value1.value));
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					case IMMEDIATE:
-					case HEX: {
-						Token value2 = NextTokenC(pos, tokens);
-						switch (value2.type) {
-						case REG: {
-							program.push_back(SHR_IR);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							program.push_back(StringToRegister(value2.value));
-						} break;
-						case IMMEDIATE:
-						case HEX: {
-							program.push_back(SHR_I);
-							program.push_back(StringToRegister(dest.value));
-							PushNumberU16(program, value1);
-							PushNumberU16(program, value2);
-						} break;
-						}
-					} break;
-					}
-				} break;
-				default: {
-					ERROR("invalid SHR destination!");
-					exit(1);
-				} break;
-				}
-			} else if (tok.value == "CMP") {
-				Token value1 = NextToken(pos, tokens);
-				switch (value1.type) {
-				case REG: {
-					Token value2 = NextTokenC(pos, tokens);
-					switch (value2.type) {
-					case REG: {
-						program.push_back(CMP_R);
-						program.push_back(StringToRegister(value1.value));
-						program.push_back(StringToRegister(value2.value));
-					} break;
-					case IMMEDIATE:
-					case HEX: {
-						program.push_back(CMP_RI);
-						program.push_back(StringToRegister(value1.value));
-						PushNumberU16(program, value2);
-					} break;
-					}
-				} break;
-				case IMMEDIATE:
-				case HEX: {
-					Token value2 = NextTokenC(pos, tokens);
-					switch (value2.type) {
-					case REG: {
-						program.push_back(CMP_RI);
-						program.push_back(StringToRegister(value1.value));
-						PushNumberU16(program, value2);
-					} break;
-					}
-				} break;
-				}
-			} else if (tok.value == "IGT") {
-				Token value1 = NextToken(pos, tokens);
-				switch (value1.type) {
-				case REG: {
-					Token value2 = NextTokenC(pos, tokens);
-					switch (value2.type) {
-					case REG: {
-						program.push_back(IGT_R);
-						program.push_back(StringToRegister(value1.value));
-						program.push_back(StringToRegister(value2.value));
-					} break;
-					case IMMEDIATE:
-					case HEX: {
-						program.push_back(IGT_RI);
-						program.push_back(StringToRegister(value1.value));
-						PushNumberU16(program, value2);
-					} break;
-					}
-				} break;
-				case IMMEDIATE:
-				case HEX: {
-					Token value2 = NextTokenC(pos, tokens);
-					switch (value2.type) {
-					case REG: {
-						program.push_back(IGT_RI);
-						program.push_back(StringToRegister(value1.value));
-						PushNumberU16(program, value2);
-					} break;
-					}
-				} break;
-				}
-			} else if (tok.value == "ILT") {
-				Token value1 = NextToken(pos, tokens);
-				switch (value1.type) {
-				case REG: {
-					Token value2 = NextTokenC(pos, tokens);
-					switch (value2.type) {
-					case REG: {
-						program.push_back(ILT_R);
-						program.push_back(StringToRegister(value1.value));
-						program.push_back(StringToRegister(value2.value));
-					} break;
-					case IMMEDIATE:
-					case HEX: {
-						program.push_back(ILT_RI);
-						program.push_back(StringToRegister(value1.value));
-						PushNumberU16(program, value2);
-					} break;
-					}
-				} break;
-				case IMMEDIATE:
-				case HEX: {
-					Token value2 = NextTokenC(pos, tokens);
-					switch (value2.type) {
-					case REG: {
-						program.push_back(ILT_RI);
-						program.push_back(StringToRegister(value1.value));
-						PushNumberU16(program, value2);
-					} break;
-					}
-				} break;
-				}
-			} else if (tok.value == "IGE") {
-				Token value1 = NextToken(pos, tokens);
-				switch (value1.type) {
-				case REG: {
-					Token value2 = NextTokenC(pos, tokens);
-					switch (value2.type) {
-					case REG: {
-						program.push_back(IGE_R);
-						program.push_back(StringToRegister(value1.value));
-						program.push_back(StringToRegister(value2.value));
-					} break;
-					case IMMEDIATE:
-					case HEX: {
-						program.push_back(IGE_RI);
-						program.push_back(StringToRegister(value1.value));
-						PushNumberU16(program, value2);
-					} break;
-					}
-				} break;
-				case IMMEDIATE:
-				case HEX: {
-					Token value2 = NextTokenC(pos, tokens);
-					switch (value2.type) {
-					case REG: {
-						program.push_back(IGE_RI);
-						program.push_back(StringToRegister(value1.value));
-						PushNumberU16(program, value2);
-					} break;
-					}
-				} break;
-				}
-			} else if (tok.value == "ILE") {
-				Token value1 = NextToken(pos, tokens);
-				switch (value1.type) {
-				case REG: {
-					Token value2 = NextTokenC(pos, tokens);
-					switch (value2.type) {
-					case REG: {
-						program.push_back(ILE_R);
-						program.push_back(StringToRegister(value1.value));
-						program.push_back(StringToRegister(value2.value));
-					} break;
-					case IMMEDIATE:
-					case HEX: {
-						program.push_back(ILE_RI);
-						program.push_back(StringToRegister(value1.value));
-						PushNumberU16(program, value2);
-					} break;
-					}
-				} break;
-				case IMMEDIATE:
-				case HEX: {
-					Token value2 = NextTokenC(pos, tokens);
-					switch (value2.type) {
-					case REG: {
-						program.push_back(ILT_RI);
-						program.push_back(StringToRegister(value1.value));
-						PushNumberU16(program, value2);
-					} break;
-					}
-				} break;
-				}
-			} else if (tok.value == "JMP") {
-				GotoLabel(JMP, tokens, program, pos);
-			} else if (tok.value == "JNZ") {
-				GotoLabel(JNZ, tokens, program, pos);
-			} else if (tok.value == "JZ") {
-				GotoLabel(JZ, tokens, program, pos);
-			} else if (tok.value == "JNC") {
-				GotoLabel(JNC, tokens, program, pos);
-			} else if (tok.value == "JC") {
-				GotoLabel(JZ, tokens, program, pos);
-			} else if (tok.value == "JNS") {
-				GotoLabel(JNS, tokens, program, pos);
-			} else if (tok.value == "JS") {
-				GotoLabel(JS, tokens, program, pos);
-			} else if (tok.value == "HLT") {
-				program.push_back(HLT);
-			};
+		default: {
+			offset += instruction.GetSize();
+			if (org + offset - segmentStart > 0x10000) Fail(tokens, instruction.offset, "Segment exceeds address space");
 		} break;
 		}
+	}
+	closeSegment();
 
-		pos++;
+	if (m_Options.relocatable) return offset;
+
+	size_t overlap = FindOverlap(m_Segments);
+	if (overlap != m_Segments.size()) Fail(tokens, orgOffsets[overlap], "ORG region overlaps another");
+
+	for (const Instruction &instruction : m_Instructions) {
+		for (uint8_t i = 0; i < 3; i++) {
+			if (instruction.operands[i] != OperandKind::Addr) continue;
+
+			const Symbol &label = m_Symbols.Get(instruction.values[i]);
+			if (!label.defined) {
+				Fail(tokens, instruction.offset, "Invalid LABEL: " + std::string(label.name));
+			}
+		}
 	}
 
-	// Generate File
-	std::ofstream file("output.bin", std::ios::binary);
-	if (!file) {
-		ERROR("Unabled to open file for write!");
-		exit(1);
+	return offset;
+}
+
+// Every record's offset is known after Layout, so disjoint ranges can be
+// encoded straight into the preallocated image in parallel.
+void Assembler::Encode(std::vector<uint8_t> &program) {
+	static constexpr size_t MinRecordsPerJob = 64 * 1024;
+
+	size_t count = m_Instructions.size();
+	size_t jobs = std::min(ThreadPool::ResolveThreadCount(m_Options.jobs), count / MinRecordsPerJob);
+	if (jobs <= 1) {
+		EncodeRange(0, count, program.data());
+		return;
 	}
 
-	file.write(reinterpret_cast<const char*>(program.data()), program.size());
+	ThreadPool pool(jobs);
+	size_t chunks = jobs * 4;
+	for (size_t chunk = 0; chunk < chunks; chunk++) {
+		size_t begin = count * chunk / chunks;
+		size_t end = count * (chunk + 1) / chunks;
+		pool.Submit([this, begin, end, &program]() { EncodeRange(begin, end, program.data()); });
+	}
+	pool.Wait();
+}
 
-	file.close();
+void Assembler::EncodeRange(size_t begin, size_t end, uint8_t *program) const {
+	for (size_t i = begin; i < end; i++) {
+		const Instruction &instruction = m_Instructions[i];
+		if (instruction.IsData()) EncodeData(instruction, program + m_Offsets[i]);
+		if (instruction.kind != IRKind::Instruction) continue;
+
+		const InstructionDesc &desc = instruction.GetDesc();
+		uint8_t *out = program + m_Offsets[i];
+		*out++ = desc.opcode;
+		for (uint8_t operand = 0; operand < desc.operandCount; operand++) {
+			switch (desc.operands[operand]) {
+			case OperandKind::Reg:
+			case OperandKind::Imm8: {
+				*out++ = static_cast<uint8_t>(OperandValue(instruction, operand));
+			} break;
+			case OperandKind::Imm:
+			case OperandKind::Addr: {
+				WriteU16(out, OperandValue(instruction, operand));
+				out += 2;
+			} break;
+			default: break;
+			}
+		}
+	}
+}
+
+void Assembler::EncodeData(const Instruction &instruction, uint8_t *out) const {
+	switch (instruction.kind) {
+	case IRKind::Data: {
+		if (instruction.width == ImmediateWidth::Byte) *out = static_cast<uint8_t>(OperandValue(instruction, 0));
+		else WriteU16(out, OperandValue(instruction, 0));
+	} break;
+	case IRKind::Space: {
+		std::memset(out, static_cast<uint8_t>(instruction.values[1]), instruction.values[0]);
+	} break;
+	case IRKind::Binary: {
+		// Straight from what readFile handed over, typically a mapping of the
+		// file, so this is the only copy of the bytes.
+		std::memcpy(out, m_Blobs[instruction.values[0]].data() + instruction.values[1], instruction.values[2]);
+	} break;
+	default: break;
+	}
+}
+
+uint16_t Assembler::OperandValue(const Instruction &instruction, uint8_t operand) const {
+	uint32_t value = instruction.values[operand];
+	switch (instruction.operands[operand]) {
+	case OperandKind::Addr: return m_Symbols.Get(value).value;
+	case OperandKind::Expr: return static_cast<uint16_t>(m_ExpressionValues[value]);
+	default: return static_cast<uint16_t>(value);
+	}
 }
 
-void Assemble::GotoLabel(uint8_t opcode, std::vector<Token> tokens, std::vector<uint8_t>& program, int& pos) {
-	uint16_t addr;
-	for (Label label : m_Labels) {
-		if (label.name == ExpectNextToken(pos, tokens, LABEL).value) {
-			addr = label.addr;
-			goto no_error;
+AssembleResult Assemble(std::string_view source, const AssembleOptions &options) {
+	return Assembler(options).Assemble(source);
+}
+
+// Splits the image at every ORG and turns each address operand into a
+// relocation, so the linker can place the code anywhere.
+ObjectFile Assembler::EmitObject(const std::vector<uint8_t> &image) const {
+	ObjectFile object;
+	std::vector<uint32_t> indices(m_Symbols.Size(), UINT32_MAX);
+	auto symbolIndex = [&](SymbolID id) {
+		if (indices[id] == UINT32_MAX) {
+			indices[id] = static_cast<uint32_t>(object.symbols.size());
+			object.symbols.push_back(ObjectSymbol { .name = std::string(m_Symbols.Get(id).name), .section = NoSection, .offset = 0 });
+		}
+		return indices[id];
+	};
+
+	uint32_t sectionStart = 0;
+	object.sections.push_back(ObjectSection { .absolute = false, .origin = 0 });
+	auto closeSection = [&](uint32_t end) {
+		object.sections.back().bytes.assign(image.begin() + sectionStart, image.begin() + end);
+		sectionStart = end;
+	};
+
+	auto relocate = [&](const Instruction &instruction, uint8_t operand, uint32_t section, uint32_t field) {
+		if (instruction.operands[operand] == OperandKind::Addr) {
+			object.relocations.push_back(Relocation { .section = section, .offset = field - sectionStart,
+				.symbol = symbolIndex(instruction.values[operand]), .addend = 0 });
+		} else if (instruction.operands[operand] == OperandKind::Expr) {
+			SymbolID symbol;
+			int64_t addend;
+			Relocate(instruction.values[operand], symbol, addend);
+			if (symbol != InvalidSymbol) {
+				object.relocations.push_back(Relocation { .section = section, .offset = field - sectionStart,
+					.symbol = symbolIndex(symbol), .addend = static_cast<int32_t>(addend) });
+			}
+		}
+	};
+
+	for (size_t i = 0; i < m_Instructions.size(); i++) {
+		const Instruction &instruction = m_Instructions[i];
+		uint32_t section = static_cast<uint32_t>(object.sections.size() - 1);
+
+		switch (instruction.kind) {
+		case IRKind::Org: {
+			closeSection(m_Offsets[i]);
+			object.sections.push_back(ObjectSection { .absolute = true, .origin = static_cast<uint16_t>(instruction.values[0]) });
+		} break;
+		case IRKind::Label: {
+			ObjectSymbol &symbol = object.symbols[symbolIndex(instruction.values[0])];
+			symbol.section = section;
+			symbol.offset = m_Offsets[i] - sectionStart;
+		} break;
+		case IRKind::Instruction: {
+			const InstructionDesc &desc = instruction.GetDesc();
+			uint32_t field = m_Offsets[i] + 1;
+			for (uint8_t operand = 0; operand < desc.operandCount; operand++) {
+				relocate(instruction, operand, section, field);
+				field += OperandSize(desc.operands[operand]);
+			}
+		} break;
+		case IRKind::Data: {
+			// Relax has rejected DB values that would need one.
+			if (instruction.width == ImmediateWidth::Word) relocate(instruction, 0, section, m_Offsets[i]);
+		} break;
+		default: break;
 		}
 	}
+	closeSection(static_cast<uint32_t>(image.size()));
+
+	// Relocated fields hold nothing until link time; keep them zero so the
+	// object doesn't depend on where this module happened to be assembled.
+	for (const Relocation &relocation : object.relocations) {
+		uint8_t *field = object.sections[relocation.section].bytes.data() + relocation.offset;
+		field[0] = 0;
+		field[1] = 0;
+	}
 
-	ERROR("Invalid LABEL!");
-	exit(1);
-no_error:
-	program.push_back(opcode);
-	PushNumberU16(program, Token { .type = IMMEDIATE, .value = std::to_string(addr) });
+	return object;
 }
 
 }
\ No newline at end of file
@@ -1,25 +1,162 @@
 #pragma once
 
+#include <functional>
 #include <string>
+#include <string_view>
+#include <vector>
 
+#include "Arena.h"
+#include "Diagnostic.h"
+#include "Expression.h"
+#include "IR.h"
+#include "Image.h"
 #include "Lexer.h"
+#include "Object.h"
+#include "Optimizer.h"
+#include "SourceMap.h"
+#include "SymbolTable.h"
+#include "TokenStream.h"
 
 namespace REASM {
 
-class Assemble {
+// Bump whenever the same source and options may assemble differently;
+// cached outputs are keyed on it.
+constexpr uint32_t AssemblerVersion = 5;
+
+struct AssembleOptions {
+	// Lexer and encoder threads; 0 picks one per hardware thread.
+	size_t jobs = 1;
+	// Emit an ObjectFile instead of a flat image; labels that are never
+	// defined become external references for the linker.
+	bool relocatable = false;
+	// Run the peephole pass; every change is listed in AssembleResult::rewrites.
+	bool optimize = false;
+	// Fill AssembleResult::map; flat images only.
+	bool sourceMap = false;
+	// Reads a file INCBIN names, as written in the source. contents must stay
+	// valid until Assemble or Update returns. Without one, INCBIN is an error.
+	std::function<bool(std::string_view path, std::string_view &contents, std::string &error)> readFile;
+};
+
+struct AssembledSymbol {
+	std::string name;
+	uint16_t value;
+};
+
+struct AssembleResult {
+	bool success = false;
+	SegmentedImage image;					// empty when relocatable
+	ObjectFile object;						// only when relocatable
+	std::vector<AssembledSymbol> symbols;	// defined labels, in definition order
+	std::vector<Diagnostic> diagnostics;
+	std::vector<Rewrite> rewrites;			// only when optimizing
+	SourceMap map;							// only with sourceMap
+	std::vector<std::string> included;		// files read by INCBIN, which the output depends on too
+};
+
+// What an immediate must fit before it is narrowed to 16 bits.
+enum class ValueRange : uint8_t {
+	Word,	// -32768..0xFFFF
+	Byte,	// a DB value, -128..0xFF
+	Fill,	// a DS fill, as for Byte
+	Count,	// a DS count, 0..0xFFFF
+};
+
+struct UpdateStats {
+	bool incremental;		// false when the whole source was assembled again
+	bool relaidOut;			// edited lines changed size, so every address was recomputed
+	size_t linesRelexed;
+};
+
+// In-memory assembler: never touches the filesystem or exits, failures come
+// back as diagnostics. Reusing one instance across sources keeps its arena
+// and tables warm; an instance is not safe to share between threads.
+class Assembler {
 public:
-	Assemble(std::string FilePath);
+	Assembler(const AssembleOptions &options = {});
+
+	AssembleResult Assemble(std::string_view source);
+	// Assembles a new revision of the source given to the previous Update.
+	// Only the lines that differ are lexed and parsed again, and addresses
+	// are only recomputed when those lines changed size. Falls back to a
+	// full Assemble for -c, -O, errors and for sources where a line's
+	// meaning depends on other lines.
+	AssembleResult Update(std::string_view source);
+	const UpdateStats &GetUpdateStats() const { return m_UpdateStats; }
+
+	void SetOptions(const AssembleOptions &options) { m_Options = options; }
 private:
-	void GotoLabel(uint8_t opcode, std::vector<Token> tokens, std::vector<uint8_t> &program, int &pos);
+	void Reset();
+	AssembleResult Rebuild(std::string_view source);
+	bool UpdateLines(std::string_view source);
+	AssembleResult Snapshot() const;
+	SourceMap MapSource(std::string_view source) const;
+
+	void Parse(const TokenStream &tokens, SymbolTable &symbols, std::vector<Instruction> &records, uint32_t base);
+	void ParseInstruction(TokenStream::Cursor &cursor, const TokenStream &tokens, SymbolTable &symbols,
+		std::vector<Instruction> &records, uint32_t base);
+	void ParseConstant(TokenStream::Cursor &cursor, const TokenStream &tokens, SymbolTable &symbols);
+	void ParseData(TokenStream::Cursor &cursor, const TokenStream &tokens, SymbolTable &symbols,
+		std::vector<Instruction> &records, uint32_t base);
+	void ParseBinary(TokenStream::Cursor &cursor, const TokenStream &tokens, SymbolTable &symbols,
+		std::vector<Instruction> &records, uint32_t base);
+	OperandKind ParseConstantOperand(TokenStream::Cursor &cursor, const TokenStream &tokens, SymbolTable &symbols, uint32_t &value,
+		ValueRange range = ValueRange::Word);
+	OperandKind ParseOperand(TokenStream::Cursor &cursor, const TokenStream &tokens, SymbolTable &symbols, uint32_t &value,
+		ValueRange range = ValueRange::Word);
+	void ParseExpression(TokenStream::Cursor &cursor, const TokenStream &tokens, SymbolTable &symbols, int precedence, int nesting);
+	void ParsePrimary(TokenStream::Cursor &cursor, const TokenStream &tokens, SymbolTable &symbols, int nesting);
+	void EmitNode(const TokenStream &tokens, uint32_t offset, ExprNode node);
+	void CheckLine(const TokenStream &tokens, uint32_t start, const TokenStream::Cursor &last);
+
+	void ResolveConstants(const TokenStream &tokens);
+	void CheckExtent(const TokenStream &tokens, Instruction &instruction) const;
+	void ResolveExpressions(const TokenStream &tokens);
+	bool ConstantValue(SymbolID symbol, bool labelsKnown, int64_t &value);
+	EvalStatus Relocate(uint32_t expression, SymbolID &symbol, int64_t &addend) const;
+	size_t Relax(const TokenStream &tokens);
+	size_t Layout(const TokenStream &tokens);
+	void Encode(std::vector<uint8_t> &program);
+	void EncodeRange(size_t begin, size_t end, uint8_t *program) const;
+	void EncodeData(const Instruction &instruction, uint8_t *out) const;
+	uint16_t OperandValue(const Instruction &instruction, uint8_t operand) const;
+	ObjectFile EmitObject(const std::vector<uint8_t> &image) const;
 private:
-	struct Label {
-		std::string name;
-		uint16_t addr;
+	AssembleOptions m_Options;
+	Arena m_Arena;
+
+	SymbolTable m_Symbols;
+	std::vector<Instruction> m_Instructions;
+	std::vector<uint32_t> m_Offsets;
+	std::vector<ImageSegment> m_Segments;
+	std::vector<std::string_view> m_Blobs;		// INCBIN contents, from readFile
+	std::vector<std::string> m_Included;
+
+	// Expressions and EQU constants
+	ExpressionPool m_Expressions;
+	std::vector<ExprNode> m_ExpressionNodes;	// the one being parsed
+	size_t m_ExpressionDepth = 0;
+	std::vector<uint32_t> m_Constants;			// EQU expression per SymbolID, or NoExpression
+	std::vector<SymbolID> m_ConstantOrder;		// each after the constants it uses
+	std::vector<SymbolID> m_LabelConstants;		// the ones that need label addresses, in that order
+	std::vector<int64_t> m_ConstantValues;
+	std::vector<uint8_t> m_ConstantKnown;
+	std::vector<int32_t> m_ExpressionValues;		// per expression, after Layout
+	struct LabelPlace {
+		uint32_t section;
+		uint32_t offset;
 	};
-private:
-	uint16_t m_OrgAddr = 0x0000;
+	std::vector<LabelPlace> m_LabelPlaces;		// per SymbolID, only when relocatable
+	std::vector<SymbolID> m_SectionLabels;		// a label defined in each section
 
-	std::vector<Label> m_Labels;
+	// State kept between Updates
+	bool m_Incremental = false;
+	bool m_CrossLine = false;	// a statement spans lines, or a stray identifier
+	std::string m_Source;
+	std::vector<uint8_t> m_Image;
+	UpdateStats m_UpdateStats {};
 };
 
+AssembleResult Assemble(std::string_view source, const AssembleOptions &options = {});
+
 }
\ No newline at end of file
@@ -0,0 +1,583 @@
+#include "Batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <mutex>
+
+#include "ThreadPool.h"
+
+// The kernels are written once against a vector of lanes: GCC and Clang have
+// GNU vector extensions and lower them to whatever the target offers; other
+// compilers get an array of lanes and loops.
+#if defined(__GNUC__)
+#define REASM_VECTOR_EXTENSIONS 1
+#endif
+
+// On x86-64 ELF targets the warp loop is also built for AVX2 and the copy to
+// run is picked when the program loads.
+#if defined(REASM_VECTOR_EXTENSIONS) && defined(__x86_64__) && defined(__ELF__)
+#define REASM_BATCH_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define REASM_BATCH_CLONES
+#endif
+
+namespace REASM {
+
+static constexpr size_t LaneCount = BatchEmulator::LaneCount;
+static constexpr size_t PageSize = 256;
+static constexpr size_t PageCount = MemorySize / PageSize;
+static constexpr uint16_t SharedPage = 0;
+
+// Lane counts are kept in 16 bits and folded into 64-bit totals this often.
+static constexpr uint32_t FoldInterval = 0xFFFF;
+
+// Vectors never cross a function boundary: passing one by value would change
+// with the instruction set the caller was built for, so the kernels are
+// macros like Emulator's handlers. Comparisons give 0xFFFF in a lane where
+// they hold.
+#ifdef REASM_VECTOR_EXTENSIONS
+typedef uint16_t Lanes __attribute__((vector_size(LaneCount * sizeof(uint16_t))));
+typedef uint32_t WideLanes __attribute__((vector_size(LaneCount * sizeof(uint32_t))));
+
+#define SPLAT(value) (Lanes {} + static_cast<uint16_t>(value))
+#define SPLAT_WIDE(value) (WideLanes {} + static_cast<uint32_t>(value))
+#define LESS(x, y) ((Lanes)((x) < (y)))
+#define EQUAL(x, y) ((Lanes)((x) == (y)))
+#define WIDEN(x) __builtin_convertvector((x), WideLanes)
+#define NARROW(x) __builtin_convertvector((x), Lanes)
+
+static_assert(LaneCount == 16, "The reductions below halve 16 lanes");
+
+static uint16_t Minimum(const Lanes &lanes) {
+	Lanes x = lanes, y;
+	y = __builtin_shufflevector(x, x, 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+	x = x < y ? x : y;
+	y = __builtin_shufflevector(x, x, 4, 5, 6, 7, 0, 1, 2, 3, 12, 13, 14, 15, 8, 9, 10, 11);
+	x = x < y ? x : y;
+	y = __builtin_shufflevector(x, x, 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+	x = x < y ? x : y;
+	y = __builtin_shufflevector(x, x, 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	x = x < y ? x : y;
+	return x[0];
+}
+
+static bool None(const Lanes &lanes) {
+	typedef uint64_t Words __attribute__((vector_size(sizeof(Lanes))));
+	Words words = (Words)lanes;
+	return (words[0] | words[1] | words[2] | words[3]) == 0;
+}
+#else
+template<typename T>
+struct LaneArray {
+	T lane[LaneCount];
+
+	LaneArray() = default;
+	LaneArray(T value) { for (T &element : lane) element = value; }
+
+	T &operator[](size_t index) { return lane[index]; }
+	const T &operator[](size_t index) const { return lane[index]; }
+
+	friend LaneArray operator~(LaneArray x) {
+		for (T &element : x.lane) element = static_cast<T>(~element);
+		return x;
+	}
+
+#define REASM_LANE_OPERATOR(op) \
+	friend LaneArray operator op(LaneArray x, const LaneArray &y) { \
+		for (size_t i = 0; i < LaneCount; i++) x.lane[i] = static_cast<T>(x.lane[i] op y.lane[i]); \
+		return x; \
+	} \
+	LaneArray &operator op##=(const LaneArray &y) { return *this = *this op y; }
+
+	REASM_LANE_OPERATOR(+)
+	REASM_LANE_OPERATOR(-)
+	REASM_LANE_OPERATOR(*)
+	REASM_LANE_OPERATOR(&)
+	REASM_LANE_OPERATOR(|)
+	REASM_LANE_OPERATOR(^)
+	REASM_LANE_OPERATOR(<<)
+	REASM_LANE_OPERATOR(>>)
+#undef REASM_LANE_OPERATOR
+};
+
+typedef LaneArray<uint16_t> Lanes;
+typedef LaneArray<uint32_t> WideLanes;
+
+template<typename T>
+static LaneArray<T> Less(const LaneArray<T> &x, const LaneArray<T> &y) {
+	LaneArray<T> result;
+	for (size_t i = 0; i < LaneCount; i++) result[i] = x[i] < y[i] ? static_cast<T>(~T {}) : T {};
+	return result;
+}
+
+template<typename T>
+static LaneArray<T> Equal(const LaneArray<T> &x, const LaneArray<T> &y) {
+	LaneArray<T> result;
+	for (size_t i = 0; i < LaneCount; i++) result[i] = x[i] == y[i] ? static_cast<T>(~T {}) : T {};
+	return result;
+}
+
+template<typename To, typename From>
+static To Convert(const From &from) {
+	To to;
+	for (size_t i = 0; i < LaneCount; i++) to[i] = static_cast<decltype(+to[i])>(from[i]);
+	return to;
+}
+
+static uint16_t Minimum(const Lanes &lanes) {
+	return *std::min_element(std::begin(lanes.lane), std::end(lanes.lane));
+}
+
+static bool None(const Lanes &lanes) {
+	return std::all_of(std::begin(lanes.lane), std::end(lanes.lane), [](uint16_t lane) { return lane == 0; });
+}
+
+#define SPLAT(value) Lanes(static_cast<uint16_t>(value))
+#define SPLAT_WIDE(value) WideLanes(static_cast<uint32_t>(value))
+#define LESS(x, y) Less<uint16_t>((x), (y))
+#define EQUAL(x, y) Equal<uint16_t>((x), (y))
+#define WIDEN(x) Convert<WideLanes>(x)
+#define NARROW(x) Convert<Lanes>(x)
+#endif
+
+#define SELECT(mask, x, y) (((x) & (mask)) | ((y) & ~(mask)))
+
+class BatchEmulator::Runner {
+public:
+	Runner(const BatchEmulator &batch, std::span<const RegisterFile> instances, std::span<BatchOutcome> outcomes, uint64_t limit);
+
+	REASM_BATCH_CLONES void RunWarp(size_t warp);
+	const BatchStats &GetStats() const { return m_Stats; }
+private:
+	const Emulator::Decoded &Fetch(uint16_t address);
+	void MarkCode(uint16_t address);
+
+	uint8_t ReadByte(size_t lane, uint16_t address) const;
+	void WriteByte(size_t lane, uint16_t address, uint8_t value);
+	uint16_t LoadWord(size_t lane, uint16_t address) const;
+	void Store(size_t lane, uint16_t address, uint16_t value);
+
+	uint64_t Count(size_t lane) const { return m_Totals[lane] + m_Counted[lane]; }
+	MachineState LaneState(size_t lane) const;
+	void Retire(size_t lane, StopReason reason, uint64_t instructions);
+	void Detach(size_t lane);
+private:
+	const BatchEmulator &m_Batch;
+	std::span<const RegisterFile> m_Instances;
+	std::span<BatchOutcome> m_Outcomes;
+	uint64_t m_Limit;
+
+	// Holds the image, never written, and decodes it for every lane.
+	Emulator m_Decoder;
+	std::unique_ptr<Emulator> m_Scalar;		// runs detached lanes
+	std::vector<uint8_t> m_Decoded;			// per address: decoded by m_Decoder
+	std::vector<uint8_t> m_IsCode;			// per address: read by a decoded instruction
+
+	// One warp's state, a vector per field with an instance per lane.
+	Lanes m_Registers[RegisterCount];
+	Lanes m_PC, m_SP;
+	Lanes m_FlagsLow, m_FlagsHigh;	// bits 0-15 and 16-31 of MachineState::flags
+	Lanes m_Active;
+	Lanes m_Counted;
+	uint64_t m_Totals[LaneCount];
+	size_t m_First = 0;
+	size_t m_Live = 0;
+
+	// A lane's writes go to its own copies of the pages it touches.
+	uint16_t m_PageOf[LaneCount][PageCount];	// SharedPage or 1 + index into m_Pages
+	std::vector<std::array<uint8_t, PageSize>> m_Pages;
+	uint32_t m_WroteCode = 0;	// lanes whose last write changed a code byte
+
+	BatchStats m_Stats {};
+};
+
+BatchEmulator::Runner::Runner(const BatchEmulator &batch, std::span<const RegisterFile> instances, std::span<BatchOutcome> outcomes, uint64_t limit)
+	: m_Batch(batch), m_Instances(instances), m_Outcomes(outcomes), m_Limit(limit), m_Decoded(MemorySize), m_IsCode(MemorySize) {
+	m_Decoder.Load(batch.m_Image, batch.m_Origin);
+}
+
+const Emulator::Decoded &BatchEmulator::Runner::Fetch(uint16_t address) {
+	if (!m_Decoded[address]) {
+		m_Decoder.Decode(address);
+		m_Decoded[address] = 1;
+		MarkCode(address);
+	}
+	return m_Decoder.m_Code[address];
+}
+
+// Marks the bytes an instruction is decoded from. Lanes that already wrote
+// something else there would decode it differently, so they leave.
+void BatchEmulator::Runner::MarkCode(uint16_t address) {
+	const uint8_t *image = m_Decoder.m_Memory.get();
+	uint8_t row = ISA::OpcodeTable[image[address]];
+	size_t size = row == ISA::NoInstruction ? 1 : std::min<size_t>(ISA::Instructions[row].size, MemorySize - address);
+	for (size_t i = 0; i < size; i++) m_IsCode[address + i] = 1;
+
+	for (size_t lane = 0; lane < LaneCount; lane++) {
+		if (!m_Active[lane]) continue;
+		for (size_t i = 0; i < size; i++) {
+			uint16_t byte = static_cast<uint16_t>(address + i);
+			if (ReadByte(lane, byte) != image[byte]) {
+				Detach(lane);
+				break;
+			}
+		}
+	}
+}
+
+uint8_t BatchEmulator::Runner::ReadByte(size_t lane, uint16_t address) const {
+	uint16_t page = m_PageOf[lane][address / PageSize];
+	if (page == SharedPage) return m_Decoder.m_Memory[address];
+	return m_Pages[page - 1][address % PageSize];
+}
+
+void BatchEmulator::Runner::WriteByte(size_t lane, uint16_t address, uint8_t value) {
+	const uint8_t *image = m_Decoder.m_Memory.get();
+	uint16_t &page = m_PageOf[lane][address / PageSize];
+	if (page == SharedPage) {
+		m_Pages.emplace_back();
+		std::memcpy(m_Pages.back().data(), image + address / PageSize * PageSize, PageSize);
+		page = static_cast<uint16_t>(m_Pages.size());
+	}
+	m_Pages[page - 1][address % PageSize] = value;
+	if (m_IsCode[address] && value != image[address]) m_WroteCode |= 1u << lane;
+}
+
+uint16_t BatchEmulator::Runner::LoadWord(size_t lane, uint16_t address) const {
+	return static_cast<uint16_t>(ReadByte(lane, address) | ReadByte(lane, static_cast<uint16_t>(address + 1)) << 8);
+}
+
+void BatchEmulator::Runner::Store(size_t lane, uint16_t address, uint16_t value) {
+	WriteByte(lane, address, static_cast<uint8_t>(value));
+	WriteByte(lane, static_cast<uint16_t>(address + 1), static_cast<uint8_t>(value >> 8));
+}
+
+MachineState BatchEmulator::Runner::LaneState(size_t lane) const {
+	MachineState state;
+	for (size_t i = 0; i < RegisterCount; i++) state.registers[i] = m_Registers[i][lane];
+	state.pc = m_PC[lane];
+	state.sp = m_SP[lane];
+	state.flags = m_FlagsLow[lane] | static_cast<uint32_t>(m_FlagsHigh[lane]) << 16;
+	return state;
+}
+
+void BatchEmulator::Runner::Retire(size_t lane, StopReason reason, uint64_t instructions) {
+	m_Outcomes[m_First + lane] = BatchOutcome { .result = { reason, instructions }, .state = LaneState(lane) };
+	m_Active[lane] = 0;
+	m_Live--;
+	m_Stats.issued += instructions;
+}
+
+// Finishes a lane on its own Emulator, from its state and its view of memory.
+void BatchEmulator::Runner::Detach(size_t lane) {
+	if (!m_Scalar) m_Scalar = std::make_unique<Emulator>();
+	Emulator &scalar = *m_Scalar;
+	scalar.Load(m_Batch.m_Image, m_Batch.m_Origin);
+	for (size_t page = 0; page < PageCount; page++) {
+		if (m_PageOf[lane][page] == SharedPage) continue;
+		std::memcpy(scalar.m_Memory.get() + page * PageSize, m_Pages[m_PageOf[lane][page] - 1].data(), PageSize);
+	}
+	scalar.m_State = LaneState(lane);
+
+	uint64_t count = Count(lane);
+	RunResult result = scalar.Run(m_Limit - count);
+	m_Outcomes[m_First + lane] = BatchOutcome { .result = { result.reason, count + result.instructions }, .state = scalar.m_State };
+	m_Active[lane] = 0;
+	m_Live--;
+	m_Stats.issued += count;
+	m_Stats.detached++;
+}
+
+void BatchEmulator::Runner::RunWarp(size_t warp) {
+	m_First = warp * LaneCount;
+	m_Live = std::min(LaneCount, m_Instances.size() - m_First);
+	const Lanes zero = SPLAT(0), one = SPLAT(1);
+
+	for (size_t i = 0; i < RegisterCount; i++) {
+		for (size_t lane = 0; lane < LaneCount; lane++) m_Registers[i][lane] = lane < m_Live ? m_Instances[m_First + lane][i] : 0;
+	}
+	m_PC = SPLAT(m_Batch.m_Origin);
+	m_SP = m_FlagsLow = m_FlagsHigh = m_Counted = zero;
+	m_Active = zero;
+	for (size_t lane = 0; lane < m_Live; lane++) m_Active[lane] = 0xFFFF;
+	std::fill(std::begin(m_Totals), std::end(m_Totals), 0);
+	std::memset(m_PageOf, 0, sizeof(m_PageOf));
+	m_Pages.clear();
+
+	uint64_t steps = 0;
+	uint32_t sinceFold = 0;
+	uint16_t pc = m_Batch.m_Origin;
+	bool together = true;	// every active lane is at pc
+	while (m_Live > 0) {
+		// No lane has run more instructions than the warp has issued.
+		if (steps >= m_Limit) {
+			for (size_t lane = 0; lane < LaneCount; lane++) {
+				if (m_Active[lane] && Count(lane) >= m_Limit) Retire(lane, StopReason::Limit, Count(lane));
+			}
+			if (m_Live == 0) break;
+		}
+
+		// While the lanes agree on pc it is followed as a scalar. Otherwise the
+		// lowest goes next, so lanes that took different paths wait for each
+		// other at the first instruction they have in common.
+		Lanes mask = m_Active;
+		if (!together) {
+			pc = Minimum(m_PC | ~m_Active);
+			mask &= EQUAL(m_PC, SPLAT(pc));
+			together = None(m_Active & ~mask);
+		}
+
+		size_t live = m_Live;
+		const Emulator::Decoded *d = &Fetch(pc);
+		const Emulator::Decoded *skipped = nullptr;
+		uint16_t next = static_cast<uint16_t>(pc + d->size);
+		if (d->op < ISA::InstructionCount && ISA::Instructions[d->op].effects & SkipsNext) skipped = &Fetch(next);
+		// Decoding for the first time may have detached lanes.
+		if (m_Live != live) {
+			mask &= m_Active;
+			if (None(mask)) continue;
+		}
+
+		m_Counted += mask & one;
+		steps++;
+		if (++sinceFold == FoldInterval) {
+			for (size_t lane = 0; lane < LaneCount; lane++) m_Totals[lane] += m_Counted[lane];
+			m_Counted = zero;
+			sinceFold = 0;
+		}
+
+		if (d->op >= ISA::InstructionCount) {
+			for (size_t lane = 0; lane < LaneCount; lane++) {
+				if (mask[lane]) Retire(lane, StopReason::InvalidInstruction, Count(lane) - 1);
+			}
+			continue;
+		}
+
+		Lanes target = SPLAT(next);
+		uint16_t following = next;	// where all of mask goes, if together
+		Lanes value, high;
+
+#define REG(index) m_Registers[index]
+#define IMM(field) SPLAT(field)
+#define WRITE(dest, x) dest = SELECT(mask, x, dest)
+#define SET_FLAGS() { WRITE(m_FlagsLow, value); WRITE(m_FlagsHigh, high); }
+#define ALU(kernel, dest, x, y) { kernel(x, y); WRITE(REG(dest), value); SET_FLAGS(); } break;
+
+	// Each family comes in four forms: both sources registers, the second an
+	// immediate, the first an immediate, or both immediates.
+#define FORMS(name, kernel) \
+		case name##_R: ALU(kernel, d->a, REG(d->b), REG(d->c)) \
+		case name##_RI: ALU(kernel, d->a, REG(d->b), IMM(d->c)) \
+		case name##_IR: ALU(kernel, d->a, IMM(d->b), REG(d->c)) \
+		case name##_I: ALU(kernel, d->a, IMM(d->b), IMM(d->c))
+
+	// Each kernel leaves the result in value and the flags' upper half in
+	// high, which is what the Emulator's 32-bit flags hold above the result:
+	// a carry of 1, a borrow of 0xFFFF, or what SHL shifted past bit 15. The
+	// shifts work in 32-bit lanes, where AVX2 has per-lane counts, and only
+	// compare in 16-bit ones; SHR shifts the value doubled, which leaves the
+	// last bit out in bit 0.
+#define ADD(x, y) { Lanes a = (x), b = (y); value = a + b; high = LESS(value, a) & one; }
+#define SUB(x, y) { Lanes a = (x), b = (y); value = a - b; high = LESS(a, b); }
+#define ADC(x, y) { \
+		Lanes a = (x), b = (y), sum = a + b; \
+		value = sum + (m_FlagsHigh & one); \
+		high = (LESS(sum, a) | LESS(value, sum)) & one; \
+	}
+#define SBC(x, y) { \
+		Lanes a = (x), b = (y), difference = a - b, borrow = m_FlagsHigh & one; \
+		value = difference - borrow; \
+		high = LESS(a, b) | LESS(difference, borrow); \
+	}
+#define MUL(x, y) { \
+		WideLanes product = WIDEN(x) * WIDEN(y); \
+		value = NARROW(product); \
+		high = ~EQUAL(NARROW(product >> SPLAT_WIDE(16)), zero) & one; \
+	}
+#define AND(x, y) { value = (x) & (y); high = zero; }
+#define OR(x, y) { value = (x) | (y); high = zero; }
+#define XOR(x, y) { value = (x) ^ (y); high = zero; }
+#define SHL(x, y) { \
+		Lanes count = (y), in = LESS(count, SPLAT(32)); \
+		WideLanes shifted = WIDEN(x) << (WIDEN(count) & SPLAT_WIDE(31)); \
+		value = NARROW(shifted) & in; \
+		high = NARROW(shifted >> SPLAT_WIDE(16)) & in; \
+	}
+#define SHR(x, y) { \
+		Lanes count = (y), in = LESS(count, SPLAT(32)); \
+		WideLanes doubled = (WIDEN(x) << SPLAT_WIDE(1)) >> (WIDEN(count) & SPLAT_WIDE(31)); \
+		value = NARROW(doubled >> SPLAT_WIDE(1)) & in; \
+		high = NARROW(doubled) & one & in; \
+	}
+	// Division has no vector form, so it goes lane by lane.
+#define DIV(x, y) { \
+		Lanes a = (x), b = (y); \
+		value = zero; \
+		high = zero; \
+		for (size_t lane = 0; lane < LaneCount; lane++) { \
+			if (!mask[lane]) continue; \
+			if (b[lane] == 0) { \
+				Retire(lane, StopReason::DivideByZero, Count(lane) - 1); \
+				mask[lane] = 0; \
+				continue; \
+			} \
+			value[lane] = static_cast<uint16_t>(a[lane] / b[lane]); \
+		} \
+	}
+
+#define BRANCH(condition, to) { \
+		Lanes taken = (condition) & mask; \
+		target = SELECT(taken, SPLAT(to), target); \
+		if (None(mask & ~taken)) following = (to); \
+		else if (!None(taken)) together = false; \
+	} break;
+#define SKIP_UNLESS(condition) BRANCH(~(condition), next + skipped->size)
+#define JUMP_IF(condition) BRANCH(condition, d->a)
+#define PUSH(x) { \
+		Lanes pushed = (x); \
+		for (size_t lane = 0; lane < LaneCount; lane++) { \
+			if (!mask[lane]) continue; \
+			m_SP[lane] = static_cast<uint16_t>(m_SP[lane] - 2); \
+			Store(lane, m_SP[lane], pushed[lane]); \
+		} \
+	} break;
+
+		switch (ISA::Instructions[d->op].opcode) {
+		case MOV_IM: WRITE(REG(d->a), IMM(d->b)); break;
+		case MOV_R: WRITE(REG(d->a), REG(d->b)); break;
+
+		FORMS(ADD, ADD)
+		FORMS(SUB, SUB)
+		FORMS(ADC, ADC)
+		FORMS(SBC, SBC)
+		FORMS(MUL, MUL)
+		FORMS(DIV, DIV)
+		FORMS(AND, AND)
+		FORMS(OR, OR)
+		FORMS(XOR, XOR)
+		FORMS(SHL, SHL)
+		FORMS(SHR, SHR)
+
+		case DEC_R: ALU(SUB, d->a, REG(d->a), one)
+		case INC_R: ALU(ADD, d->a, REG(d->a), one)
+		case NOT_R: { value = ~REG(d->b); high = zero; WRITE(REG(d->a), value); SET_FLAGS(); } break;
+
+		case CMP_R: { SUB(REG(d->a), REG(d->b)); SET_FLAGS(); } break;
+		case CMP_RI: { SUB(REG(d->a), IMM(d->b)); SET_FLAGS(); } break;
+
+		case IGT_R: SKIP_UNLESS(LESS(REG(d->b), REG(d->a)))
+		case IGT_RI: SKIP_UNLESS(LESS(IMM(d->b), REG(d->a)))
+		case ILT_R: SKIP_UNLESS(LESS(REG(d->a), REG(d->b)))
+		case ILT_RI: SKIP_UNLESS(LESS(REG(d->a), IMM(d->b)))
+		case IGE_R: SKIP_UNLESS(~LESS(REG(d->a), REG(d->b)))
+		case IGE_RI: SKIP_UNLESS(~LESS(REG(d->a), IMM(d->b)))
+		case ILE_R: SKIP_UNLESS(~LESS(REG(d->b), REG(d->a)))
+		case ILE_RI: SKIP_UNLESS(~LESS(IMM(d->b), REG(d->a)))
+
+		case JMP: target = SPLAT(d->a); following = d->a; break;
+		case JNZ: JUMP_IF(~EQUAL(m_FlagsLow, zero))
+		case JZ: JUMP_IF(EQUAL(m_FlagsLow, zero))
+		case JNS: JUMP_IF(EQUAL(m_FlagsLow & SPLAT(0x8000), zero))
+		case JS: JUMP_IF(~EQUAL(m_FlagsLow & SPLAT(0x8000), zero))
+		case JNC: JUMP_IF(EQUAL(m_FlagsHigh & one, zero))
+		case JC: JUMP_IF(~EQUAL(m_FlagsHigh & one, zero))
+
+		case PUSH_R: PUSH(REG(d->a))
+		case PUSH_IM_W: PUSH(IMM(d->a))
+		case PUSH_IM_B: PUSH(IMM(d->a))
+		case POP_R: {
+			for (size_t lane = 0; lane < LaneCount; lane++) {
+				if (!mask[lane]) continue;
+				m_Registers[d->a][lane] = LoadWord(lane, m_SP[lane]);
+				m_SP[lane] = static_cast<uint16_t>(m_SP[lane] + 2);
+			}
+		} break;
+
+		case HLT: {
+			for (size_t lane = 0; lane < LaneCount; lane++) {
+				if (mask[lane]) Retire(lane, StopReason::Halted, Count(lane));
+			}
+			mask = zero;
+		} break;
+		default: break;
+		}
+		WRITE(m_PC, target);
+		pc = following;
+
+		// A lane that changed code can't share decoded instructions any more.
+		while (m_WroteCode) {
+			size_t lane = static_cast<size_t>(std::countr_zero(m_WroteCode));
+			m_WroteCode &= m_WroteCode - 1;
+			Detach(lane);
+		}
+
+#undef REG
+#undef IMM
+#undef WRITE
+#undef SET_FLAGS
+#undef ALU
+#undef FORMS
+#undef ADD
+#undef SUB
+#undef ADC
+#undef SBC
+#undef MUL
+#undef AND
+#undef OR
+#undef XOR
+#undef SHL
+#undef SHR
+#undef DIV
+#undef BRANCH
+#undef SKIP_UNLESS
+#undef JUMP_IF
+#undef PUSH
+	}
+
+	m_Stats.steps += steps;
+}
+
+bool BatchEmulator::Load(std::span<const uint8_t> image, uint16_t origin) {
+	if (image.size() > MemorySize - origin) return false;
+
+	m_Image.assign(image.begin(), image.end());
+	m_Origin = origin;
+	return true;
+}
+
+std::vector<BatchOutcome> BatchEmulator::Run(std::span<const RegisterFile> instances, uint64_t limit, size_t jobs) {
+	std::vector<BatchOutcome> outcomes(instances.size());
+	m_Stats = BatchStats {};
+
+	size_t warps = (instances.size() + LaneCount - 1) / LaneCount;
+	size_t threads = std::min(ThreadPool::ResolveThreadCount(jobs), warps);
+	if (threads <= 1) {
+		auto runner = std::make_unique<Runner>(*this, instances, outcomes, limit);
+		for (size_t warp = 0; warp < warps; warp++) runner->RunWarp(warp);
+		m_Stats = runner->GetStats();
+		return outcomes;
+	}
+
+	// Warps are handed out one at a time, since how long one runs depends on
+	// its instances.
+	std::atomic<size_t> nextWarp = 0;
+	std::mutex statsMutex;
+	ThreadPool pool(threads);
+	for (size_t thread = 0; thread < threads; thread++) {
+		pool.Submit([&]() {
+			auto runner = std::make_unique<Runner>(*this, instances, outcomes, limit);
+			for (size_t warp; (warp = nextWarp.fetch_add(1)) < warps;) runner->RunWarp(warp);
+
+			std::lock_guard<std::mutex> lock(statsMutex);
+			m_Stats.steps += runner->GetStats().steps;
+			m_Stats.issued += runner->GetStats().issued;
+			m_Stats.detached += runner->GetStats().detached;
+		});
+	}
+	pool.Wait();
+	return outcomes;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <span>
+#include <vector>
+
+#include "Emulator.h"
+
+namespace REASM {
+
+using RegisterFile = std::array<uint16_t, RegisterCount>;
+
+struct BatchOutcome {
+	RunResult result;
+	MachineState state;
+};
+
+struct BatchStats {
+	uint64_t steps;		// instructions issued to a warp, each for all of its lanes at that pc
+	uint64_t issued;	// instance instructions run in warps; steps * LaneCount if none ever waited
+	size_t detached;	// instances that finished on an Emulator
+};
+
+// Runs one image for many instances that differ only in their starting
+// registers. Instances go in warps of LaneCount, whose registers, pc, sp and
+// flags are kept as one vector per field. Each step issues the instruction
+// at the lowest pc any lane of the warp is at, for the lanes that are there;
+// the rest wait, so lanes that branched apart meet again at the first
+// instruction they share. The ALU kernels work on whole vectors, built for
+// AVX2 where the compiler can pick it at run time.
+//
+// Stack writes go to per-lane copies of the pages they touch. A lane that
+// writes over code a warp has run, or is about to run code it wrote, leaves
+// the warp and finishes on an Emulator. Every outcome, counts included, is
+// what an Emulator running that instance alone would report.
+class BatchEmulator {
+public:
+	static constexpr size_t LaneCount = 16;
+
+	// False if the image doesn't fit at origin.
+	bool Load(std::span<const uint8_t> image, uint16_t origin);
+
+	// Runs every instance until it halts, faults or reaches limit
+	// instructions. Warps are shared out over jobs threads, 0 for one per
+	// hardware thread.
+	std::vector<BatchOutcome> Run(std::span<const RegisterFile> instances, uint64_t limit = UINT64_MAX, size_t jobs = 1);
+
+	const BatchStats &GetStats() const { return m_Stats; }
+private:
+	class Runner;
+	std::vector<uint8_t> m_Image;
+	uint16_t m_Origin = 0;
+	BatchStats m_Stats {};
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include "BuildCache.h"
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#include "ByteStream.h"
+#include "File.h"
+#include "Hash.h"
+
+namespace REASM {
+
+// Entry layout, little-endian:
+//   "RCHE" u32 version, u64 key, u32 output size, output,
+//   u32 symbols, then per symbol u16 name length, name, u16 value,
+//   u32 map size, map
+static constexpr char Magic[4] = { 'R', 'C', 'H', 'E' };
+static constexpr uint32_t Version = 2;
+static constexpr std::string_view Extension = ".entry";
+
+BuildCache::BuildCache(std::filesystem::path directory, uint64_t maxBytes)
+	: m_Directory(std::move(directory)), m_MaxBytes(maxBytes) {
+	std::error_code error;
+	std::filesystem::create_directories(m_Directory, error);
+}
+
+uint64_t BuildCache::Key(std::string_view source, const AssembleOptions &options) {
+	std::vector<uint8_t> header;
+	ByteWriter writer(header);
+	writer.U32(Version);
+	writer.U32(AssemblerVersion);
+	writer.U8(options.relocatable ? 1 : 0);
+	writer.U8(options.optimize ? 1 : 0);
+	writer.U8(options.sourceMap ? 1 : 0);
+
+	return HashBytes(source, HashBytes(header.data(), header.size()));
+}
+
+std::filesystem::path BuildCache::EntryPath(uint64_t key) const {
+	char name[17];
+	for (int i = 0; i < 16; i++) name[i] = "0123456789abcdef"[(key >> (60 - i * 4)) & 0xF];
+	name[16] = '\0';
+
+	return m_Directory / (std::string(name) + std::string(Extension));
+}
+
+bool BuildCache::Lookup(uint64_t key, CacheEntry &entry) {
+	std::filesystem::path path = EntryPath(key);
+	MappedFile file(path.string());
+	if (!file.IsValid()) {
+		m_Misses++;
+		return false;
+	}
+
+	ByteReader reader(file.GetContents());
+	std::string_view magic, output;
+	uint32_t version, outputSize, symbolCount;
+	uint64_t storedKey;
+	bool valid = reader.Bytes(magic, sizeof(Magic)) && std::memcmp(magic.data(), Magic, sizeof(Magic)) == 0 &&
+		reader.U32(version) && version == Version && reader.U64(storedKey) && storedKey == key &&
+		reader.U32(outputSize) && reader.Bytes(output, outputSize) && reader.U32(symbolCount);
+
+	entry.output.assign(output.begin(), output.end());
+	entry.symbols.clear();
+	for (uint32_t i = 0; valid && i < symbolCount; i++) {
+		uint16_t length, value;
+		std::string_view name;
+		valid = reader.U16(length) && reader.Bytes(name, length) && reader.U16(value);
+		if (valid) entry.symbols.push_back(AssembledSymbol { .name = std::string(name), .value = value });
+	}
+
+	uint32_t mapSize;
+	std::string_view map;
+	valid = valid && reader.U32(mapSize) && reader.Bytes(map, mapSize);
+	entry.map.assign(map);
+
+	if (!valid) {
+		m_Misses++;
+		return false;
+	}
+
+	std::error_code error;
+	std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+	m_Hits++;
+	return true;
+}
+
+void BuildCache::Store(uint64_t key, const CacheEntry &entry) {
+	std::vector<uint8_t> data;
+	ByteWriter writer(data);
+	writer.Bytes(Magic, sizeof(Magic));
+	writer.U32(Version);
+	writer.U64(key);
+	writer.U32(static_cast<uint32_t>(entry.output.size()));
+	writer.Bytes(entry.output.data(), entry.output.size());
+	writer.U32(static_cast<uint32_t>(entry.symbols.size()));
+	for (const AssembledSymbol &symbol : entry.symbols) {
+		writer.U16(static_cast<uint16_t>(symbol.name.size()));
+		writer.Bytes(symbol.name.data(), symbol.name.size());
+		writer.U16(symbol.value);
+	}
+	writer.U32(static_cast<uint32_t>(entry.map.size()));
+	writer.Bytes(entry.map.data(), entry.map.size());
+
+	std::filesystem::path path = EntryPath(key);
+	std::filesystem::path temporary = path;
+	// Unique to this writer across every process sharing the directory.
+#ifdef _WIN32
+	int process = _getpid();
+#else
+	int process = getpid();
+#endif
+	temporary += ".tmp" + std::to_string(process) + "-" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	{
+		std::ofstream file(temporary, std::ios::binary);
+		if (!file) return;
+		file.write(reinterpret_cast<const char *>(data.data()), data.size());
+		if (!file) return;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporary, path, error);
+	if (error) {
+		std::filesystem::remove(temporary, error);
+		return;
+	}
+	m_Stores++;
+}
+
+void BuildCache::Trim() {
+	struct File {
+		std::filesystem::path path;
+		std::filesystem::file_time_type time;
+		uint64_t size;
+	};
+
+	std::vector<File> files;
+	std::error_code error;
+	for (const std::filesystem::directory_entry &item : std::filesystem::directory_iterator(m_Directory, error)) {
+		if (item.path().extension() != Extension) continue;
+
+		std::error_code itemError;
+		File file { .path = item.path(), .time = item.last_write_time(itemError), .size = item.file_size(itemError) };
+		if (!itemError) files.push_back(std::move(file));
+	}
+
+	m_Bytes = 0;
+	for (const File &file : files) m_Bytes += file.size;
+
+	std::sort(files.begin(), files.end(), [](const File &a, const File &b) { return a.time < b.time; });
+	size_t evicted = 0;
+	while (m_Bytes > m_MaxBytes && evicted < files.size()) {
+		std::filesystem::remove(files[evicted].path, error);
+		m_Bytes -= files[evicted].size;
+		evicted++;
+	}
+
+	m_Evictions += evicted;
+	m_Entries = files.size() - evicted;
+}
+
+CacheStats BuildCache::GetStats() const {
+	return CacheStats {
+		.hits = m_Hits, .misses = m_Misses, .stores = m_Stores,
+		.evictions = m_Evictions, .entries = m_Entries, .bytes = m_Bytes,
+	};
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Assemble.h"
+
+namespace REASM {
+
+struct CacheEntry {
+	std::vector<uint8_t> output;	// flat image or serialized object
+	std::vector<AssembledSymbol> symbols;
+	std::string map;				// serialized SourceMap, only with sourceMap
+};
+
+struct CacheStats {
+	size_t hits;
+	size_t misses;
+	size_t stores;
+	size_t evictions;
+	size_t entries;		// after the last Trim
+	uint64_t bytes;
+};
+
+// On-disk build cache keyed by a hash of the source, the assembler version
+// and every option that changes the output. Each entry is one file whose
+// mtime is the LRU clock: hits refresh it and Trim evicts the oldest until
+// the directory fits the size bound. Entries are written under a temporary
+// name and renamed into place, so concurrent builds can share a directory.
+class BuildCache {
+public:
+	BuildCache(std::filesystem::path directory, uint64_t maxBytes);
+
+	static uint64_t Key(std::string_view source, const AssembleOptions &options);
+
+	bool Lookup(uint64_t key, CacheEntry &entry);
+	void Store(uint64_t key, const CacheEntry &entry);
+	void Trim();
+
+	CacheStats GetStats() const;
+private:
+	std::filesystem::path EntryPath(uint64_t key) const;
+private:
+	std::filesystem::path m_Directory;
+	uint64_t m_MaxBytes;
+
+	std::atomic<size_t> m_Hits = 0;
+	std::atomic<size_t> m_Misses = 0;
+	std::atomic<size_t> m_Stores = 0;
+	size_t m_Evictions = 0;
+	size_t m_Entries = 0;
+	uint64_t m_Bytes = 0;
+};
+
+}
\ No newline at end of file
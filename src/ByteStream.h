@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <string_view>
+#include <vector>
+
+namespace REASM {
+
+// Little-endian field writer and bounds-checked reader for the on-disk
+// formats.
+class ByteWriter {
+public:
+	ByteWriter(std::vector<uint8_t> &out)
+		: m_Out(out) {}
+
+	void U8(uint8_t value) { m_Out.push_back(value); }
+	void U16(uint16_t value) {
+		U8(value & 0xFF);
+		U8((value >> 8) & 0xFF);
+	}
+	void U32(uint32_t value) {
+		U16(value & 0xFFFF);
+		U16((value >> 16) & 0xFFFF);
+	}
+	void U64(uint64_t value) {
+		U32(value & 0xFFFFFFFF);
+		U32((value >> 32) & 0xFFFFFFFF);
+	}
+	void Bytes(const void *data, size_t size) {
+		const uint8_t *bytes = static_cast<const uint8_t *>(data);
+		m_Out.insert(m_Out.end(), bytes, bytes + size);
+	}
+private:
+	std::vector<uint8_t> &m_Out;
+};
+
+class ByteReader {
+public:
+	ByteReader(std::string_view data)
+		: m_Data(data) {}
+
+	bool U8(uint8_t &value) {
+		if (m_Pos + 1 > m_Data.size()) return false;
+		value = static_cast<uint8_t>(m_Data[m_Pos++]);
+		return true;
+	}
+	bool U16(uint16_t &value) {
+		uint8_t low, high;
+		if (!U8(low) || !U8(high)) return false;
+		value = static_cast<uint16_t>(low | (high << 8));
+		return true;
+	}
+	bool U32(uint32_t &value) {
+		uint16_t low, high;
+		if (!U16(low) || !U16(high)) return false;
+		value = static_cast<uint32_t>(low) | (static_cast<uint32_t>(high) << 16);
+		return true;
+	}
+	bool U64(uint64_t &value) {
+		uint32_t low, high;
+		if (!U32(low) || !U32(high)) return false;
+		value = static_cast<uint64_t>(low) | (static_cast<uint64_t>(high) << 32);
+		return true;
+	}
+	bool Bytes(std::string_view &bytes, size_t size) {
+		if (size > m_Data.size() - m_Pos) return false;
+		bytes = m_Data.substr(m_Pos, size);
+		m_Pos += size;
+		return true;
+	}
+private:
+	std::string_view m_Data;
+	size_t m_Pos = 0;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <exception>
+#include <string>
+#include <utility>
+
+namespace REASM {
+
+struct Diagnostic {
+	uint32_t line;		// 1-based, 0 when not tied to a source position
+	uint32_t column;
+	std::string message;
+};
+
+// Raised by the assembler stages and caught at the library entry points,
+// which hand it back as a Diagnostic instead of terminating the process.
+class DiagnosticError : public std::exception {
+public:
+	DiagnosticError(Diagnostic diagnostic)
+		: m_Diagnostic(std::move(diagnostic)) {}
+
+	const Diagnostic &GetDiagnostic() const { return m_Diagnostic; }
+	const char *what() const noexcept override { return m_Diagnostic.message.c_str(); }
+private:
+	Diagnostic m_Diagnostic;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,356 @@
+#include "Disassembler.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <vector>
+
+#include "Emulator.h"
+#include "ISA.h"
+#include "ThreadPool.h"
+
+namespace REASM {
+
+struct DecodeEntry {
+	uint8_t row;			// ISA::Instructions row, or ISA::NoInstruction
+	uint8_t size;
+	uint8_t operandCount;
+	bool shrinks;			// Relax would move a small immediate to a short form
+	OperandKind operands[3];
+	uint8_t prefixLength;
+	char prefix[8];			// a tab and the mnemonic
+	uint64_t registers;		// 0xFF in each byte of the instruction that names a register
+};
+
+static_assert(ISA::MaxInstructionSize <= sizeof(uint64_t), "an instruction's register bytes are checked in one word");
+static_assert(RegisterCount <= 0x80);
+
+static constexpr auto DecodeTable = [] {
+	std::array<DecodeEntry, 256> table {};
+	for (size_t byte = 0; byte < table.size(); byte++) {
+		DecodeEntry &entry = table[byte];
+		entry.row = ISA::OpcodeTable[byte];
+		entry.size = 1;
+		if (entry.row == ISA::NoInstruction) continue;
+
+		const InstructionDesc &desc = ISA::Instructions[entry.row];
+		entry.size = desc.size;
+		entry.operandCount = desc.operandCount;
+		entry.shrinks = ISA::ShortForms[entry.row] != ISA::NoInstruction;
+		entry.prefix[0] = '\t';
+		for (char c : desc.mnemonic) entry.prefix[++entry.prefixLength] = c;
+		entry.prefixLength++;
+
+		std::array<uint8_t, sizeof(uint64_t)> registers {};
+		uint8_t at = 1;
+		for (uint8_t operand = 0; operand < desc.operandCount; operand++) {
+			entry.operands[operand] = desc.operands[operand];
+			if (desc.operands[operand] == OperandKind::Reg) registers[at] = 0xFF;
+			at += OperandSize(desc.operands[operand]);
+		}
+		entry.registers = std::bit_cast<uint64_t>(registers);
+	}
+	return table;
+}();
+
+static constexpr auto HexDigits = [] {
+	constexpr char Digits[] = "0123456789ABCDEF";
+	std::array<std::array<char, 2>, 256> table {};
+	for (size_t byte = 0; byte < table.size(); byte++) table[byte] = { Digits[byte >> 4], Digits[byte & 0xF] };
+	return table;
+}();
+
+// Register names padded to four bytes, with their length in the last.
+static constexpr auto RegisterNames = [] {
+	std::array<std::array<char, 4>, RegisterCount> table {};
+	for (size_t index = 0; index < table.size(); index++) {
+		table[index] = index < 10 ? std::array<char, 4> { 'R', char('0' + index), 0, 2 }
+			: std::array<char, 4> { 'R', char('0' + index / 10), char('0' + index % 10), 3 };
+	}
+	return table;
+}();
+
+// Images are formatted in slices of about this many bytes, one per job.
+static constexpr size_t SliceSize = 256 * 1024;
+// Room left before each line; the longest instruction line is well under it.
+static constexpr size_t MaxLineSize = 64;
+static constexpr size_t DataPerLine = 8;
+static constexpr uint32_t NoLabel = UINT32_MAX;
+
+// The size of the instruction at offset, or 0 when the bytes there aren't
+// one the Emulator would run.
+static size_t DecodeAt(std::span<const uint8_t> image, size_t offset) {
+	const DecodeEntry &entry = DecodeTable[image[offset]];
+	size_t left = image.size() - offset;
+	if (entry.row == ISA::NoInstruction || entry.size > left) return 0;
+
+	// Every register byte at once: one is out of range when adding
+	// 0x80 - RegisterCount to its low seven bits, or the byte itself, has the
+	// top bit set. No sum carries into the next byte.
+	uint64_t bytes = 0;
+	if (left >= sizeof(bytes)) std::memcpy(&bytes, &image[offset], sizeof(bytes));
+	else std::memcpy(&bytes, &image[offset], left);
+	bytes &= entry.registers;
+	constexpr uint64_t Ones = 0x0101010101010101;
+	uint64_t over = ((bytes & Ones * 0x7F) + Ones * (0x80 - RegisterCount)) | bytes;
+	return over & entry.registers & Ones * 0x80 ? 0 : entry.size;
+}
+
+static uint16_t ReadU16(const uint8_t *in) {
+	return static_cast<uint16_t>(in[0] | in[1] << 8);
+}
+
+static char *WriteHex(char *out, uint16_t value, int digits) {
+	*out++ = '0';
+	*out++ = 'x';
+	if (digits > 2) {
+		std::memcpy(out, HexDigits[value >> 8].data(), 2);
+		out += 2;
+	}
+	std::memcpy(out, HexDigits[value & 0xFF].data(), 2);
+	return out + 2;
+}
+
+static char *WriteText(char *out, std::string_view text) {
+	std::memcpy(out, text.data(), text.size());
+	return out + text.size();
+}
+
+namespace {
+
+// Label names by address; the names at one address are adjacent.
+struct LabelTable {
+	std::vector<std::string_view> names;
+	std::vector<uint32_t> first = std::vector<uint32_t>(MemorySize + 1, NoLabel);	// per address, into names
+	std::vector<uint32_t> addresses;	// per name
+
+	std::string_view Find(uint32_t address) const {
+		return first[address] == NoLabel ? std::string_view() : names[first[address]];
+	}
+};
+
+struct Layout {
+	std::vector<size_t> slices;		// image offsets where a slice starts, each at a line, and the end
+	std::vector<uint8_t> starts;	// per address: a line starts there; only when the image fits
+	std::vector<uint8_t> targets;	// per address: a jump goes there
+	size_t instructions = 0;
+	size_t undecoded = 0;
+	size_t firstUndecoded = 0;
+};
+
+}
+
+// Walks the image once for instruction boundaries and jump targets.
+static Layout Scan(std::span<const uint8_t> image, uint16_t origin, bool fits) {
+	Layout layout;
+	if (fits) {
+		layout.starts.resize(MemorySize + 1);
+		layout.targets.resize(MemorySize + 1);
+	}
+
+	size_t offset = 0, sliceEnd = 0;
+	while (offset < image.size()) {
+		if (offset >= sliceEnd) {
+			layout.slices.push_back(offset);
+			sliceEnd = offset + SliceSize;
+		}
+
+		if (fits) layout.starts[origin + offset] = 1;
+		size_t size = DecodeAt(image, offset);
+		if (size == 0) {
+			if (layout.undecoded++ == 0) layout.firstUndecoded = offset;
+			offset++;
+			continue;
+		}
+
+		layout.instructions++;
+		if (fits) {
+			const InstructionDesc &desc = ISA::Instructions[DecodeTable[image[offset]].row];
+			if (desc.effects & Branches && desc.operands[0] == OperandKind::Addr) layout.targets[ReadU16(&image[offset + 1])] = 1;
+		}
+		offset += size;
+	}
+	layout.slices.push_back(image.size());
+	if (fits) layout.starts[origin + image.size()] = 1;
+	return layout;
+}
+
+// Places the map's labels, or names every jump target without one. A map
+// label that doesn't fall on a line is kept as an EQU.
+static void PlaceLabels(const Layout &layout, const DisassembleOptions &options, std::vector<std::string> &madeUp,
+		LabelTable &labels, std::vector<const SourceLabel *> &constants) {
+	std::vector<std::pair<uint32_t, std::string_view>> placed;
+	if (options.map) {
+		for (const SourceLabel &label : options.map->labels) {
+			if (layout.starts[label.address]) placed.emplace_back(label.address, label.name);
+			else constants.push_back(&label);
+		}
+	} else {
+		// Every name is made before any view of one is taken, since short
+		// strings move when the vector grows.
+		for (size_t address = 0; address < MemorySize; address++) {
+			if (!layout.targets[address] || !layout.starts[address]) continue;
+			char name[8];
+			char *end = WriteHex(name, static_cast<uint16_t>(address), 4);
+			name[0] = 'L';
+			name[1] = '_';
+			madeUp.emplace_back(name, end);
+		}
+		size_t next = 0;
+		for (size_t address = 0; address < MemorySize; address++) {
+			if (layout.targets[address] && layout.starts[address]) placed.emplace_back(static_cast<uint32_t>(address), madeUp[next++]);
+		}
+	}
+
+	std::stable_sort(placed.begin(), placed.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+	for (const auto &[address, name] : placed) {
+		if (labels.first[address] == NoLabel) labels.first[address] = static_cast<uint32_t>(labels.names.size());
+		labels.names.push_back(name);
+		labels.addresses.push_back(address);
+	}
+}
+
+// Appends the lines for image[begin, end) to out, which is sized up front and
+// trimmed after, so a line costs one capacity check.
+static void FormatSlice(std::span<const uint8_t> image, size_t begin, size_t end, uint16_t origin, const LabelTable *labels, std::string &out) {
+	size_t start = out.size();
+	out.resize(start + (end - begin) * 5 + MaxLineSize);
+	char *cursor = out.data() + start;
+	auto reserve = [&](size_t size) {
+		size_t used = cursor - out.data();
+		if (out.size() - used >= size) return;
+		out.resize(std::max(out.size() * 2, used + size));
+		cursor = out.data() + used;
+	};
+	auto writeLabels = [&](uint32_t address) {
+		reserve(1);
+		*cursor++ = '\n';
+		for (uint32_t i = labels->first[address]; i < labels->names.size() && labels->addresses[i] == address; i++) {
+			reserve(labels->names[i].size() + 2);
+			cursor = WriteText(cursor, labels->names[i]);
+			cursor = WriteText(cursor, ":\n");
+		}
+	};
+
+	size_t offset = begin;
+	while (offset < end) {
+		uint32_t address = static_cast<uint32_t>(origin + offset);
+		if (labels && labels->first[address] != NoLabel) writeLabels(address);
+		reserve(MaxLineSize);
+
+		size_t size = DecodeAt(image, offset);
+		if (size == 0) {
+			// Runs of bytes that aren't instructions share a DB line, up to
+			// the next label.
+			cursor = WriteHex(WriteText(cursor, "\tDB "), image[offset++], 2);
+			for (size_t count = 1; count < DataPerLine && offset < end && DecodeAt(image, offset) == 0; count++) {
+				if (labels && labels->first[origin + offset] != NoLabel) break;
+				cursor = WriteHex(WriteText(cursor, ", "), image[offset++], 2);
+			}
+			*cursor++ = '\n';
+			continue;
+		}
+
+		const DecodeEntry &entry = DecodeTable[image[offset]];
+		const uint8_t *in = &image[offset + 1];
+		std::memcpy(cursor, entry.prefix, sizeof(entry.prefix));
+		cursor += entry.prefixLength;
+		if (entry.shrinks) {
+			bool small = true;
+			const uint8_t *field = in;
+			for (uint8_t operand = 0; operand < entry.operandCount; operand++) {
+				if (entry.operands[operand] == OperandKind::Imm && ReadU16(field) > 0xFF) small = false;
+				field += OperandSize(entry.operands[operand]);
+			}
+			if (small) cursor = WriteText(cursor, ".W");
+		}
+
+		for (uint8_t operand = 0; operand < entry.operandCount; operand++) {
+			std::memcpy(cursor, ", ", 2);
+			cursor += operand ? 2 : 1;
+			if (!operand) cursor[-1] = ' ';
+			switch (entry.operands[operand]) {
+			case OperandKind::Reg: {
+				const std::array<char, 4> &name = RegisterNames[*in];
+				std::memcpy(cursor, name.data(), 3);
+				cursor += name[3];
+			} break;
+			case OperandKind::Imm8: {
+				cursor = WriteHex(cursor, *in, 2);
+			} break;
+			case OperandKind::Addr: {
+				std::string_view target = labels ? labels->Find(ReadU16(in)) : std::string_view();
+				if (target.empty()) {
+					cursor = WriteHex(cursor, ReadU16(in), 4);
+				} else {
+					reserve(target.size() + 1);
+					cursor = WriteText(cursor, target);
+				}
+			} break;
+			default: {
+				cursor = WriteHex(cursor, ReadU16(in), 4);
+			} break;
+			}
+			in += OperandSize(entry.operands[operand]);
+		}
+		*cursor++ = '\n';
+		offset += size;
+	}
+	if (labels && end == image.size() && labels->first[origin + end] != NoLabel) writeLabels(static_cast<uint32_t>(origin + end));
+	out.resize(cursor - out.data());
+}
+
+Disassembly Disassemble(std::span<const uint8_t> image, const DisassembleOptions &options) {
+	bool fits = image.size() <= MemorySize - options.origin;
+	Layout layout = Scan(image, options.origin, fits);
+
+	Disassembly result;
+	result.instructions = layout.instructions;
+	result.undecoded = layout.undecoded;
+	result.firstUndecoded = layout.firstUndecoded;
+
+	std::vector<std::string> madeUp;
+	std::unique_ptr<LabelTable> labels;
+	std::vector<const SourceLabel *> constants;
+	if (fits) {
+		labels = std::make_unique<LabelTable>();
+		PlaceLabels(layout, options, madeUp, *labels, constants);
+		result.labels = labels->names.size();
+	}
+
+	char header[32];
+	char *cursor = WriteHex(WriteText(header, "ORG "), options.origin, 4);
+	*cursor++ = '\n';
+	result.text.append(header, cursor);
+	for (const SourceLabel *constant : constants) {
+		cursor = WriteHex(header, constant->address, 4);
+		result.text += constant->name;
+		result.text += " EQU ";
+		result.text.append(header, cursor);
+		result.text += '\n';
+	}
+	if (!labels || labels->first[options.origin] == NoLabel) result.text += '\n';
+
+	size_t sliceCount = layout.slices.size() - 1;
+	size_t jobs = std::min(ThreadPool::ResolveThreadCount(options.jobs), sliceCount);
+	if (jobs <= 1) {
+		FormatSlice(image, 0, image.size(), options.origin, labels.get(), result.text);
+		return result;
+	}
+
+	std::vector<std::string> slices(sliceCount);
+	ThreadPool pool(jobs);
+	for (size_t i = 0; i < sliceCount; i++) {
+		pool.Submit([&, i]() { FormatSlice(image, layout.slices[i], layout.slices[i + 1], options.origin, labels.get(), slices[i]); });
+	}
+	pool.Wait();
+
+	size_t total = result.text.size();
+	for (const std::string &slice : slices) total += slice.size();
+	result.text.reserve(total);
+	for (const std::string &slice : slices) result.text += slice;
+	return result;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <span>
+#include <string>
+
+#include "SourceMap.h"
+
+namespace REASM {
+
+struct DisassembleOptions {
+	uint16_t origin = 0;	// where the image is loaded, as for Emulator::Load
+	// Label names, from build --map. Without one, jump targets inside the
+	// image get made-up names. Labels are only placed when the image fits
+	// in memory at origin, since addresses would otherwise repeat.
+	const SourceMap *map = nullptr;
+	// Formatting threads; 0 picks one per hardware thread.
+	size_t jobs = 1;
+};
+
+struct Disassembly {
+	std::string text;
+	size_t instructions = 0;
+	size_t undecoded = 0;		// bytes that don't start an instruction, written with DB
+	size_t firstUndecoded = 0;	// image offset of the first one
+	size_t labels = 0;			// placed before a line; the rest become EQUs
+};
+
+// Turns a flat image back into source that assembles to the same bytes: an
+// ORG, then one line per instruction and DB lines for bytes that don't
+// decode. Every opcode byte is looked up in a 256-entry table built from the
+// ISA table, which gives its row, size and which operand bytes must name a
+// register. Immediates the assembler would shrink to 8 bits are written with
+// .W so they keep their encoding.
+Disassembly Disassemble(std::span<const uint8_t> image, const DisassembleOptions &options = {});
+
+}
\ No newline at end of file
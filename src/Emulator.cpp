@@ -0,0 +1,337 @@
+#include "Emulator.h"
+
+#include <cstring>
+
+#include "JIT.h"
+
+// Threaded dispatch needs labels as values; elsewhere the handlers become the
+// cases of a switch in a loop.
+#if defined(__GNUC__)
+#define REASM_THREADED_DISPATCH 1
+#endif
+
+namespace REASM {
+
+static constexpr uint8_t InvalidOp = ISA::InstructionCount;
+static constexpr uint8_t UndecodedOp = ISA::InstructionCount + 1;
+
+static_assert(UndecodedOp < 0xFF);
+
+// Every opcode in the ISA table, each with a handler in Run.
+#define REASM_EMULATED_OPCODES(X) \
+	X(MOV_IM) X(MOV_R) \
+	X(ADD_R) X(ADD_RI) X(ADD_IR) X(ADD_I) \
+	X(SUB_R) X(SUB_RI) X(SUB_IR) X(SUB_I) \
+	X(ADC_R) X(ADC_RI) X(ADC_IR) X(ADC_I) \
+	X(SBC_R) X(SBC_RI) X(SBC_IR) X(SBC_I) \
+	X(MUL_R) X(MUL_RI) X(MUL_IR) X(MUL_I) \
+	X(DIV_R) X(DIV_RI) X(DIV_IR) X(DIV_I) \
+	X(DEC_R) X(INC_R) \
+	X(AND_R) X(AND_RI) X(AND_IR) X(AND_I) \
+	X(OR_R) X(OR_RI) X(OR_IR) X(OR_I) \
+	X(XOR_R) X(XOR_RI) X(XOR_IR) X(XOR_I) \
+	X(NOT_R) \
+	X(SHL_R) X(SHL_RI) X(SHL_IR) X(SHL_I) \
+	X(SHR_R) X(SHR_RI) X(SHR_IR) X(SHR_I) \
+	X(CMP_R) X(CMP_RI) \
+	X(IGT_R) X(IGT_RI) X(ILT_R) X(ILT_RI) X(IGE_R) X(IGE_RI) X(ILE_R) X(ILE_RI) \
+	X(JMP) X(JNZ) X(JZ) X(JNS) X(JS) X(JNC) X(JC) \
+	X(PUSH_R) X(PUSH_IM_W) X(PUSH_IM_B) X(POP_R) \
+	X(HLT)
+
+#define REASM_COUNT_OPCODE(name) + 1
+static_assert(0 REASM_EMULATED_OPCODES(REASM_COUNT_OPCODE) == ISA::InstructionCount, "Every ISA row needs a handler");
+#undef REASM_COUNT_OPCODE
+
+Emulator::Emulator()
+	: m_Memory(new uint8_t[MemorySize]()), m_Code(new Decoded[MemorySize]) {
+	for (size_t i = 0; i < MemorySize; i++) m_Code[i].op = UndecodedOp;
+}
+
+bool Emulator::Load(std::span<const uint8_t> image, uint16_t origin) {
+	if (image.size() > MemorySize - origin) return false;
+
+	std::memset(m_Memory.get(), 0, MemorySize);
+	if (!image.empty()) std::memcpy(m_Memory.get() + origin, image.data(), image.size());
+	for (size_t i = 0; i < MemorySize; i++) m_Code[i].op = UndecodedOp;
+
+	m_State = MachineState {};
+	m_State.pc = origin;
+	if (m_Translator) m_Translator->Flush();
+	return true;
+}
+
+const Emulator::Decoded &Emulator::Decode(uint16_t address) {
+	Decoded &decoded = m_Code[address];
+	decoded = Decoded { .op = InvalidOp, .size = 1 };
+
+	uint8_t row = ISA::OpcodeTable[m_Memory[address]];
+	if (row == ISA::NoInstruction) return decoded;
+	const InstructionDesc &desc = ISA::Instructions[row];
+	if (address + desc.size > MemorySize) return decoded;
+
+	const uint8_t *in = m_Memory.get() + address + 1;
+	uint16_t fields[3] = {};
+	for (uint8_t operand = 0; operand < desc.operandCount; operand++) {
+		switch (desc.operands[operand]) {
+		case OperandKind::Reg: {
+			if (*in >= RegisterCount) return decoded;
+			fields[operand] = *in++;
+		} break;
+		case OperandKind::Imm8: {
+			fields[operand] = *in++;
+		} break;
+		default: {
+			fields[operand] = static_cast<uint16_t>(in[0] | in[1] << 8);
+			in += 2;
+		} break;
+		}
+	}
+
+	decoded = Decoded { .op = row, .size = desc.size, .a = fields[0], .b = fields[1], .c = fields[2] };
+	return decoded;
+}
+
+void Emulator::Store(uint16_t address, uint16_t value) {
+	uint16_t high = static_cast<uint16_t>(address + 1);
+	m_Memory[address] = static_cast<uint8_t>(value);
+	m_Memory[high] = static_cast<uint8_t>(value >> 8);
+	for (size_t back = 0; back < ISA::MaxInstructionSize + 1; back++) m_Code[static_cast<uint16_t>(high - back)].op = UndecodedOp;
+	if (m_Translator) {
+		m_Translator->Invalidate(address);
+		m_Translator->Invalidate(high);
+	}
+}
+
+uint16_t Emulator::LoadWord(uint16_t address) const {
+	return static_cast<uint16_t>(m_Memory[address] | m_Memory[static_cast<uint16_t>(address + 1)] << 8);
+}
+
+RunResult Emulator::Run(uint64_t limit) {
+	return Execute<false>(limit, nullptr);
+}
+
+RunResult Emulator::Run(uint64_t limit, Profile &profile) {
+	return Execute<true>(limit, &profile);
+}
+
+template<bool Profiling>
+RunResult Emulator::Execute(uint64_t limit, Profile *profile) {
+	uint64_t *executions = Profiling ? profile->executions.data() : nullptr;
+	uint64_t *taken = Profiling ? profile->taken.data() : nullptr;
+	uint16_t *r = m_State.registers.data();
+	const Decoded *code = m_Code.get();
+	uint16_t pc = m_State.pc, sp = m_State.sp;
+	uint32_t flags = m_State.flags;
+	uint64_t remaining = limit;
+	StopReason reason;
+	const Decoded *d;
+
+#ifdef REASM_THREADED_DISPATCH
+	const void *handlers[UndecodedOp + 1];
+	for (size_t row = 0; row < ISA::InstructionCount; row++) {
+		switch (ISA::Instructions[row].opcode) {
+#define REASM_HANDLER_ADDRESS(name) case name: handlers[row] = &&op_##name; break;
+		REASM_EMULATED_OPCODES(REASM_HANDLER_ADDRESS)
+#undef REASM_HANDLER_ADDRESS
+		default: handlers[row] = &&invalid; break;
+		}
+	}
+	handlers[InvalidOp] = &&invalid;
+	handlers[UndecodedOp] = &&undecoded;
+
+#define CASE(label, op)	label:
+#define DISPATCH() do { \
+		if (remaining == 0) { reason = StopReason::Limit; goto stop; } \
+		remaining--; \
+		if constexpr (Profiling) executions[pc]++; \
+		d = &code[pc]; \
+		goto *handlers[d->op]; \
+	} while (0)
+
+	DISPATCH();
+undecoded:
+	d = &Decode(pc);
+	goto *handlers[d->op];
+#else
+#define CASE(label, op)	case op:
+#define DISPATCH() continue
+
+	while (true) {
+		if (remaining == 0) { reason = StopReason::Limit; goto stop; }
+		remaining--;
+		if constexpr (Profiling) executions[pc]++;
+		d = &code[pc];
+		if (d->op == UndecodedOp) d = &Decode(pc);
+		switch (d->op) {
+#endif
+
+#define HANDLER(name) CASE(op_##name, ISA::OpcodeTable[name])
+// Each handler knows its own size, which keeps loads off the chain from
+// one pc to the next.
+#define SIZE(name) ISA::Instructions[ISA::OpcodeTable[name]].size
+#define TAKEN() { if constexpr (Profiling) taken[pc]++; }
+#define NEXT(name) { pc = static_cast<uint16_t>(pc + SIZE(name)); DISPATCH(); }
+
+	// Each family comes in four forms: both sources registers, the second an
+	// immediate, the first an immediate, or both immediates.
+#define FORMS(name, op) \
+	HANDLER(name##_R) { op(r[d->a], r[d->b], r[d->c]); NEXT(name##_R); } \
+	HANDLER(name##_RI) { op(r[d->a], r[d->b], d->c); NEXT(name##_RI); } \
+	HANDLER(name##_IR) { op(r[d->a], d->b, r[d->c]); NEXT(name##_IR); } \
+	HANDLER(name##_I) { op(r[d->a], d->b, d->c); NEXT(name##_I); }
+
+#define WIDE(dest, expression) { uint32_t wide = (expression); dest = static_cast<uint16_t>(wide); flags = wide; }
+#define ADD(dest, x, y) WIDE(dest, static_cast<uint32_t>(x) + (y))
+#define SUB(dest, x, y) WIDE(dest, static_cast<uint32_t>(x) - (y))
+#define ADC(dest, x, y) WIDE(dest, static_cast<uint32_t>(x) + (y) + (flags >> 16 & 1))
+#define SBC(dest, x, y) WIDE(dest, static_cast<uint32_t>(x) - (y) - (flags >> 16 & 1))
+#define AND(dest, x, y) WIDE(dest, static_cast<uint32_t>((x) & (y)))
+#define OR(dest, x, y) WIDE(dest, static_cast<uint32_t>((x) | (y)))
+#define XOR(dest, x, y) WIDE(dest, static_cast<uint32_t>((x) ^ (y)))
+#define MUL(dest, x, y) { \
+		uint32_t product = static_cast<uint32_t>(x) * (y); \
+		dest = static_cast<uint16_t>(product); \
+		flags = (product & 0xFFFF) | (product > 0xFFFF ? 0x10000 : 0); \
+	}
+#define DIV(dest, x, y) { \
+		uint16_t divisor = (y); \
+		if (divisor == 0) { reason = StopReason::DivideByZero; goto fault; } \
+		WIDE(dest, static_cast<uint32_t>((x) / divisor)); \
+	}
+#define SHL(dest, x, y) { \
+		uint16_t count = (y); \
+		WIDE(dest, count < 32 ? static_cast<uint32_t>(x) << count : 0); \
+	}
+#define SHR(dest, x, y) { \
+		uint16_t value = (x), count = (y); \
+		uint32_t out = count >= 1 && count <= 16 ? (value >> (count - 1)) & 1 : 0; \
+		WIDE(dest, (count < 16 ? value >> count : 0) | out << 16); \
+	}
+
+	HANDLER(MOV_IM) { r[d->a] = d->b; NEXT(MOV_IM); }
+	HANDLER(MOV_R) { r[d->a] = r[d->b]; NEXT(MOV_R); }
+
+	FORMS(ADD, ADD)
+	FORMS(SUB, SUB)
+	FORMS(ADC, ADC)
+	FORMS(SBC, SBC)
+	FORMS(MUL, MUL)
+	FORMS(DIV, DIV)
+	FORMS(AND, AND)
+	FORMS(OR, OR)
+	FORMS(XOR, XOR)
+	FORMS(SHL, SHL)
+	FORMS(SHR, SHR)
+
+	HANDLER(DEC_R) { SUB(r[d->a], r[d->a], 1u); NEXT(DEC_R); }
+	HANDLER(INC_R) { ADD(r[d->a], r[d->a], 1u); NEXT(INC_R); }
+	HANDLER(NOT_R) { WIDE(r[d->a], static_cast<uint16_t>(~r[d->b])); NEXT(NOT_R); }
+
+	HANDLER(CMP_R) { flags = static_cast<uint32_t>(r[d->a]) - r[d->b]; NEXT(CMP_R); }
+	HANDLER(CMP_RI) { flags = static_cast<uint32_t>(r[d->a]) - d->b; NEXT(CMP_RI); }
+
+	// A skipped instruction doesn't count as executed.
+#define SKIP_UNLESS(name, condition) { \
+		uint16_t next = static_cast<uint16_t>(pc + SIZE(name)); \
+		if (!(condition)) { \
+			TAKEN(); \
+			const Decoded *skipped = &code[next]; \
+			if (skipped->op == UndecodedOp) skipped = &Decode(next); \
+			next = static_cast<uint16_t>(next + skipped->size); \
+		} \
+		pc = next; \
+		DISPATCH(); \
+	}
+
+	HANDLER(IGT_R) SKIP_UNLESS(IGT_R, r[d->a] > r[d->b])
+	HANDLER(IGT_RI) SKIP_UNLESS(IGT_RI, r[d->a] > d->b)
+	HANDLER(ILT_R) SKIP_UNLESS(ILT_R, r[d->a] < r[d->b])
+	HANDLER(ILT_RI) SKIP_UNLESS(ILT_RI, r[d->a] < d->b)
+	HANDLER(IGE_R) SKIP_UNLESS(IGE_R, r[d->a] >= r[d->b])
+	HANDLER(IGE_RI) SKIP_UNLESS(IGE_RI, r[d->a] >= d->b)
+	HANDLER(ILE_R) SKIP_UNLESS(ILE_R, r[d->a] <= r[d->b])
+	HANDLER(ILE_RI) SKIP_UNLESS(ILE_RI, r[d->a] <= d->b)
+
+#define JUMP_IF(name, condition) { \
+		if constexpr (Profiling) taken[pc] += (condition) ? 1 : 0; \
+		pc = (condition) ? d->a : static_cast<uint16_t>(pc + SIZE(name)); \
+		DISPATCH(); \
+	}
+
+	HANDLER(JMP) { TAKEN(); pc = d->a; DISPATCH(); }
+	HANDLER(JNZ) JUMP_IF(JNZ, (flags & 0xFFFF) != 0)
+	HANDLER(JZ) JUMP_IF(JZ, (flags & 0xFFFF) == 0)
+	HANDLER(JNS) JUMP_IF(JNS, !(flags & 0x8000))
+	HANDLER(JS) JUMP_IF(JS, flags & 0x8000)
+	HANDLER(JNC) JUMP_IF(JNC, !(flags & 0x10000))
+	HANDLER(JC) JUMP_IF(JC, flags & 0x10000)
+
+	// The store may drop the entry d points at, so move on first.
+#define PUSH(name, value) { \
+		uint16_t pushed = (value); \
+		pc = static_cast<uint16_t>(pc + SIZE(name)); \
+		sp = static_cast<uint16_t>(sp - 2); \
+		Store(sp, pushed); \
+		DISPATCH(); \
+	}
+
+	HANDLER(PUSH_R) PUSH(PUSH_R, r[d->a])
+	HANDLER(PUSH_IM_W) PUSH(PUSH_IM_W, d->a)
+	HANDLER(PUSH_IM_B) PUSH(PUSH_IM_B, d->a)
+	HANDLER(POP_R) {
+		r[d->a] = LoadWord(sp);
+		sp = static_cast<uint16_t>(sp + 2);
+		NEXT(POP_R);
+	}
+
+	HANDLER(HLT) {
+		reason = StopReason::Halted;
+		goto stop;
+	}
+
+	CASE(invalid, InvalidOp) {
+		reason = StopReason::InvalidInstruction;
+		goto fault;
+	}
+
+#ifndef REASM_THREADED_DISPATCH
+		default: break;
+		}
+	}
+#endif
+
+fault:
+	remaining++;
+	if constexpr (Profiling) executions[pc]--;
+stop:
+	m_State.pc = pc;
+	m_State.sp = sp;
+	m_State.flags = flags;
+	return RunResult { .reason = reason, .instructions = limit - remaining };
+
+#undef CASE
+#undef DISPATCH
+#undef HANDLER
+#undef SIZE
+#undef TAKEN
+#undef NEXT
+#undef FORMS
+#undef WIDE
+#undef ADD
+#undef SUB
+#undef ADC
+#undef SBC
+#undef AND
+#undef OR
+#undef XOR
+#undef MUL
+#undef DIV
+#undef SHL
+#undef SHR
+#undef SKIP_UNLESS
+#undef JUMP_IF
+#undef PUSH
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "ISA.h"
+
+namespace REASM {
+
+constexpr size_t RegisterCount = 12;
+constexpr size_t MemorySize = 0x10000;
+
+// The flags are kept the way the ALU produces them: bits 0-15 hold the last
+// result and bit 16 its carry (or borrow), so an ALU instruction sets all of
+// them with one store and the jumps test a bit. After a reset they read as a
+// result of zero.
+struct MachineState {
+	std::array<uint16_t, RegisterCount> registers {};
+	uint16_t pc = 0;
+	uint16_t sp = 0;	// the stack grows down; the first push writes 0xFFFE
+	uint32_t flags = 0;
+
+	bool Zero() const { return (flags & 0xFFFF) == 0; }
+	bool Sign() const { return flags & 0x8000; }
+	bool Carry() const { return flags & 0x10000; }
+
+	bool operator==(const MachineState &) const = default;
+};
+
+enum class StopReason : uint8_t {
+	Halted,
+	InvalidInstruction,	// an opcode outside the ISA table or a bad register
+	DivideByZero,
+	Limit,
+};
+
+struct RunResult {
+	StopReason reason;
+	uint64_t instructions;	// executed, including the HLT; pc is left on the one that stopped
+};
+
+// Per-address counts from a profiling Run, indexed by instruction address.
+struct Profile {
+	std::vector<uint64_t> executions = std::vector<uint64_t>(MemorySize);
+	std::vector<uint64_t> taken = std::vector<uint64_t>(MemorySize);	// jumps to their target and tests that skipped
+};
+
+class JIT;
+
+// Runs R828v2 images. Instructions are decoded once into a table indexed by
+// address and dispatched by threaded code, each handler jumping straight to
+// the next one; stores into decoded bytes drop those entries, so code the
+// program writes is decoded again.
+//
+// Semantics, as the optimizer assumes them: the ALU instructions, INC, DEC,
+// NOT and CMP set the flags; MOV, PUSH and POP don't. Arithmetic is unsigned
+// 16-bit, MUL sets carry when the product overflows and the shifts carry out
+// the last bit shifted. IGT, ILT, IGE and ILE compare unsigned and skip the
+// next instruction when false. The 8-bit PUSH is zero-extended.
+class Emulator {
+public:
+	Emulator();
+
+	// Copies image to origin in otherwise zeroed memory and resets the
+	// machine to start there. False if the image doesn't fit.
+	bool Load(std::span<const uint8_t> image, uint16_t origin);
+	RunResult Run(uint64_t limit = UINT64_MAX);
+	// Same, adding every instruction and taken branch to profile. The
+	// counting is compiled into its own copy of the loop, so plain runs
+	// don't pay for it.
+	RunResult Run(uint64_t limit, Profile &profile);
+
+	MachineState &GetState() { return m_State; }
+	const MachineState &GetState() const { return m_State; }
+	const uint8_t *GetMemory() const { return m_Memory.get(); }
+private:
+	friend class JIT;
+	friend class BatchEmulator;
+
+	struct Decoded {
+		uint8_t op;		// ISA::Instructions row, InvalidOp or UndecodedOp
+		uint8_t size;
+		uint16_t a, b, c;	// operands in order, registers as indices
+	};
+
+	template<bool Profiling>
+	RunResult Execute(uint64_t limit, Profile *profile);
+	const Decoded &Decode(uint16_t address);
+	void Store(uint16_t address, uint16_t value);
+	uint16_t LoadWord(uint16_t address) const;
+private:
+	MachineState m_State;
+	std::unique_ptr<uint8_t[]> m_Memory;
+	std::unique_ptr<Decoded[]> m_Code;
+	JIT *m_Translator = nullptr;	// told about stores, when one is attached
+};
+
+}
\ No newline at end of file
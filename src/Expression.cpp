@@ -0,0 +1,148 @@
+#include "Expression.h"
+
+#include <algorithm>
+
+namespace REASM {
+
+uint32_t ExpressionPool::Add(std::span<const ExprNode> nodes, uint32_t offset) {
+	m_Expressions.push_back(Expression { .first = static_cast<uint32_t>(m_Nodes.size()), .count = static_cast<uint32_t>(nodes.size()),
+		.offset = offset });
+	m_Nodes.insert(m_Nodes.end(), nodes.begin(), nodes.end());
+	return static_cast<uint32_t>(m_Expressions.size() - 1);
+}
+
+void ExpressionPool::Clear() {
+	m_Nodes.clear();
+	m_Expressions.clear();
+}
+
+EvalStatus ApplyOperator(ExprOp op, int64_t left, int64_t right, int64_t &result) {
+	switch (op) {
+	case ExprOp::Multiply: result = left * right; break;
+	case ExprOp::Divide:
+		if (right == 0) return EvalStatus::DivideByZero;
+		result = left / right;
+		break;
+	case ExprOp::Modulo:
+		if (right == 0) return EvalStatus::DivideByZero;
+		result = left % right;
+		break;
+	case ExprOp::Add: result = left + right; break;
+	case ExprOp::Subtract: result = left - right; break;
+	case ExprOp::ShiftLeft:
+		if (right < 0 || right > 31) return EvalStatus::BadShift;
+		result = left << right;
+		break;
+	case ExprOp::ShiftRight:
+		if (right < 0 || right > 31) return EvalStatus::BadShift;
+		result = left >> right;
+		break;
+	case ExprOp::And: result = left & right; break;
+	case ExprOp::Xor: result = left ^ right; break;
+	case ExprOp::Or: result = left | right; break;
+	default: break;
+	}
+	return EvalStatus::Ok;
+}
+
+static void Scale(LinearValue &value, int64_t factor) {
+	value.constant *= factor;
+	for (auto &term : value.terms) term.second *= factor;
+	if (factor == 0) value.terms.clear();
+}
+
+static void Accumulate(LinearValue &into, const LinearValue &other, int64_t sign) {
+	into.constant += sign * other.constant;
+	for (const auto &[symbol, coefficient] : other.terms) {
+		auto existing = std::find_if(into.terms.begin(), into.terms.end(), [&](const auto &term) { return term.first == symbol; });
+		if (existing == into.terms.end()) into.terms.emplace_back(symbol, sign * coefficient);
+		else existing->second += sign * coefficient;
+	}
+	std::erase_if(into.terms, [](const auto &term) { return term.second == 0; });
+}
+
+EvalStatus EvaluateLinear(std::span<const ExprNode> nodes, const std::function<bool(SymbolID, LinearValue &)> &resolve, LinearValue &result) {
+	std::vector<LinearValue> stack;
+	stack.reserve(MaxExpressionDepth);
+	for (const ExprNode &node : nodes) {
+		switch (node.op) {
+		case ExprOp::Number: stack.push_back(LinearValue { .constant = node.value }); break;
+		case ExprOp::Symbol: {
+			LinearValue value;
+			if (!resolve(static_cast<SymbolID>(node.value), value)) return EvalStatus::Unresolved;
+			stack.push_back(std::move(value));
+		} break;
+		case ExprOp::Negate: Scale(stack.back(), -1); break;
+		case ExprOp::Complement:
+			if (!stack.back().terms.empty()) return EvalStatus::NotRelocatable;
+			stack.back().constant = ~stack.back().constant;
+			break;
+		default: {
+			LinearValue right = std::move(stack.back());
+			stack.pop_back();
+			LinearValue &left = stack.back();
+			if (node.op == ExprOp::Add || node.op == ExprOp::Subtract) {
+				Accumulate(left, right, node.op == ExprOp::Add ? 1 : -1);
+			} else if (node.op == ExprOp::Multiply && (left.terms.empty() || right.terms.empty())) {
+				if (left.terms.empty()) std::swap(left, right);
+				Scale(left, right.constant);
+			} else if (left.terms.empty() && right.terms.empty()) {
+				EvalStatus status = ApplyOperator(node.op, left.constant, right.constant, left.constant);
+				if (status != EvalStatus::Ok) return status;
+			} else {
+				return EvalStatus::NotRelocatable;
+			}
+		} break;
+		}
+	}
+	result = std::move(stack.back());
+	return EvalStatus::Ok;
+}
+
+static int Precedence(ExprOp op) {
+	switch (op) {
+	case ExprOp::Or: return 1;
+	case ExprOp::Xor: return 2;
+	case ExprOp::And: return 3;
+	case ExprOp::ShiftLeft:
+	case ExprOp::ShiftRight: return 4;
+	case ExprOp::Add:
+	case ExprOp::Subtract: return 5;
+	case ExprOp::Multiply:
+	case ExprOp::Divide:
+	case ExprOp::Modulo: return 6;
+	default: return 7;
+	}
+}
+
+std::string FormatExpression(std::span<const ExprNode> nodes, const SymbolTable &symbols) {
+	static constexpr const char *Operators[] = { "", "", "-", "~", "*", "/", "%", "+", "-", "<<", ">>", "&", "^", "|" };
+
+	std::vector<std::pair<std::string, int>> stack;
+	for (const ExprNode &node : nodes) {
+		int precedence = Precedence(node.op);
+		switch (node.op) {
+		case ExprOp::Number: stack.emplace_back(std::to_string(node.value), precedence); break;
+		case ExprOp::Symbol: stack.emplace_back(std::string(symbols.Get(node.value).name), precedence); break;
+		case ExprOp::Negate:
+		case ExprOp::Complement: {
+			auto &operand = stack.back();
+			if (operand.second < precedence) operand.first = "(" + operand.first + ")";
+			operand.first = Operators[static_cast<size_t>(node.op)] + operand.first;
+			operand.second = precedence;
+		} break;
+		default: {
+			auto right = std::move(stack.back());
+			stack.pop_back();
+			auto &left = stack.back();
+			if (left.second < precedence) left.first = "(" + left.first + ")";
+			if (right.second <= precedence) right.first = "(" + right.first + ")";
+			left.first += Operators[static_cast<size_t>(node.op)] + right.first;
+			left.second = precedence;
+		} break;
+		}
+	}
+	return stack.back().first;
+}
+
+}
\ No newline at end of file
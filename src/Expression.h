@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SymbolTable.h"
+
+namespace REASM {
+
+enum class ExprOp : uint8_t {
+	Number,
+	Symbol,
+
+	Negate,
+	Complement,
+
+	Multiply,
+	Divide,
+	Modulo,
+	Add,
+	Subtract,
+	ShiftLeft,
+	ShiftRight,
+	And,
+	Xor,
+	Or,
+};
+
+struct ExprNode {
+	ExprOp op;
+	uint32_t value;		// the number, or the SymbolID
+};
+
+// An operand or EQU value in reverse Polish order, kept when it can't be
+// folded at parse time because it names a symbol.
+struct Expression {
+	uint32_t first;
+	uint32_t count;
+	uint32_t offset;	// source offset, for diagnostics
+};
+
+constexpr uint32_t NoExpression = UINT32_MAX;
+// The parser rejects anything deeper, so evaluation needs no heap.
+constexpr size_t MaxExpressionDepth = 32;
+
+class ExpressionPool {
+public:
+	uint32_t Add(std::span<const ExprNode> nodes, uint32_t offset);
+
+	const Expression &Get(uint32_t index) const { return m_Expressions[index]; }
+	std::span<const ExprNode> Nodes(uint32_t index) const {
+		return std::span<const ExprNode>(m_Nodes).subspan(m_Expressions[index].first, m_Expressions[index].count);
+	}
+	size_t Size() const { return m_Expressions.size(); }
+	void Clear();
+private:
+	std::vector<ExprNode> m_Nodes;
+	std::vector<Expression> m_Expressions;
+};
+
+enum class EvalStatus {
+	Ok,
+	Unresolved,		// a symbol has no value yet
+	DivideByZero,
+	BadShift,
+	NotRelocatable,
+};
+
+EvalStatus ApplyOperator(ExprOp op, int64_t left, int64_t right, int64_t &result);
+
+// Evaluates in 64-bit signed arithmetic, so callers range-check the result.
+// resolve(SymbolID, int64_t &) returns false for a symbol with no value yet.
+template<typename Resolve>
+EvalStatus Evaluate(std::span<const ExprNode> nodes, Resolve &&resolve, int64_t &result) {
+	int64_t stack[MaxExpressionDepth];
+	size_t depth = 0;
+	for (const ExprNode &node : nodes) {
+		switch (node.op) {
+		case ExprOp::Number: stack[depth++] = node.value; break;
+		case ExprOp::Symbol:
+			if (!resolve(static_cast<SymbolID>(node.value), stack[depth])) return EvalStatus::Unresolved;
+			depth++;
+			break;
+		case ExprOp::Negate: stack[depth - 1] = -stack[depth - 1]; break;
+		case ExprOp::Complement: stack[depth - 1] = ~stack[depth - 1]; break;
+		default: {
+			depth--;
+			EvalStatus status = ApplyOperator(node.op, stack[depth - 1], stack[depth], stack[depth - 1]);
+			if (status != EvalStatus::Ok) return status;
+		} break;
+		}
+	}
+	result = stack[0];
+	return EvalStatus::Ok;
+}
+
+// A value for relocatable output: constant plus a sum of symbol addresses
+// times their coefficients, with zero coefficients dropped.
+struct LinearValue {
+	int64_t constant = 0;
+	std::vector<std::pair<SymbolID, int64_t>> terms;
+};
+
+// Like Evaluate, but a symbol may stand for an address only known at link
+// time; operations other than adding, subtracting and scaling such values
+// are NotRelocatable. resolve(SymbolID, LinearValue &) fills in constants
+// and returns false for unresolved ones.
+EvalStatus EvaluateLinear(std::span<const ExprNode> nodes, const std::function<bool(SymbolID, LinearValue &)> &resolve, LinearValue &result);
+
+// Infix text with only the parentheses precedence needs.
+std::string FormatExpression(std::span<const ExprNode> nodes, const SymbolTable &symbols);
+
+}
\ No newline at end of file
@@ -0,0 +1,112 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOGDI
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "File.h"
+
+namespace REASM {
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string &path) {
+	m_File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_File == INVALID_HANDLE_VALUE) {
+		m_Error = "Unable to open file: " + path;
+		return;
+	}
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(m_File, &size);
+	m_Size = static_cast<size_t>(size.QuadPart);
+	if (m_Size == 0) return;
+
+	m_Mapping = CreateFileMappingA(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m_Mapping) {
+		m_Error = "Unable to map file: " + path;
+		m_Size = 0;
+		return;
+	}
+	m_Data = static_cast<const char *>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!m_Data) {
+		m_Error = "Unable to map file: " + path;
+		m_Size = 0;
+		return;
+	}
+}
+
+MappedFile::~MappedFile() {
+	if (m_Data) UnmapViewOfFile(m_Data);
+	if (m_Mapping) CloseHandle(m_Mapping);
+	if (m_File && m_File != INVALID_HANDLE_VALUE) CloseHandle(m_File);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		m_Error = "Unable to open file: " + path;
+		return;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		m_Error = "Unable to stat file: " + path;
+		close(fd);
+		return;
+	}
+
+	m_Size = static_cast<size_t>(info.st_size);
+	if (m_Size > 0) {
+		void *data = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			m_Error = "Unable to map file: " + path;
+			m_Size = 0;
+			close(fd);
+			return;
+		}
+		madvise(data, m_Size, MADV_SEQUENTIAL);
+		m_Data = static_cast<const char *>(data);
+	}
+
+	close(fd);
+}
+
+MappedFile::~MappedFile() {
+	if (m_Data) munmap(const_cast<char *>(m_Data), m_Size);
+}
+
+#endif
+
+bool IncludedFiles::Read(std::string_view path, std::string_view &contents, std::string &error) {
+	std::string resolved = Resolve(path);
+	for (const auto &[name, file] : m_Files) {
+		if (name == resolved) {
+			contents = file->GetContents();
+			return true;
+		}
+	}
+
+	auto file = std::make_unique<MappedFile>(resolved);
+	if (!file->IsValid()) {
+		error = file->GetError();
+		return false;
+	}
+	contents = file->GetContents();
+	m_Files.emplace_back(std::move(resolved), std::move(file));
+	return true;
+}
+
+std::string IncludedFiles::Resolve(std::string_view path) const {
+	return (m_Directory / std::filesystem::path(path)).string();
+}
+
+}
\ No newline at end of file
@@ -1,12 +1,16 @@
 #pragma once
 
+#include <filesystem>
 #include <fstream>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace REASM {
 
-std::string GetFileContents(std::string path) {
+inline std::string GetFileContents(std::string path) {
 	std::ifstream file(path);
 	std::stringstream buffer;
 
@@ -14,4 +18,44 @@ std::string GetFileContents(std::string path) {
 	return buffer.str();
 }
 
+// Read-only view of a whole file, mapped once. Tokens lexed from it point
+// straight into the mapping, so it must outlive them. Failing to open or map
+// leaves it invalid with the reason in GetError.
+class MappedFile {
+public:
+	MappedFile(const std::string &path);
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	bool IsValid() const { return m_Error.empty(); }
+	const std::string &GetError() const { return m_Error; }
+	std::string_view GetContents() const { return std::string_view(m_Data, m_Size); }
+private:
+	const char *m_Data = nullptr;
+	size_t m_Size = 0;
+	std::string m_Error;
+#ifdef _WIN32
+	void *m_File = nullptr;
+	void *m_Mapping = nullptr;
+#endif
+};
+
+// The files a source pulls in with INCBIN, named relative to its directory.
+// Each is mapped on first use and stays mapped while this lives, so the
+// assembler can copy straight from the mapping.
+class IncludedFiles {
+public:
+	IncludedFiles(const std::string &source)
+		: m_Directory(std::filesystem::path(source).parent_path()) {}
+
+	bool Read(std::string_view path, std::string_view &contents, std::string &error);
+	// Where Read looks for path.
+	std::string Resolve(std::string_view path) const;
+private:
+	std::filesystem::path m_Directory;
+	std::vector<std::pair<std::string, std::unique_ptr<MappedFile>>> m_Files;
+};
+
 }
\ No newline at end of file
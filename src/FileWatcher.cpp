@@ -0,0 +1,142 @@
+#include "FileWatcher.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#else
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#endif
+
+namespace REASM {
+
+// Saves often arrive as several events in quick succession; they are folded
+// into one change once this long passes without another.
+static constexpr int SettleMilliseconds = 20;
+
+#ifdef __linux__
+
+FileWatcher::FileWatcher(const std::string &path) : m_Path(path) {
+	m_Inotify = inotify_init1(IN_CLOEXEC);
+	if (m_Inotify < 0) {
+		m_Error = "Unable to start watching: " + path;
+		return;
+	}
+
+	Add(path);
+}
+
+FileWatcher::~FileWatcher() {
+	if (m_Inotify >= 0) close(m_Inotify);
+}
+
+void FileWatcher::Add(const std::string &path) {
+	std::filesystem::path file(path);
+	std::filesystem::path directory = file.parent_path();
+	if (directory.empty()) directory = ".";
+	int watch = inotify_add_watch(m_Inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	if (watch < 0) {
+		m_Error = "Unable to watch directory: " + directory.string();
+		return;
+	}
+	m_Entries.push_back(Entry { .watch = watch, .name = file.filename().string() });
+}
+
+// Watches on directories no longer needed are kept: adding a directory again
+// returns its existing descriptor, so changes queued while building still
+// match.
+void FileWatcher::SetPaths(const std::vector<std::string> &paths) {
+	m_Entries.clear();
+	for (const std::string &path : paths) Add(path);
+}
+
+bool FileWatcher::Wait() {
+	alignas(inotify_event) char buffer[4096];
+	bool changed = false;
+	while (true) {
+		pollfd descriptor { .fd = m_Inotify, .events = POLLIN, .revents = 0 };
+		int ready = poll(&descriptor, 1, changed ? SettleMilliseconds : -1);
+		if (ready < 0 && errno == EINTR) continue;
+		if (ready < 0) {
+			m_Error = "Unable to wait for changes: " + m_Path.string();
+			return false;
+		}
+		if (ready == 0) return true;
+
+		ssize_t length = read(m_Inotify, buffer, sizeof(buffer));
+		if (length < 0 && errno == EINTR) continue;
+		if (length < 0) {
+			m_Error = "Unable to read changes: " + m_Path.string();
+			return false;
+		}
+
+		for (ssize_t offset = 0; offset < length;) {
+			const inotify_event *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+			if (event->len > 0) {
+				for (const Entry &entry : m_Entries) {
+					if (entry.watch == event->wd && entry.name == event->name) changed = true;
+				}
+			}
+			offset += sizeof(inotify_event) + event->len;
+		}
+	}
+}
+
+#else
+
+static constexpr int PollMilliseconds = 100;
+
+FileWatcher::FileWatcher(const std::string &path) : m_Path(path) {
+	Add(path);
+}
+
+FileWatcher::~FileWatcher() {}
+
+void FileWatcher::Add(const std::string &path) {
+	std::error_code error;
+	auto lastWrite = std::filesystem::last_write_time(path, error);
+	if (error) {
+		m_Error = "Unable to watch file: " + path;
+		return;
+	}
+	m_Entries.push_back(Entry { .path = path, .lastWrite = lastWrite });
+}
+
+// A file watched before keeps its last seen time, so a write made while
+// building is still noticed.
+void FileWatcher::SetPaths(const std::vector<std::string> &paths) {
+	std::vector<Entry> previous = std::move(m_Entries);
+	m_Entries.clear();
+	for (const std::string &path : paths) {
+		auto found = std::find_if(previous.begin(), previous.end(), [&path](const Entry &entry) { return entry.path == path; });
+		if (found != previous.end()) m_Entries.push_back(*found);
+		else Add(path);
+	}
+}
+
+bool FileWatcher::Wait() {
+	while (true) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(PollMilliseconds));
+
+		bool changed = false;
+		for (Entry &entry : m_Entries) {
+			std::error_code error;
+			auto lastWrite = std::filesystem::last_write_time(entry.path, error);
+			if (error || lastWrite == entry.lastWrite) continue;
+
+			entry.lastWrite = lastWrite;
+			changed = true;
+		}
+		if (!changed) continue;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(SettleMilliseconds));
+		return true;
+	}
+}
+
+#endif
+
+}
\ No newline at end of file
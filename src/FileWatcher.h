@@ -0,0 +1,51 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace REASM {
+
+// Blocks until one of a set of files is written again. Editors often save by writing a new
+// file and renaming it over the old one, so on Linux the parent directory is
+// watched with inotify and events are filtered by name; elsewhere the
+// modification time is polled.
+class FileWatcher {
+public:
+	FileWatcher(const std::string &path);
+	~FileWatcher();
+
+	FileWatcher(const FileWatcher &) = delete;
+	FileWatcher &operator=(const FileWatcher &) = delete;
+
+	bool IsValid() const { return m_Error.empty(); }
+	const std::string &GetError() const { return m_Error; }
+
+	// Watches these files from now on, in place of the ones before.
+	void SetPaths(const std::vector<std::string> &paths);
+
+	// Returns once a file has changed and writes to it have settled, or
+	// false on error.
+	bool Wait();
+private:
+	void Add(const std::string &path);
+
+	std::filesystem::path m_Path;
+	std::string m_Error;
+#ifdef __linux__
+	struct Entry {
+		int watch;
+		std::string name;
+	};
+
+	int m_Inotify = -1;
+#else
+	struct Entry {
+		std::filesystem::path path;
+		std::filesystem::file_time_type lastWrite;
+	};
+#endif
+	std::vector<Entry> m_Entries;
+};
+
+}
\ No newline at end of file
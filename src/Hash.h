@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstring>
+#include <string_view>
+
+namespace REASM {
+
+// XXH64: reads 32 bytes per round, so hashing a whole source costs far less
+// than lexing it.
+namespace Hash {
+
+constexpr uint64_t Prime1 = 11400714785074694791ull;
+constexpr uint64_t Prime2 = 14029467366897019727ull;
+constexpr uint64_t Prime3 = 1609587929392839161ull;
+constexpr uint64_t Prime4 = 9650029242287828579ull;
+constexpr uint64_t Prime5 = 2870177450012600261ull;
+
+inline uint64_t Rotl(uint64_t value, int bits) { return (value << bits) | (value >> (64 - bits)); }
+
+inline uint64_t Read64(const uint8_t *data) {
+	uint64_t value;
+	std::memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+inline uint32_t Read32(const uint8_t *data) {
+	uint32_t value;
+	std::memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+inline uint64_t Round(uint64_t acc, uint64_t input) {
+	acc += input * Prime2;
+	return Rotl(acc, 31) * Prime1;
+}
+
+inline uint64_t Merge(uint64_t acc, uint64_t value) {
+	acc ^= Round(0, value);
+	return acc * Prime1 + Prime4;
+}
+
+}
+
+inline uint64_t HashBytes(const void *bytes, size_t size, uint64_t seed = 0) {
+	using namespace Hash;
+	const uint8_t *data = static_cast<const uint8_t *>(bytes);
+	const uint8_t *end = data + size;
+
+	uint64_t hash;
+	if (size >= 32) {
+		uint64_t v1 = seed + Prime1 + Prime2;
+		uint64_t v2 = seed + Prime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - Prime1;
+		do {
+			v1 = Round(v1, Read64(data));
+			v2 = Round(v2, Read64(data + 8));
+			v3 = Round(v3, Read64(data + 16));
+			v4 = Round(v4, Read64(data + 24));
+			data += 32;
+		} while (data + 32 <= end);
+
+		hash = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+		hash = Merge(hash, v1);
+		hash = Merge(hash, v2);
+		hash = Merge(hash, v3);
+		hash = Merge(hash, v4);
+	} else {
+		hash = seed + Prime5;
+	}
+	hash += size;
+
+	for (; data + 8 <= end; data += 8) hash = Rotl(hash ^ Round(0, Read64(data)), 27) * Prime1 + Prime4;
+	if (data + 4 <= end) {
+		hash = Rotl(hash ^ (Read32(data) * Prime1), 23) * Prime2 + Prime3;
+		data += 4;
+	}
+	for (; data < end; data++) hash = Rotl(hash ^ (*data * Prime5), 11) * Prime1;
+
+	hash ^= hash >> 33;
+	hash *= Prime2;
+	hash ^= hash >> 29;
+	hash *= Prime3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+inline uint64_t HashBytes(std::string_view bytes, uint64_t seed = 0) {
+	return HashBytes(bytes.data(), bytes.size(), seed);
+}
+
+}
\ No newline at end of file
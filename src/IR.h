@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "ISA.h"
+#include "SymbolTable.h"
+
+namespace REASM {
+
+enum class IRKind : uint8_t {
+	Instruction,	// desc indexes ISA::Instructions
+	Label,			// values[0] is the SymbolID being defined
+	Org,			// values[0] is the new origin
+	Data,			// one DB or DW value: operand 0, width Byte or Word
+	Space,			// DS: values[0] bytes of values[1]
+	Binary,			// INCBIN: values[2] bytes from values[1] on in blob values[0]
+};
+
+// One fixed-size record per parsed line, produced by the parse stage and
+// consumed by layout and encoding. Operand values are already resolved to
+// register indices, immediates or SymbolIDs.
+struct Instruction {
+	IRKind kind;
+	uint8_t desc;
+	OperandKind operands[3];
+	ImmediateWidth width;	// as written; Auto unless the mnemonic had a suffix
+	uint32_t values[3];
+	uint32_t offset;	// source offset, for diagnostics
+
+	const InstructionDesc &GetDesc() const { return ISA::Instructions[desc]; }
+	bool IsData() const { return kind == IRKind::Data || kind == IRKind::Space || kind == IRKind::Binary; }
+	uint32_t GetSize() const {
+		switch (kind) {
+		case IRKind::Instruction: return GetDesc().size;
+		case IRKind::Data: return width == ImmediateWidth::Byte ? 1 : 2;
+		case IRKind::Space: return values[0];
+		case IRKind::Binary: return values[2];
+		default: return 0;
+		}
+	}
+};
+
+static_assert(sizeof(Instruction) <= 24, "IR records should stay small enough to stream through cache");
+
+}
\ No newline at end of file
@@ -0,0 +1,376 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <iterator>
+#include <string_view>
+
+#include "Defines/Opcodes.h"
+#include "StringUtils.h"
+
+namespace REASM {
+
+enum class OperandKind : uint8_t {
+	None,
+	Reg,		// 1 byte register index
+	Imm,		// 16-bit little-endian immediate
+	Imm8,		// 8-bit immediate, zero-extended; only the short form of an Imm row
+	Addr,		// 16-bit little-endian label address
+	Expr,		// only in IR: a value that needs label addresses, see Expression.h
+};
+
+constexpr uint8_t OperandSize(OperandKind kind) {
+	switch (kind) {
+	case OperandKind::Reg:
+	case OperandKind::Imm8: return 1;
+	case OperandKind::Imm:
+	case OperandKind::Addr:
+	case OperandKind::Expr: return 2;
+	default: return 0;
+	}
+}
+
+// What an instruction does besides writing its first operand, for passes that
+// rewrite or drop instructions. The flags are the zero, sign and carry bits
+// tested by the conditional jumps.
+enum InstructionEffect : uint8_t {
+	ReadsFlags	= 1 << 0,
+	WritesFlags	= 1 << 1,
+	Branches	= 1 << 2,	// may continue somewhere other than the next instruction
+	SkipsNext	= 1 << 3,	// the compares skip the next instruction when false
+	Stops		= 1 << 4,
+};
+
+constexpr uint8_t EffectsOf(Byte opcode) {
+	if (opcode == ADC_R || opcode == ADC_I || opcode == ADC_RI || opcode == ADC_IR ||
+		opcode == SBC_R || opcode == SBC_I || opcode == SBC_RI || opcode == SBC_IR) return ReadsFlags | WritesFlags;
+	if (opcode >= ADD_R && opcode <= CMP_RI) return WritesFlags;
+	if (opcode >= IGT_R && opcode <= ILE_RI) return SkipsNext;
+	if (opcode == JMP) return Branches;
+	if (opcode >= JNZ && opcode <= JC) return ReadsFlags | Branches;
+	if (opcode == HLT) return Stops;
+	return 0;
+}
+
+struct InstructionDesc {
+	std::string_view mnemonic;
+	Byte opcode;
+	OperandKind operands[3];
+	uint8_t operandCount;
+	uint8_t size;
+	uint8_t effects;
+};
+
+constexpr InstructionDesc Describe(std::string_view mnemonic, Byte opcode, OperandKind a = OperandKind::None,
+		OperandKind b = OperandKind::None, OperandKind c = OperandKind::None) {
+	InstructionDesc desc { mnemonic, opcode, { a, b, c }, 0, 1, EffectsOf(opcode) };
+	for (OperandKind kind : desc.operands) {
+		if (kind == OperandKind::None) break;
+		desc.operandCount++;
+		desc.size += OperandSize(kind);
+	}
+	return desc;
+}
+
+struct MnemonicDesc {
+	std::string_view name;
+	uint8_t first;
+	uint8_t count;
+};
+
+// A .B or .W suffix on a mnemonic forces the 8- or 16-bit form of its
+// immediate instead of letting Relax choose. The lexer keeps it in an OPCODE
+// token's payload above the mnemonic index.
+enum class ImmediateWidth : uint8_t {
+	Auto,
+	Byte,
+	Word,
+};
+constexpr uint32_t WidthShift = 8;
+
+namespace ISA {
+
+constexpr OperandKind R = OperandKind::Reg;
+constexpr OperandKind I = OperandKind::Imm;
+constexpr OperandKind B = OperandKind::Imm8;
+constexpr OperandKind A = OperandKind::Addr;
+
+// Every encoding the assembler knows about. Rows sharing a mnemonic must be
+// adjacent; the parser picks the first row whose operands match, and Relax
+// then moves to the short form where the value fits.
+constexpr InstructionDesc Instructions[] = {
+	Describe("MOV", MOV_IM, R, I),
+	Describe("MOV", MOV_R, R, R),
+
+	Describe("ADD", ADD_R, R, R, R),
+	Describe("ADD", ADD_RI, R, R, I),
+	Describe("ADD", ADD_IR, R, I, R),
+	Describe("ADD", ADD_I, R, I, I),
+
+	Describe("SUB", SUB_R, R, R, R),
+	Describe("SUB", SUB_RI, R, R, I),
+	Describe("SUB", SUB_IR, R, I, R),
+	Describe("SUB", SUB_I, R, I, I),
+
+	Describe("ADC", ADC_R, R, R, R),
+	Describe("ADC", ADC_RI, R, R, I),
+	Describe("ADC", ADC_IR, R, I, R),
+	Describe("ADC", ADC_I, R, I, I),
+
+	Describe("SBC", SBC_R, R, R, R),
+	Describe("SBC", SBC_RI, R, R, I),
+	Describe("SBC", SBC_IR, R, I, R),
+	Describe("SBC", SBC_I, R, I, I),
+
+	Describe("MUL", MUL_R, R, R, R),
+	Describe("MUL", MUL_RI, R, R, I),
+	Describe("MUL", MUL_IR, R, I, R),
+	Describe("MUL", MUL_I, R, I, I),
+
+	Describe("DIV", DIV_R, R, R, R),
+	Describe("DIV", DIV_RI, R, R, I),
+	Describe("DIV", DIV_IR, R, I, R),
+	Describe("DIV", DIV_I, R, I, I),
+
+	Describe("DEC", DEC_R, R),
+	Describe("INC", INC_R, R),
+
+	Describe("AND", AND_R, R, R, R),
+	Describe("AND", AND_RI, R, R, I),
+	Describe("AND", AND_IR, R, I, R),
+	Describe("AND", AND_I, R, I, I),
+
+	Describe("OR", OR_R, R, R, R),
+	Describe("OR", OR_RI, R, R, I),
+	Describe("OR", OR_IR, R, I, R),
+	Describe("OR", OR_I, R, I, I),
+
+	Describe("XOR", XOR_R, R, R, R),
+	Describe("XOR", XOR_RI, R, R, I),
+	Describe("XOR", XOR_IR, R, I, R),
+	Describe("XOR", XOR_I, R, I, I),
+
+	Describe("NOT", NOT_R, R, R),
+
+	Describe("SHL", SHL_R, R, R, R),
+	Describe("SHL", SHL_RI, R, R, I),
+	Describe("SHL", SHL_IR, R, I, R),
+	Describe("SHL", SHL_I, R, I, I),
+
+	Describe("SHR", SHR_R, R, R, R),
+	Describe("SHR", SHR_RI, R, R, I),
+	Describe("SHR", SHR_IR, R, I, R),
+	Describe("SHR", SHR_I, R, I, I),
+
+	Describe("CMP", CMP_R, R, R),
+	Describe("CMP", CMP_RI, R, I),
+
+	Describe("IGT", IGT_R, R, R),
+	Describe("IGT", IGT_RI, R, I),
+
+	Describe("ILT", ILT_R, R, R),
+	Describe("ILT", ILT_RI, R, I),
+
+	Describe("IGE", IGE_R, R, R),
+	Describe("IGE", IGE_RI, R, I),
+
+	Describe("ILE", ILE_R, R, R),
+	Describe("ILE", ILE_RI, R, I),
+
+	Describe("JMP", JMP, A),
+	Describe("JNZ", JNZ, A),
+	Describe("JZ", JZ, A),
+	Describe("JNS", JNS, A),
+	Describe("JS", JS, A),
+	Describe("JNC", JNC, A),
+	Describe("JC", JC, A),
+
+	Describe("PUSH", PUSH_R, R),
+	Describe("PUSH", PUSH_IM_W, I),
+	Describe("PUSH", PUSH_IM_B, B),
+	Describe("POP", POP_R, R),
+
+	Describe("HLT", HLT),
+};
+
+constexpr size_t InstructionCount = std::size(Instructions);
+
+// Instructions row for every opcode byte, for passes that build records from
+// an opcode rather than a mnemonic.
+constexpr uint8_t NoInstruction = 0xFF;
+
+constexpr auto OpcodeTable = [] {
+	std::array<uint8_t, 256> table {};
+	for (uint8_t &entry : table) entry = NoInstruction;
+	for (size_t i = 0; i < InstructionCount; i++) table[Instructions[i].opcode] = static_cast<uint8_t>(i);
+	return table;
+}();
+
+static_assert(InstructionCount < NoInstruction);
+
+constexpr size_t MaxInstructionSize = [] {
+	size_t size = 0;
+	for (const InstructionDesc &desc : Instructions) size = desc.size > size ? desc.size : size;
+	return size;
+}();
+
+// For each row, the row of the same mnemonic with an 8-bit immediate in
+// place of each 16-bit one, or NoInstruction.
+constexpr auto ShortForms = [] {
+	std::array<uint8_t, InstructionCount> table {};
+	for (size_t i = 0; i < InstructionCount; i++) {
+		table[i] = NoInstruction;
+		for (size_t j = 0; j < InstructionCount; j++) {
+			const InstructionDesc &wide = Instructions[i], &narrow = Instructions[j];
+			if (i == j || wide.mnemonic != narrow.mnemonic || wide.operandCount != narrow.operandCount) continue;
+
+			bool shorter = false, match = true;
+			for (uint8_t operand = 0; operand < wide.operandCount; operand++) {
+				OperandKind a = wide.operands[operand], b = narrow.operands[operand];
+				if (a == OperandKind::Imm && b == OperandKind::Imm8) shorter = true;
+				else if (a != b) match = false;
+			}
+			if (match && shorter) table[i] = static_cast<uint8_t>(j);
+		}
+	}
+	return table;
+}();
+
+static_assert(Instructions[ShortForms[OpcodeTable[PUSH_IM_W]]].opcode == PUSH_IM_B);
+
+constexpr size_t CountMnemonics() {
+	size_t count = 0;
+	for (size_t i = 0; i < InstructionCount; i++) {
+		if (i == 0 || Instructions[i].mnemonic != Instructions[i - 1].mnemonic) count++;
+	}
+	return count;
+}
+
+constexpr auto Mnemonics = [] {
+	std::array<MnemonicDesc, CountMnemonics()> mnemonics {};
+	size_t index = 0;
+	for (size_t i = 0; i < InstructionCount; i++) {
+		if (i > 0 && Instructions[i].mnemonic == Instructions[i - 1].mnemonic) {
+			mnemonics[index - 1].count++;
+			continue;
+		}
+		mnemonics[index++] = MnemonicDesc { Instructions[i].mnemonic, static_cast<uint8_t>(i), 1 };
+	}
+	return mnemonics;
+}();
+
+constexpr bool MnemonicsAreGrouped() {
+	for (size_t i = 0; i < Mnemonics.size(); i++) {
+		for (size_t j = i + 1; j < Mnemonics.size(); j++) {
+			if (EqualsIgnoreCase(Mnemonics[i].name, Mnemonics[j].name)) return false;
+		}
+	}
+	return true;
+}
+static_assert(MnemonicsAreGrouped(), "Instructions rows sharing a mnemonic must be adjacent");
+
+// Keyword lookup is a perfect hash: the seed is searched at compile time so
+// that every mnemonic lands in its own bucket.
+constexpr size_t MnemonicBuckets = 128;
+constexpr uint8_t NoMnemonic = 0xFF;
+
+constexpr uint32_t HashMnemonic(std::string_view name, uint32_t seed) {
+	uint32_t hash = 2166136261u ^ seed;
+	for (char c : name) {
+		hash ^= static_cast<uint8_t>(ToUpperASCII(c));
+		hash *= 16777619u;
+	}
+	return hash ^ (hash >> 15);
+}
+
+constexpr uint32_t FindMnemonicSeed() {
+	for (uint32_t seed = 0; seed < 100000; seed++) {
+		bool used[MnemonicBuckets] = {};
+		bool collision = false;
+		for (const MnemonicDesc &mnemonic : Mnemonics) {
+			size_t bucket = HashMnemonic(mnemonic.name, seed) & (MnemonicBuckets - 1);
+			if (used[bucket]) { collision = true; break; }
+			used[bucket] = true;
+		}
+		if (!collision) return seed;
+	}
+	return UINT32_MAX;
+}
+
+constexpr uint32_t MnemonicSeed = FindMnemonicSeed();
+static_assert(MnemonicSeed != UINT32_MAX, "No perfect hash seed for the mnemonic table");
+
+constexpr auto MnemonicTable = [] {
+	std::array<uint8_t, MnemonicBuckets> table {};
+	for (uint8_t &entry : table) entry = NoMnemonic;
+	for (size_t i = 0; i < Mnemonics.size(); i++) {
+		table[HashMnemonic(Mnemonics[i].name, MnemonicSeed) & (MnemonicBuckets - 1)] = static_cast<uint8_t>(i);
+	}
+	return table;
+}();
+
+constexpr uint8_t FindMnemonic(std::string_view name) {
+	uint8_t index = MnemonicTable[HashMnemonic(name, MnemonicSeed) & (MnemonicBuckets - 1)];
+	if (index == NoMnemonic || !EqualsIgnoreCase(Mnemonics[index].name, name)) return NoMnemonic;
+	return index;
+}
+
+// Any value fits an immediate or address field: a label can be loaded as a
+// number and a jump can take a computed target.
+constexpr bool OperandFits(OperandKind field, OperandKind operand) {
+	if (field == OperandKind::Imm || field == OperandKind::Addr)
+		return operand == OperandKind::Imm || operand == OperandKind::Addr || operand == OperandKind::Expr;
+	return field == operand;
+}
+
+constexpr const InstructionDesc *FindInstruction(uint8_t mnemonic, const OperandKind *operands, uint8_t count) {
+	const MnemonicDesc &desc = Mnemonics[mnemonic];
+	for (uint8_t i = desc.first; i < desc.first + desc.count; i++) {
+		const InstructionDesc &instruction = Instructions[i];
+		if (instruction.operandCount != count) continue;
+
+		bool match = true;
+		for (uint8_t operand = 0; operand < count; operand++) {
+			if (!OperandFits(instruction.operands[operand], operands[operand])) { match = false; break; }
+		}
+		if (match) return &instruction;
+	}
+	return nullptr;
+}
+
+static_assert(FindMnemonic("jc") != NoMnemonic && Mnemonics[FindMnemonic("jc")].name == "JC");
+static_assert(FindMnemonic("ORG") == NoMnemonic);
+
+// Since any value fits either kind of field, no mnemonic may offer both in
+// the same position or the first row would always win.
+constexpr bool ValueFieldsAreUnambiguous() {
+	for (const MnemonicDesc &mnemonic : Mnemonics) {
+		for (uint8_t i = mnemonic.first; i < mnemonic.first + mnemonic.count; i++) {
+			for (uint8_t j = i + 1; j < mnemonic.first + mnemonic.count; j++) {
+				bool same = Instructions[i].operandCount == Instructions[j].operandCount;
+				for (uint8_t operand = 0; same && operand < Instructions[i].operandCount; operand++) {
+					OperandKind a = Instructions[i].operands[operand], b = Instructions[j].operands[operand];
+					same = a == b || (OperandFits(a, OperandKind::Expr) && OperandFits(b, OperandKind::Expr));
+				}
+				if (same) return false;
+			}
+		}
+	}
+	return true;
+}
+static_assert(ValueFieldsAreUnambiguous(), "Rows of a mnemonic must differ in more than immediate versus address fields");
+
+// The parser reads Instructions[first].operandCount operands per mnemonic.
+constexpr bool OperandCountsAgree() {
+	for (const MnemonicDesc &mnemonic : Mnemonics) {
+		for (uint8_t i = mnemonic.first; i < mnemonic.first + mnemonic.count; i++) {
+			if (Instructions[i].operandCount != Instructions[mnemonic.first].operandCount) return false;
+		}
+	}
+	return true;
+}
+static_assert(OperandCountsAgree(), "Every row of a mnemonic must take the same number of operands");
+
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "Image.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+#include "ByteStream.h"
+
+namespace REASM {
+
+// Layout, all integers little-endian:
+//   "RSEG" u16 version, u16 reserved, u32 segments
+//   segment: u16 origin, u16 reserved, u32 size, bytes
+static constexpr char Magic[4] = { 'R', 'S', 'E', 'G' };
+static constexpr uint16_t Version = 1;
+static constexpr size_t HexRecordSize = 16;
+
+uint16_t SegmentedImage::Base() const {
+	uint16_t base = UINT16_MAX;
+	for (const ImageSegment &segment : segments) base = std::min(base, segment.origin);
+	return segments.empty() ? 0 : base;
+}
+
+size_t SegmentedImage::FlatSize() const {
+	size_t end = 0;
+	for (const ImageSegment &segment : segments) end = std::max(end, static_cast<size_t>(segment.origin) + segment.size);
+	return segments.empty() ? 0 : end - Base();
+}
+
+std::vector<uint8_t> SegmentedImage::Flatten() const {
+	std::vector<uint8_t> flat(FlatSize(), 0);
+	uint16_t base = Base();
+	for (const ImageSegment &segment : segments) {
+		std::memcpy(flat.data() + (segment.origin - base), bytes.data() + segment.offset, segment.size);
+	}
+	return flat;
+}
+
+std::vector<uint8_t> SegmentedImage::Serialize() const {
+	std::vector<uint8_t> out;
+	out.reserve(bytes.size() + 12 + segments.size() * 8);
+	ByteWriter writer(out);
+
+	writer.Bytes(Magic, sizeof(Magic));
+	writer.U16(Version);
+	writer.U16(0);
+	writer.U32(static_cast<uint32_t>(segments.size()));
+	for (const ImageSegment &segment : segments) {
+		writer.U16(segment.origin);
+		writer.U16(0);
+		writer.U32(segment.size);
+		writer.Bytes(bytes.data() + segment.offset, segment.size);
+	}
+	return out;
+}
+
+bool SegmentedImage::Deserialize(std::string_view data, SegmentedImage &image, std::string &error) {
+	ByteReader reader(data);
+	image = SegmentedImage {};
+
+	std::string_view magic;
+	uint16_t version, reserved;
+	uint32_t segmentCount;
+	if (!reader.Bytes(magic, sizeof(Magic)) || std::memcmp(magic.data(), Magic, sizeof(Magic)) != 0) {
+		error = "Not a segmented image";
+		return false;
+	}
+	if (!reader.U16(version) || !reader.U16(reserved) || version != Version) {
+		error = "Unsupported segmented image version";
+		return false;
+	}
+	if (!reader.U32(segmentCount)) {
+		error = "Truncated segmented image header";
+		return false;
+	}
+
+	for (uint32_t i = 0; i < segmentCount; i++) {
+		uint16_t origin, pad;
+		uint32_t size;
+		std::string_view bytes;
+		if (!reader.U16(origin) || !reader.U16(pad) || !reader.U32(size) || !reader.Bytes(bytes, size)) {
+			error = "Truncated segment";
+			return false;
+		}
+		image.segments.push_back(ImageSegment { .origin = origin, .offset = static_cast<uint32_t>(image.bytes.size()), .size = size });
+		image.bytes.insert(image.bytes.end(), bytes.begin(), bytes.end());
+	}
+	return true;
+}
+
+static void AppendHexRecord(std::string &out, uint32_t address, uint8_t type, const uint8_t *data, size_t size) {
+	static constexpr char Digits[] = "0123456789ABCDEF";
+	uint8_t checksum = static_cast<uint8_t>(size + (address >> 8) + address + type);
+	auto hexByte = [&](uint8_t value) {
+		out += Digits[value >> 4];
+		out += Digits[value & 0xF];
+	};
+
+	out += ':';
+	hexByte(static_cast<uint8_t>(size));
+	hexByte(static_cast<uint8_t>(address >> 8));
+	hexByte(static_cast<uint8_t>(address));
+	hexByte(type);
+	for (size_t i = 0; i < size; i++) {
+		hexByte(data[i]);
+		checksum = static_cast<uint8_t>(checksum + data[i]);
+	}
+	hexByte(static_cast<uint8_t>(-checksum));
+	out += '\n';
+}
+
+std::string SegmentedImage::ToIntelHex() const {
+	std::string out;
+	out.reserve(bytes.size() * 2 + bytes.size() / HexRecordSize * 12 + 32);
+	uint32_t upper = 0;
+	for (const ImageSegment &segment : segments) {
+		size_t done = 0;
+		while (done < segment.size) {
+			uint32_t address = static_cast<uint32_t>(segment.origin + done);
+			if (address >> 16 != upper) {
+				upper = address >> 16;
+				uint8_t extended[2] = { static_cast<uint8_t>(upper >> 8), static_cast<uint8_t>(upper) };
+				AppendHexRecord(out, 0, 0x04, extended, sizeof(extended));
+			}
+
+			// A record's address can't carry past 0xFFFF.
+			size_t size = std::min({ HexRecordSize, segment.size - done, size_t(0x10000 - (address & 0xFFFF)) });
+			AppendHexRecord(out, address & 0xFFFF, 0x00, bytes.data() + segment.offset + done, size);
+			done += size;
+		}
+	}
+	AppendHexRecord(out, 0, 0x01, nullptr, 0);
+	return out;
+}
+
+size_t FindOverlap(std::span<const ImageSegment> segments) {
+	std::vector<size_t> order(segments.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return segments[a].origin < segments[b].origin; });
+
+	// Each segment against the one reaching furthest among those starting
+	// at or before it.
+	size_t found = segments.size();
+	size_t furthest = segments.size();
+	uint64_t end = 0;
+	for (size_t index : order) {
+		const ImageSegment &segment = segments[index];
+		if (furthest != segments.size() && segment.origin < end) found = std::min(found, std::max(index, furthest));
+		if (static_cast<uint64_t>(segment.origin) + segment.size > end) {
+			end = static_cast<uint64_t>(segment.origin) + segment.size;
+			furthest = index;
+		}
+	}
+	return found;
+}
+
+}
\ No newline at end of file
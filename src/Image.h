@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace REASM {
+
+// The code one ORG places: size bytes from offset in the image's bytes, at
+// origin onwards.
+struct ImageSegment {
+	uint16_t origin;
+	uint32_t offset;
+	uint32_t size;
+};
+
+// An assembled program as its ORG regions, each kept as its own extent so
+// the gaps between them cost nothing until a flat image is written out.
+// Empty regions are left out.
+struct SegmentedImage {
+	std::vector<uint8_t> bytes;				// every segment's bytes, in source order
+	std::vector<ImageSegment> segments;
+
+	// A flat image starts at the lowest origin and runs to the end of the
+	// segment that ends last.
+	uint16_t Base() const;
+	size_t FlatSize() const;
+	// That flat image, with the gaps zeroed.
+	std::vector<uint8_t> Flatten() const;
+
+	// The compact segmented binary: each segment's origin and bytes, nothing
+	// for the gaps.
+	std::vector<uint8_t> Serialize() const;
+	// Returns false and sets error when data is not a well-formed segmented
+	// binary.
+	static bool Deserialize(std::string_view data, SegmentedImage &image, std::string &error);
+
+	// Intel HEX with 16-byte data records. Addresses past 0xFFFF, from a
+	// segment that runs off the end of memory, get extended linear address
+	// records.
+	std::string ToIntelHex() const;
+};
+
+// The index of the first segment that overlaps one listed before it, or
+// segments.size() when none does.
+size_t FindOverlap(std::span<const ImageSegment> segments);
+
+}
\ No newline at end of file
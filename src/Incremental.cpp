@@ -0,0 +1,232 @@
+#include "Assemble.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace REASM {
+
+static constexpr size_t CompareBlock = 4096;
+
+static size_t CommonPrefix(std::string_view a, std::string_view b) {
+	size_t limit = std::min(a.size(), b.size());
+	size_t length = 0;
+	while (length + CompareBlock <= limit && std::memcmp(a.data() + length, b.data() + length, CompareBlock) == 0) length += CompareBlock;
+	while (length < limit && a[length] == b[length]) length++;
+	return length;
+}
+
+static size_t CommonSuffix(std::string_view a, std::string_view b, size_t limit) {
+	size_t length = 0;
+	while (length + CompareBlock <= limit &&
+		std::memcmp(a.data() + a.size() - length - CompareBlock, b.data() + b.size() - length - CompareBlock, CompareBlock) == 0)
+		length += CompareBlock;
+	while (length < limit && a[a.size() - length - 1] == b[b.size() - length - 1]) length++;
+	return length;
+}
+
+static bool IsLineStart(std::string_view text, size_t pos) {
+	return pos == 0 || text[pos - 1] == '\n';
+}
+
+AssembleResult Assembler::Update(std::string_view source) {
+	m_UpdateStats = UpdateStats {};
+	if (m_Incremental) {
+		try {
+			if (UpdateLines(source)) {
+				m_UpdateStats.incremental = true;
+				return Snapshot();
+			}
+		} catch (const DiagnosticError &) {
+			// Assembled again below, which reports the error with the
+			// same diagnostics a fresh build would.
+		}
+	}
+
+	return Rebuild(source);
+}
+
+AssembleResult Assembler::Rebuild(std::string_view source) {
+	AssembleResult result = Assemble(source);
+	m_UpdateStats.linesRelexed = std::count(source.begin(), source.end(), '\n') + (IsLineStart(source, source.size()) ? 0 : 1);
+
+	m_Incremental = result.success && !m_Options.relocatable && !m_Options.optimize && !m_CrossLine;
+	if (m_Incremental) {
+		m_Source.assign(source);
+		m_Image = result.image.bytes;
+	} else {
+		m_Source = std::string();
+		m_Image = std::vector<uint8_t>();
+	}
+	return result;
+}
+
+// Finds the lines that differ from the previous revision, assuming a single
+// edited region between a common prefix and suffix, and splices freshly
+// parsed records for them into the IR. Returns false, or throws, when a
+// full rebuild is needed instead.
+bool Assembler::UpdateLines(std::string_view source) {
+	std::string_view previous = m_Source;
+	size_t prefix = CommonPrefix(previous, source);
+	if (prefix == previous.size() && prefix == source.size()) return true;
+	size_t suffix = CommonSuffix(previous, source, std::min(previous.size(), source.size()) - prefix);
+
+	// Widen the edit to whole lines; text outside [start, end) is identical
+	// in both revisions and made of complete lines.
+	size_t start = prefix;
+	while (start > 0 && source[start - 1] != '\n') start--;
+	size_t previousEnd = previous.size() - suffix;
+	size_t end = source.size() - suffix;
+	if (!IsLineStart(previous, previousEnd) || !IsLineStart(source, end)) {
+		const char *newline = static_cast<const char *>(std::memchr(previous.data() + previousEnd, '\n', suffix));
+		size_t extend = newline ? static_cast<size_t>(newline - (previous.data() + previousEnd)) + 1 : suffix;
+		previousEnd += extend;
+		end += extend;
+	}
+
+	std::string_view lines = source.substr(start, end - start);
+	m_UpdateStats.linesRelexed = std::count(lines.begin(), lines.end(), '\n') + (IsLineStart(lines, lines.size()) ? 0 : 1);
+
+	// The edited lines get a table of their own, as a fresh lex of the whole
+	// file would have, so names left over from earlier revisions can't
+	// change how their identifiers classify.
+	m_Arena.Reset();
+	SymbolTable symbols;
+	TokenStream tokens = Lexer::Lex(lines, symbols, m_Arena, m_Options.jobs);
+	std::vector<Instruction> region;
+	region.reserve(tokens.GetStatementCount());
+	Parse(tokens, symbols, region, static_cast<uint32_t>(start));
+	if (m_CrossLine) return false;
+
+	for (Instruction &instruction : region) {
+		if (instruction.kind == IRKind::Label) instruction.values[0] = m_Symbols.Intern(symbols.Get(instruction.values[0]).name);
+		for (uint8_t operand = 0; operand < 3; operand++) {
+			if (instruction.operands[operand] == OperandKind::Addr) instruction.values[operand] = m_Symbols.Intern(symbols.Get(instruction.values[operand]).name);
+		}
+	}
+
+	// Records are ordered by source offset, so the ones parsed from the
+	// edited lines are a contiguous run.
+	auto byOffset = [](const Instruction &instruction, uint32_t offset) { return instruction.offset < offset; };
+	size_t first = std::lower_bound(m_Instructions.begin(), m_Instructions.end(), static_cast<uint32_t>(start), byOffset) - m_Instructions.begin();
+	size_t last = std::lower_bound(m_Instructions.begin() + first, m_Instructions.end(), static_cast<uint32_t>(previousEnd), byOffset) - m_Instructions.begin();
+
+	bool orgChanged = false;
+	size_t previousBytes = 0, regionBytes = 0;
+	std::vector<std::pair<SymbolID, uint16_t>> removed;
+	for (size_t i = first; i < last; i++) {
+		const Instruction &instruction = m_Instructions[i];
+		orgChanged |= instruction.kind == IRKind::Org;
+		previousBytes += instruction.GetSize();
+		if (instruction.kind == IRKind::Label) removed.emplace_back(instruction.values[0], m_Symbols.Get(instruction.values[0]).value);
+	}
+	for (const Instruction &instruction : region) {
+		orgChanged |= instruction.kind == IRKind::Org;
+		regionBytes += instruction.GetSize();
+	}
+
+	uint32_t regionOffset = first < m_Offsets.size() ? m_Offsets[first] : static_cast<uint32_t>(m_Image.size());
+	m_Instructions.erase(m_Instructions.begin() + first, m_Instructions.begin() + last);
+	m_Instructions.insert(m_Instructions.begin() + first, region.begin(), region.end());
+	m_Offsets.erase(m_Offsets.begin() + first, m_Offsets.begin() + last);
+	m_Offsets.insert(m_Offsets.begin() + first, region.size(), 0);
+
+	int64_t delta = static_cast<int64_t>(source.size()) - static_cast<int64_t>(previous.size());
+	if (delta != 0) {
+		for (size_t i = first + region.size(); i < m_Instructions.size(); i++) {
+			m_Instructions[i].offset = static_cast<uint32_t>(m_Instructions[i].offset + delta);
+		}
+	}
+	m_Source.replace(start, previousEnd - start, lines);
+
+	// Positions are only reported through Fail, which makes Update rebuild.
+	TokenStream located(m_Source, m_Arena);
+
+	if (orgChanged || regionBytes != previousBytes) {
+		for (SymbolID id = 0; id < m_Symbols.Size(); id++) m_Symbols.Get(id).defined = false;
+
+		m_Image.assign(Layout(located), 0);
+		Encode(m_Image);
+		m_UpdateStats.relaidOut = true;
+		return true;
+	}
+
+	// Same size and no ORG: every address outside the edited lines stands,
+	// so only their labels move and only their records are encoded again.
+	uint16_t org = 0x0000;
+	uint32_t segmentStart = 0;
+	for (size_t i = first; i-- > 0;) {
+		if (m_Instructions[i].kind == IRKind::Org) {
+			org = static_cast<uint16_t>(m_Instructions[i].values[0]);
+			segmentStart = m_Offsets[i];
+			break;
+		}
+	}
+
+	for (const auto &[id, value] : removed) m_Symbols.Get(id).defined = false;
+
+	std::vector<SymbolID> defined;
+	uint32_t offset = regionOffset;
+	for (size_t i = first; i < first + region.size(); i++) {
+		const Instruction &instruction = m_Instructions[i];
+		m_Offsets[i] = offset;
+		if (instruction.kind == IRKind::Label) {
+			Symbol &label = m_Symbols.Get(instruction.values[0]);
+			if (label.defined) return false;
+
+			label.value = static_cast<uint16_t>(org + offset - segmentStart);
+			label.defined = true;
+			defined.push_back(instruction.values[0]);
+		}
+		offset += instruction.GetSize();
+	}
+
+	std::vector<bool> changed(m_Symbols.Size(), false);
+	std::vector<bool> wasDefined(m_Symbols.Size(), false);
+	bool anyChanged = false;
+	for (const auto &[id, value] : removed) {
+		const Symbol &symbol = m_Symbols.Get(id);
+		wasDefined[id] = true;
+		if (!symbol.defined || symbol.value != value) changed[id] = anyChanged = true;
+	}
+	for (SymbolID id : defined) {
+		if (!wasDefined[id]) changed[id] = anyChanged = true;
+	}
+
+	for (size_t i = first; i < first + region.size(); i++) {
+		for (uint8_t operand = 0; operand < 3; operand++) {
+			if (m_Instructions[i].operands[operand] == OperandKind::Addr && !m_Symbols.Get(m_Instructions[i].values[operand]).defined) return false;
+		}
+	}
+	EncodeRange(first, first + region.size(), m_Image.data());
+
+	if (anyChanged) {
+		for (size_t i = 0; i < m_Instructions.size(); i++) {
+			const Instruction &instruction = m_Instructions[i];
+			for (uint8_t operand = 0; operand < 3; operand++) {
+				if (instruction.operands[operand] != OperandKind::Addr || !changed[instruction.values[operand]]) continue;
+				if (!m_Symbols.Get(instruction.values[operand]).defined) return false;
+
+				EncodeRange(i, i + 1, m_Image.data());
+				break;
+			}
+		}
+	}
+
+	return true;
+}
+
+AssembleResult Assembler::Snapshot() const {
+	AssembleResult result;
+	result.success = true;
+	result.image = SegmentedImage { .bytes = m_Image, .segments = m_Segments };
+	for (const Instruction &instruction : m_Instructions) {
+		if (instruction.kind != IRKind::Label) continue;
+
+		const Symbol &symbol = m_Symbols.Get(instruction.values[0]);
+		result.symbols.push_back(AssembledSymbol { .name = std::string(symbol.name), .value = symbol.value });
+	}
+	if (m_Options.sourceMap) result.map = MapSource(m_Source);
+	return result;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,465 @@
+#include "JIT.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <type_traits>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define REASM_JIT_X64 1
+#include <sys/mman.h>
+#endif
+
+namespace REASM {
+
+static constexpr int32_t NoBlock = -1;
+static constexpr int32_t Interpreted = -2;	// the instruction here can't start a block
+
+static constexpr size_t MaxBlockInstructions = 64;
+// Guest bytes a block can read: its instructions and one skipped after them.
+static constexpr size_t MaxBlockBytes = (MaxBlockInstructions + 1) * ISA::MaxInstructionSize;
+static constexpr size_t BufferSize = 8 << 20;
+// Host bytes a block can need, with room to spare.
+static constexpr size_t MaxBlockCode = 64 * MaxBlockInstructions + 256;
+
+static_assert(std::is_standard_layout_v<MachineState>);
+static_assert(offsetof(MachineState, flags) < 0x80, "State fields are addressed with 8-bit displacements");
+
+// Generated code keeps the MachineState in rbx and the instruction budget in
+// r12, both callee-saved. eax, ecx and edx are scratch within an instruction;
+// nothing is kept in host registers from one instruction to the next.
+enum HostRegister : uint8_t { EAX = 0, ECX = 1, EDX = 2 };
+
+static uint8_t RegisterOffset(uint16_t index) {
+	return static_cast<uint8_t>(offsetof(MachineState, registers) + index * sizeof(uint16_t));
+}
+
+static constexpr uint8_t PCOffset = offsetof(MachineState, pc);
+static constexpr uint8_t FlagsOffset = offsetof(MachineState, flags);
+
+// The interpreter's SHR, called from generated code rather than inlined for
+// its edge cases.
+static uint32_t ShiftRight(uint32_t x, uint32_t y) {
+	uint16_t value = static_cast<uint16_t>(x), count = static_cast<uint16_t>(y);
+	uint32_t out = count >= 1 && count <= 16 ? (value >> (count - 1)) & 1 : 0;
+	return (count < 16 ? value >> count : 0) | out << 16;
+}
+
+class Emitter {
+public:
+	Emitter(uint8_t *buffer, size_t position)
+		: m_Buffer(buffer), m_Position(position) {}
+
+	uint32_t Position() const { return static_cast<uint32_t>(m_Position); }
+
+	void Emit(std::initializer_list<uint8_t> bytes) {
+		for (uint8_t byte : bytes) m_Buffer[m_Position++] = byte;
+	}
+	void Emit16(uint16_t value) {
+		std::memcpy(m_Buffer + m_Position, &value, sizeof(value));
+		m_Position += sizeof(value);
+	}
+	void Emit32(uint32_t value) {
+		std::memcpy(m_Buffer + m_Position, &value, sizeof(value));
+		m_Position += sizeof(value);
+	}
+	void Emit64(uint64_t value) {
+		std::memcpy(m_Buffer + m_Position, &value, sizeof(value));
+		m_Position += sizeof(value);
+	}
+	// Emits a jump with a rel32 operand and returns where that operand is.
+	uint32_t Jump(std::initializer_list<uint8_t> opcode) {
+		Emit(opcode);
+		uint32_t at = Position();
+		Emit32(0);
+		return at;
+	}
+
+	// movzx reg, word [rbx + guest register], or mov reg, imm32
+	void Load(HostRegister reg, OperandKind kind, uint16_t value) {
+		if (kind == OperandKind::Reg) {
+			Emit({ 0x0F, 0xB7, static_cast<uint8_t>(0x43 | reg << 3), RegisterOffset(value) });
+		} else {
+			Emit({ static_cast<uint8_t>(0xB8 + reg) });
+			Emit32(value);
+		}
+	}
+	// mov word [rbx + guest register], ax and mov dword [rbx + flags], eax
+	void StoreResult(uint16_t dest) {
+		Emit({ 0x66, 0x89, 0x43, RegisterOffset(dest) });
+		Emit({ 0x89, 0x43, FlagsOffset });
+	}
+	// mov word [rbx + pc], target
+	void StorePC(uint16_t target) {
+		Emit({ 0x66, 0xC7, 0x43, PCOffset });
+		Emit16(target);
+	}
+private:
+	uint8_t *m_Buffer;
+	size_t m_Position;
+};
+
+// Points the rel32 at jump to destination, both offsets into buffer.
+static void PatchJump(uint8_t *buffer, uint32_t jump, uint32_t destination) {
+	int32_t relative = static_cast<int32_t>(destination - (jump + 4));
+	std::memcpy(buffer + jump, &relative, sizeof(relative));
+}
+
+JIT::JIT(Emulator &emulator)
+	: m_Emulator(emulator), m_BlockAt(MemorySize, NoBlock), m_Covered(MemorySize, 0) {
+#ifdef REASM_JIT_X64
+	void *buffer = mmap(nullptr, BufferSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffer == MAP_FAILED) return;
+	m_Buffer = static_cast<uint8_t *>(buffer);
+
+	// uint64_t enter(MachineState *state, const uint8_t *block, uint64_t budget)
+	// returns what is left of the budget. The three pushes leave the stack
+	// aligned for the calls blocks make.
+	Emitter emitter(m_Buffer, 0);
+	emitter.Emit({ 0x53, 0x41, 0x54, 0x55 });		// push rbx; push r12; push rbp
+	emitter.Emit({ 0x48, 0x89, 0xFB });				// mov rbx, rdi
+	emitter.Emit({ 0x49, 0x89, 0xD4 });				// mov r12, rdx
+	emitter.Emit({ 0xFF, 0xE6 });					// jmp rsi
+	m_Exit = emitter.Position();
+	emitter.Emit({ 0x4C, 0x89, 0xE0 });				// mov rax, r12
+	emitter.Emit({ 0x5D, 0x41, 0x5C, 0x5B, 0xC3 });	// pop rbp; pop r12; pop rbx; ret
+	m_Used = m_CodeStart = emitter.Position();
+#endif
+
+	m_Emulator.m_Translator = this;
+}
+
+JIT::~JIT() {
+	if (m_Emulator.m_Translator == this) m_Emulator.m_Translator = nullptr;
+#ifdef REASM_JIT_X64
+	if (m_Buffer) munmap(m_Buffer, BufferSize);
+#endif
+}
+
+void JIT::Flush() {
+	if (!m_Blocks.empty()) m_Stats.flushes++;
+	m_Used = m_CodeStart;
+	m_Blocks.clear();
+	m_Links.clear();
+	std::fill(m_BlockAt.begin(), m_BlockAt.end(), NoBlock);
+	std::fill(m_Covered.begin(), m_Covered.end(), 0);
+}
+
+RunResult JIT::Run(uint64_t limit) {
+	return Execute(limit, false);
+}
+
+RunResult JIT::Step(uint64_t limit) {
+	return Execute(limit, true);
+}
+
+RunResult JIT::Execute(uint64_t limit, bool once) {
+	if (!m_Buffer) return m_Emulator.Run(once ? std::min<uint64_t>(limit, 1) : limit);
+
+	using Enter = uint64_t (*)(MachineState *, const uint8_t *, uint64_t);
+	Enter enter = reinterpret_cast<Enter>(m_Buffer);
+	MachineState &state = m_Emulator.GetState();
+	uint64_t remaining = limit;
+	while (remaining > 0) {
+		const Block *block = Lookup(state.pc);
+		if (block && block->count <= remaining) {
+			// A budget of one block makes the next one bail straight back.
+			uint64_t budget = once ? block->count : remaining;
+			remaining -= budget - enter(&state, m_Buffer + block->code, budget);
+			if (once) break;
+			continue;
+		}
+
+		// A block that doesn't fit in what is left of the budget would bail
+		// forever, so the interpreter finishes the run.
+		RunResult result = m_Emulator.Run(block && !once ? remaining : 1);
+		m_Stats.interpreted += result.instructions;
+		remaining -= result.instructions;
+		if (result.reason != StopReason::Limit) return RunResult { .reason = result.reason, .instructions = limit - remaining };
+		if (once) break;
+	}
+	return RunResult { .reason = StopReason::Limit, .instructions = limit - remaining };
+}
+
+const JIT::Block *JIT::Lookup(uint16_t pc) {
+	int32_t index = m_BlockAt[pc];
+	if (index == NoBlock) index = Translate(pc);
+	return index >= 0 ? &m_Blocks[index] : nullptr;
+}
+
+// Exits start out returning to the dispatcher through their stub and are
+// pointed straight at their target's block whenever it exists.
+void JIT::Link(uint16_t target, uint32_t jump, uint32_t stub) {
+	m_Links[target].push_back(Exit { .jump = jump, .stub = stub });
+	int32_t index = m_BlockAt[target];
+	if (index >= 0) {
+		PatchJump(m_Buffer, jump, m_Blocks[index].code);
+		m_Stats.chained++;
+	} else {
+		PatchJump(m_Buffer, jump, stub);
+	}
+}
+
+int32_t JIT::Translate(uint16_t pc) {
+	if (BufferSize - m_Used < MaxBlockCode) Flush();
+
+	struct PendingExit {
+		uint16_t target;
+		uint32_t jump;
+	};
+	PendingExit exits[2];
+	size_t exitCount = 0;
+
+	Emitter emitter(m_Buffer, m_Used);
+	uint32_t code = emitter.Position();
+
+	// cmp r12, count; jb bail; sub r12, count. The count is patched in once
+	// the block is known.
+	emitter.Emit({ 0x49, 0x81, 0xFC });
+	uint32_t compareCount = emitter.Position();
+	emitter.Emit32(0);
+	uint32_t bail = emitter.Jump({ 0x0F, 0x82 });
+	emitter.Emit({ 0x49, 0x81, 0xEC });
+	uint32_t subtractCount = emitter.Position();
+	emitter.Emit32(0);
+
+	uint16_t address = pc;
+	uint32_t count = 0;
+	uint32_t end = pc;	// one past the last guest byte read
+	bool terminated = false;
+	while (!terminated && count < MaxBlockInstructions) {
+		const Emulator::Decoded &d = m_Emulator.Decode(address);
+		if (d.op >= ISA::InstructionCount) break;
+
+		const InstructionDesc &desc = ISA::Instructions[d.op];
+		uint32_t next = address + d.size;
+		OperandKind b = desc.operands[1], c = desc.operands[2];
+		auto binary = [&](std::initializer_list<uint8_t> operation) {
+			emitter.Load(EAX, b, d.b);
+			emitter.Load(ECX, c, d.c);
+			emitter.Emit(operation);
+			emitter.StoreResult(d.a);
+		};
+		auto exit = [&](std::initializer_list<uint8_t> opcode, uint16_t target) {
+			exits[exitCount++] = PendingExit { .target = target, .jump = emitter.Jump(opcode) };
+		};
+
+		bool handled = true;
+		switch (desc.opcode) {
+		case MOV_IM: {
+			emitter.Emit({ 0x66, 0xC7, 0x43, RegisterOffset(d.a) });
+			emitter.Emit16(d.b);
+		} break;
+		case MOV_R: {
+			emitter.Load(EAX, b, d.b);
+			emitter.Emit({ 0x66, 0x89, 0x43, RegisterOffset(d.a) });
+		} break;
+
+		case ADD_R: case ADD_RI: case ADD_IR: case ADD_I: binary({ 0x01, 0xC8 }); break;	// add eax, ecx
+		case SUB_R: case SUB_RI: case SUB_IR: case SUB_I: binary({ 0x29, 0xC8 }); break;	// sub eax, ecx
+		case AND_R: case AND_RI: case AND_IR: case AND_I: binary({ 0x21, 0xC8 }); break;	// and eax, ecx
+		case OR_R: case OR_RI: case OR_IR: case OR_I: binary({ 0x09, 0xC8 }); break;		// or eax, ecx
+		case XOR_R: case XOR_RI: case XOR_IR: case XOR_I: binary({ 0x31, 0xC8 }); break;	// xor eax, ecx
+		// edx = carry, then eax = x + y + edx or x - y - edx
+		case ADC_R: case ADC_RI: case ADC_IR: case ADC_I: {
+			binary({ 0x8B, 0x53, FlagsOffset, 0xC1, 0xEA, 0x10, 0x83, 0xE2, 0x01, 0x01, 0xC8, 0x01, 0xD0 });
+		} break;
+		case SBC_R: case SBC_RI: case SBC_IR: case SBC_I: {
+			binary({ 0x8B, 0x53, FlagsOffset, 0xC1, 0xEA, 0x10, 0x83, 0xE2, 0x01, 0x29, 0xC8, 0x29, 0xD0 });
+		} break;
+		// xor edx, edx; shl eax, cl; cmp ecx, 32; cmovae eax, edx
+		case SHL_R: case SHL_RI: case SHL_IR: case SHL_I: {
+			binary({ 0x31, 0xD2, 0xD3, 0xE0, 0x83, 0xF9, 0x20, 0x0F, 0x43, 0xC2 });
+		} break;
+		// mov edi, eax; mov esi, ecx; mov rax, ShiftRight; call rax
+		case SHR_R: case SHR_RI: case SHR_IR: case SHR_I: {
+			emitter.Load(EAX, b, d.b);
+			emitter.Load(ECX, c, d.c);
+			emitter.Emit({ 0x89, 0xC7, 0x89, 0xCE, 0x48, 0xB8 });
+			emitter.Emit64(reinterpret_cast<uint64_t>(&ShiftRight));
+			emitter.Emit({ 0xFF, 0xD0 });
+			emitter.StoreResult(d.a);
+		} break;
+		// The product goes to the register; the flags get its low half and a
+		// carry when it overflowed.
+		case MUL_R: case MUL_RI: case MUL_IR: case MUL_I: {
+			emitter.Load(EAX, b, d.b);
+			emitter.Load(ECX, c, d.c);
+			emitter.Emit({ 0x0F, 0xAF, 0xC1 });						// imul eax, ecx
+			emitter.Emit({ 0x66, 0x89, 0x43, RegisterOffset(d.a) });
+			emitter.Emit({ 0x89, 0xC2, 0x81, 0xE2 });				// mov edx, eax; and edx, 0xFFFF
+			emitter.Emit32(0xFFFF);
+			emitter.Emit({ 0x31, 0xC9, 0x3D });						// xor ecx, ecx; cmp eax, 0xFFFF
+			emitter.Emit32(0xFFFF);
+			emitter.Emit({ 0x0F, 0x97, 0xC1, 0xC1, 0xE1, 0x10 });	// seta cl; shl ecx, 16
+			emitter.Emit({ 0x09, 0xCA, 0x89, 0x53, FlagsOffset });	// or edx, ecx; mov [flags], edx
+		} break;
+
+		case DEC_R:
+		case INC_R: {
+			emitter.Load(EAX, OperandKind::Reg, d.a);
+			emitter.Emit({ 0x83, static_cast<uint8_t>(desc.opcode == INC_R ? 0xC0 : 0xE8), 0x01 });
+			emitter.StoreResult(d.a);
+		} break;
+		case NOT_R: {
+			emitter.Load(EAX, b, d.b);
+			emitter.Emit({ 0xF7, 0xD0, 0x0F, 0xB7, 0xC0 });	// not eax; movzx eax, ax
+			emitter.StoreResult(d.a);
+		} break;
+
+		case CMP_R:
+		case CMP_RI: {
+			emitter.Load(EAX, OperandKind::Reg, d.a);
+			emitter.Load(ECX, b, d.b);
+			emitter.Emit({ 0x29, 0xC8, 0x89, 0x43, FlagsOffset });
+		} break;
+
+		// The test goes on to the next instruction when true and past it
+		// when false, so the skipped instruction's bytes belong to the block.
+		case IGT_R: case IGT_RI: case ILT_R: case ILT_RI:
+		case IGE_R: case IGE_RI: case ILE_R: case ILE_RI: {
+			uint32_t past = next < MemorySize ? next + m_Emulator.Decode(static_cast<uint16_t>(next)).size : MemorySize + 1;
+			if (past > MemorySize) {
+				handled = false;
+				break;
+			}
+
+			uint8_t condition;
+			switch (desc.opcode) {
+			case IGT_R: case IGT_RI: condition = 0x87; break;	// ja
+			case ILT_R: case ILT_RI: condition = 0x82; break;	// jb
+			case IGE_R: case IGE_RI: condition = 0x83; break;	// jae
+			default: condition = 0x86; break;					// jbe
+			}
+			emitter.Load(EAX, OperandKind::Reg, d.a);
+			emitter.Load(ECX, b, d.b);
+			emitter.Emit({ 0x39, 0xC8 });	// cmp eax, ecx
+			exit({ 0x0F, condition }, static_cast<uint16_t>(next));
+			exit({ 0xE9 }, static_cast<uint16_t>(past));
+			next = past;
+			terminated = true;
+		} break;
+
+		case JMP: {
+			exit({ 0xE9 }, d.a);
+			terminated = true;
+		} break;
+		// test dword [flags], mask; jnz or jz to the target, else fall through
+		case JNZ: case JZ: case JNS: case JS: case JNC: case JC: {
+			uint32_t mask = desc.opcode == JNZ || desc.opcode == JZ ? 0xFFFF : desc.opcode == JNS || desc.opcode == JS ? 0x8000 : 0x10000;
+			bool whenSet = desc.opcode == JNZ || desc.opcode == JS || desc.opcode == JC;
+			emitter.Emit({ 0xF7, 0x43, FlagsOffset });
+			emitter.Emit32(mask);
+			exit({ 0x0F, static_cast<uint8_t>(whenSet ? 0x85 : 0x84) }, d.a);
+			exit({ 0xE9 }, static_cast<uint16_t>(next));
+			terminated = true;
+		} break;
+
+		// PUSH, POP, DIV and HLT
+		default: handled = false; break;
+		}
+
+		if (!handled) break;
+		count++;
+		end = next;
+		address = static_cast<uint16_t>(next);
+		if (next >= MemorySize) break;
+	}
+
+	// An instruction left untranslated ends the block before it, and one
+	// that can't start a block is interpreted whenever it comes up.
+	if (count == 0) {
+		m_BlockAt[pc] = Interpreted;
+		return Interpreted;
+	}
+	if (!terminated) exits[exitCount++] = PendingExit { .target = address, .jump = emitter.Jump({ 0xE9 }) };
+
+	uint32_t stubs[2];
+	for (size_t i = 0; i < exitCount; i++) {
+		stubs[i] = emitter.Position();
+		emitter.StorePC(exits[i].target);
+		PatchJump(m_Buffer, emitter.Jump({ 0xE9 }), m_Exit);
+	}
+	PatchJump(m_Buffer, bail, emitter.Position());
+	emitter.StorePC(pc);
+	PatchJump(m_Buffer, emitter.Jump({ 0xE9 }), m_Exit);
+	std::memcpy(m_Buffer + compareCount, &count, sizeof(count));
+	std::memcpy(m_Buffer + subtractCount, &count, sizeof(count));
+	m_Used = emitter.Position();
+
+	int32_t index = static_cast<int32_t>(m_Blocks.size());
+	m_Blocks.push_back(Block { .start = pc, .size = static_cast<uint16_t>(end - pc), .count = count, .code = code });
+	m_BlockAt[pc] = index;
+	for (uint32_t i = pc; i < end; i++) m_Covered[i]++;
+	m_Stats.blocks++;
+
+	// Exits already waiting for this address now come straight here.
+	for (const Exit &exit : m_Links[pc]) {
+		PatchJump(m_Buffer, exit.jump, code);
+		m_Stats.chained++;
+	}
+	for (size_t i = 0; i < exitCount; i++) Link(exits[i].target, exits[i].jump, stubs[i]);
+	return index;
+}
+
+void JIT::Invalidate(uint16_t address) {
+	for (size_t back = 0; back < ISA::MaxInstructionSize; back++) {
+		uint16_t start = static_cast<uint16_t>(address - back);
+		if (m_BlockAt[start] == Interpreted) m_BlockAt[start] = NoBlock;
+	}
+	if (m_Covered[address] == 0) return;
+
+	for (size_t back = 0; back < MaxBlockBytes; back++) {
+		uint16_t start = static_cast<uint16_t>(address - back);
+		int32_t index = m_BlockAt[start];
+		if (index < 0 || static_cast<uint16_t>(address - start) >= m_Blocks[index].size) continue;
+
+		const Block &block = m_Blocks[index];
+		m_BlockAt[start] = NoBlock;
+		for (size_t i = 0; i < block.size; i++) m_Covered[start + i]--;
+		for (const Exit &exit : m_Links[start]) PatchJump(m_Buffer, exit.jump, exit.stub);
+		m_Stats.invalidated++;
+	}
+}
+
+bool RunDifferential(std::span<const uint8_t> image, uint16_t origin, uint64_t limit, RunResult &result, Divergence &divergence) {
+	Emulator translated, reference;
+	if (!translated.Load(image, origin) || !reference.Load(image, origin)) {
+		result = RunResult { .reason = StopReason::InvalidInstruction, .instructions = 0 };
+		return true;
+	}
+
+	JIT jit(translated);
+	uint64_t remaining = limit;
+	result = RunResult { .reason = StopReason::Limit, .instructions = 0 };
+	while (remaining > 0) {
+		uint16_t pc = translated.GetState().pc;
+		RunResult actual = jit.Step(remaining);
+		// A fault isn't counted, so the interpreter needs one more to reach it.
+		bool fault = actual.reason != StopReason::Limit && actual.reason != StopReason::Halted;
+		RunResult expected = reference.Run(actual.instructions + (fault ? 1 : 0));
+
+		if (actual.reason != expected.reason || actual.instructions != expected.instructions || translated.GetState() != reference.GetState()) {
+			divergence = Divergence { .instructions = result.instructions, .pc = pc, .expected = expected, .actual = actual,
+				.expectedState = reference.GetState(), .actualState = translated.GetState() };
+			return false;
+		}
+
+		result.instructions += actual.instructions;
+		remaining -= actual.instructions;
+		if (actual.reason != StopReason::Limit) {
+			result.reason = actual.reason;
+			break;
+		}
+	}
+
+	if (std::memcmp(translated.GetMemory(), reference.GetMemory(), MemorySize) != 0) {
+		divergence = Divergence { .instructions = result.instructions, .pc = translated.GetState().pc, .expected = result, .actual = result,
+			.expectedState = reference.GetState(), .actualState = translated.GetState(), .memory = true };
+		return false;
+	}
+	return true;
+}
+
+}
\ No newline at end of file
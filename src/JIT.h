@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "Emulator.h"
+
+namespace REASM {
+
+struct JITStats {
+	size_t blocks;			// translated, including ones later dropped
+	size_t chained;			// exits patched to jump straight to their target
+	size_t invalidated;		// blocks dropped because code under them was written
+	size_t flushes;			// times the code buffer filled and was emptied
+	uint64_t interpreted;	// instructions the interpreter ran instead
+};
+
+// Translates basic blocks of an Emulator's memory to x86-64 and runs them in
+// place of the interpreter. Blocks are cached by guest address and their
+// exits are patched to jump straight into the next block once it exists.
+// The ALU, compare, skip and jump families are translated; PUSH, POP, DIV
+// and HLT end a block and go to the interpreter one instruction at a time,
+// which also makes it the only writer of memory, so its stores are where
+// blocks over the written bytes get dropped.
+//
+// Guest registers and flags stay in the Emulator's MachineState, so the two
+// can be mixed freely and every result matches the interpreter's bit for
+// bit. Where translation isn't available (not x86-64, no executable memory)
+// everything is interpreted.
+class JIT {
+public:
+	explicit JIT(Emulator &emulator);
+	~JIT();
+
+	JIT(const JIT &) = delete;
+	JIT &operator=(const JIT &) = delete;
+
+	bool IsAvailable() const { return m_Buffer != nullptr; }
+
+	RunResult Run(uint64_t limit = UINT64_MAX);
+	// Runs a single block, or a single interpreted instruction, if it fits
+	// in limit; chained exits are not followed.
+	RunResult Step(uint64_t limit = UINT64_MAX);
+
+	// Drops every block; Emulator::Load calls it.
+	void Flush();
+	const JITStats &GetStats() const { return m_Stats; }
+private:
+	friend class Emulator;
+
+	struct Block {
+		uint16_t start;
+		uint16_t size;		// guest bytes read, including a skipped instruction
+		uint32_t count;		// instructions executed on every pass
+		uint32_t code;		// offset into the buffer
+	};
+
+	struct Exit {
+		uint32_t jump;		// offset of the rel32 to patch
+		uint32_t stub;		// offset of the code that returns to the dispatcher
+	};
+
+	RunResult Execute(uint64_t limit, bool once);
+	const Block *Lookup(uint16_t pc);
+	int32_t Translate(uint16_t pc);
+	void Link(uint16_t target, uint32_t jump, uint32_t stub);
+	void Invalidate(uint16_t address);
+private:
+	Emulator &m_Emulator;
+	uint8_t *m_Buffer = nullptr;
+	size_t m_Used = 0;
+	uint32_t m_Exit = 0;		// the trampoline's way back to C++
+	size_t m_CodeStart = 0;		// blocks go after the trampoline
+
+	std::vector<Block> m_Blocks;
+	std::vector<int32_t> m_BlockAt;			// per address: index into m_Blocks, NoBlock or Interpreted
+	std::vector<uint16_t> m_Covered;		// per address: live blocks reading it
+	std::unordered_map<uint16_t, std::vector<Exit>> m_Links;	// exits by target address
+	JITStats m_Stats {};
+};
+
+struct Divergence {
+	uint64_t instructions;	// executed by both before the step that disagreed
+	uint16_t pc;			// where that step started
+	RunResult expected;		// the interpreter's
+	RunResult actual;		// the translated code's
+	MachineState expectedState;
+	MachineState actualState;
+	bool memory = false;	// only memory differed, found at the end
+};
+
+// Runs image on the translator one block at a time and on a second Emulator
+// under the interpreter, comparing both machines after every block and their
+// memory at the end. Returns false and fills divergence at the first
+// difference; result is the translated run either way.
+bool RunDifferential(std::span<const uint8_t> image, uint16_t origin, uint64_t limit, RunResult &result, Divergence &divergence);
+
+}
\ No newline at end of file
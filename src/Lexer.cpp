@@ -1,173 +1,323 @@
 #include "Lexer.h"
-#include "Log/Log.h"
+#include "ISA.h"
 
-#include <fstream>
 #include <algorithm>
+#include <charconv>
+#include <cstring>
+
+#include "ThreadPool.h"
 
 namespace REASM {
 
-static std::string Trim(std::string &str) {
-	str.erase(str.begin(), std::find_if_not(str.begin(), str.end(), [](unsigned char c) {
-        return std::isspace(c);
-    }));
+static bool IsSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static bool IsDigit(char c) {
+	return c >= '0' && c <= '9';
+}
 
-    str.erase(std::find_if_not(str.rbegin(), str.rend(), [](unsigned char c) {
-        return std::isspace(c);
-    }).base(), str.end());
+static bool IsAlpha(char c) {
+	return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
 
-    return str;
+static bool IsAlnum(char c) {
+	return IsAlpha(c) || IsDigit(c);
 }
 
-std::string ToUppercase(std::string &str) {
-	std::transform(str.begin(), str.end(), str.begin(), ::toupper);
+static std::string_view Trim(std::string_view str) {
+	while (!str.empty() && IsSpace(str.front())) str.remove_prefix(1);
+	while (!str.empty() && IsSpace(str.back())) str.remove_suffix(1);
 
 	return str;
 }
 
-static Token TokenizeWord(int &pos, std::string line, std::vector<Token> tokens) {
-	int start = pos;
-	while (pos < line.size() && std::isalnum(line[pos])
-			|| line[pos] == '_' || line[pos] == '.') { pos++; }
-	std::string value = line.substr(start, pos - start);
-	
-	if (value == "MOV"
-		|| value == "ADD"
-		|| value == "SUB"
-		|| value == "MUL"
-		|| value == "DIV"
-		|| value == "ADC"
-		|| value == "SBC"
-		|| value == "DEC"
-		|| value == "INC"
-		|| value == "AND"
-		|| value == "OR"
-		|| value == "XOR"
-		|| value == "NOT"
-		|| value == "SHL"
-		|| value == "SHR"
-		|| value == "IGT"
-		|| value == "ILT"
-		|| value == "IGE"
-		|| value == "ILE"
-		|| value == "CMP"
-		|| value == "JMP"
-		|| value == "JNZ"
-		|| value == "JZ"
-		|| value == "JNC"
-		|| value == "JC"
-		|| value == "JNS"
-		|| value == "JS"
-		|| value == "HLT")
-		return Token { .type = OPCODE, .value = value };
-
-	if (value == "R0"
-		|| value == "R1"
-		|| value == "R2"
-		|| value == "R3"
-		|| value == "R4"
-		|| value == "R5"
-		|| value == "R6"
-		|| value == "R7"
-		|| value == "R8"
-		|| value == "R9"
-		|| value == "R10"
-		|| value == "R11")
-		return Token { .type = REG, .value = value };
-
-	if (value == "ORG")
-		return Token { .type = ORG, .value = value };
-
-	for (Token tok : tokens) {
-		if (tok.type == LABEL && tok.value == value) {
-			return { .type = LABEL, .value = value };
+// The full value, which the parser range checks like any other; false for
+// digits that don't parse or don't fit 32 bits.
+static bool ParseNumber(std::string_view number, int base, uint32_t &value) {
+	if (base == 16 && number.size() >= 2 && number[0] == '0' && (number[1] == 'x' || number[1] == 'X'))
+		number.remove_prefix(2);
+
+	const char *end = number.data() + number.size();
+	auto [last, error] = std::from_chars(number.data(), end, value, base);
+	return !number.empty() && error == std::errc() && last == end;
+}
+
+// A line being tokenized; positions are relative to line, tokens record
+// absolute source offsets.
+struct LineContext {
+	std::string_view line;
+	uint32_t base;
+	TokenStream &tokens;
+
+	void Push(TokenType type, size_t start, size_t end, uint32_t payload = 0) {
+		tokens.Push(type, base + static_cast<uint32_t>(start), static_cast<uint32_t>(end - start), payload);
+	}
+};
+
+static void TokenizeWord(size_t &pos, LineContext &context) {
+	std::string_view line = context.line;
+	size_t start = pos;
+	while (pos < line.size() && (IsAlnum(line[pos]) || line[pos] == '_' || line[pos] == '.')) { pos++; }
+	std::string_view value = line.substr(start, pos - start);
+
+	uint8_t mnemonic = ISA::FindMnemonic(value);
+	if (mnemonic != ISA::NoMnemonic) {
+		context.Push(OPCODE, start, pos, mnemonic);
+		return;
+	}
+
+	if (value.size() > 2 && value[value.size() - 2] == '.') {
+		char suffix = ToUpperASCII(value.back());
+		mnemonic = ISA::FindMnemonic(value.substr(0, value.size() - 2));
+		if (mnemonic != ISA::NoMnemonic && (suffix == 'B' || suffix == 'W')) {
+			ImmediateWidth width = suffix == 'B' ? ImmediateWidth::Byte : ImmediateWidth::Word;
+			context.Push(OPCODE, start, pos, mnemonic | static_cast<uint32_t>(width) << WidthShift);
+			return;
+		}
+	}
+
+	static constexpr std::string_view registers[] = {
+		"R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "R8", "R9", "R10", "R11",
+	};
+	for (uint32_t reg = 0; reg < std::size(registers); reg++) {
+		if (EqualsIgnoreCase(value, registers[reg])) {
+			context.Push(REG, start, pos, reg);
+			return;
 		}
 	}
 
-	return { .type = UNKNOWN, .value = value };
+	static constexpr std::pair<std::string_view, TokenType> directives[] = {
+		{ "ORG", ORG }, { "EQU", EQU }, { "DB", DB }, { "DW", DW }, { "DS", DS }, { "INCBIN", INCBIN },
+	};
+	for (const auto &[name, type] : directives) {
+		if (EqualsIgnoreCase(value, name)) {
+			context.Push(type, start, pos);
+			return;
+		}
+	}
+
+	context.Push(UNKNOWN, start, pos, InvalidSymbol);
 }
 
-static Token TokenizeImmediate(int &pos, std::string line) {
+// '#' marks an immediate operand. Only a decimal literal keeps it in its
+// token; before anything else, hex included, it is dropped and the
+// expression that follows lexes as usual.
+static void TokenizeImmediate(size_t &pos, LineContext &context) {
+	std::string_view line = context.line;
+	size_t start = pos;
 	pos++;
-	int start = pos;
-	while (pos < line.size() && std::isdigit(line[pos])) { pos++; }
-	std::string value = line.substr(start, pos - start);
-
-	return { .type = IMMEDIATE, .value = value };
-}
-
-static Token TokenizeHex(int &pos, std::string line) {
-	int start = pos;
-	while (pos < line.size() && std::isalnum(line[pos])) { pos++; }
-	std::string value = line.substr(start, pos - start);
-
-	return { .type = HEX, .value = value };
-}
-
-static void TokenizeLine(std::string line, std::vector<Token> &tokens) {
-    line = Trim(line);
-	line = ToUppercase(line);
-
-    if (!line.empty()) {
-        if (line.find(':') == line.size() - 1) {
-            line.pop_back();
-            tokens.push_back(Token { .type = LABEL, .value = line });
-        } else {
-			int pos = 0;
-            while (pos < line.size()) {
-                char current = line[pos];
-
-                if (std::isspace(current)) {
-                    pos++;
-                    continue;
-                }
-
-                if (current == '#') {
-                    tokens.push_back(TokenizeImmediate(pos, line));
-                    continue;
-                }
-
-                if (current == '0' && pos + 1 < line.size() && line[pos + 1] == 'X') {
-                    tokens.push_back(TokenizeHex(pos, line));
-                    continue;
-                }
-
-                if (std::isalpha(current) || current == '_' || current == '.') {
-                    tokens.push_back(TokenizeWord(pos, line, tokens));
-                    continue;
-				}
-
-                switch (current) {
-                case ',': tokens.push_back(Token { .type = COMMA, .value = std::string(1, current) }); break;
-                case '(': tokens.push_back(Token { .type = LPAREN, .value = std::string(1, current) }); break;
-                case ')': tokens.push_back(Token { .type = RPAREN, .value = std::string(1, current) }); break;
-                case '[': tokens.push_back(Token { .type = LBRACE, .value = std::string(1, current) }); break;
-                case ']': tokens.push_back(Token { .type = RBRACE, .value = std::string(1, current) }); break;
-                case '{': tokens.push_back(Token { .type = LCURLYBRACE, .value = std::string(1, current) }); break;
-                case '}': tokens.push_back(Token { .type = RCURLYBRACE, .value = std::string(1, current) }); break;
-                default: break;
-                }
-
-                pos++;
-            }
-        }
-    }
-}
-
-std::vector<Token> Lexer::LexFile(std::string path)
-{
-	std::ifstream file(path);
-	std::string line;
+	if (pos == line.size() || !IsDigit(line[pos])) return;
+	if (line[pos] == '0' && pos + 1 < line.size() && (line[pos + 1] == 'X' || line[pos + 1] == 'x')) return;
+	while (pos < line.size() && IsDigit(line[pos])) { pos++; }
+
+	uint32_t value;
+	if (ParseNumber(line.substr(start + 1, pos - start - 1), 10, value)) context.Push(IMMEDIATE, start, pos, value);
+	else context.Push(INVALID, start, pos);
+}
+
+static void TokenizeNumber(size_t &pos, LineContext &context) {
+	std::string_view line = context.line;
+	size_t start = pos;
+	while (pos < line.size() && IsDigit(line[pos])) { pos++; }
+
+	uint32_t value;
+	if (ParseNumber(line.substr(start, pos - start), 10, value)) context.Push(NUMBER, start, pos, value);
+	else context.Push(INVALID, start, pos);
+}
+
+static void TokenizeHex(size_t &pos, LineContext &context) {
+	std::string_view line = context.line;
+	size_t start = pos;
+	while (pos < line.size() && IsAlnum(line[pos])) { pos++; }
+
+	uint32_t value;
+	if (ParseNumber(line.substr(start, pos - start), 16, value)) context.Push(HEX, start, pos, value);
+	else context.Push(INVALID, start, pos);
+}
+
+// The token spans the quotes; one left open runs to the end of the line, for
+// the parser to reject.
+static void TokenizeString(size_t &pos, LineContext &context) {
+	std::string_view line = context.line;
+	size_t start = pos;
+	size_t close = line.find('"', start + 1);
+	pos = close == std::string_view::npos ? line.size() : close + 1;
+
+	context.Push(STRING, start, pos);
+}
+
+static void TokenizeLine(std::string_view rawLine, uint32_t rawBase, TokenStream &tokens) {
+	std::string_view line = Trim(rawLine);
+	if (line.empty()) return;
+
+	LineContext context { .line = line, .base = rawBase + static_cast<uint32_t>(line.data() - rawLine.data()), .tokens = tokens };
+
+	if (line.find(':') == line.size() - 1) {
+		std::string_view name = Trim(line.substr(0, line.size() - 1));
+		context.Push(LABEL, 0, name.size(), InvalidSymbol);
+		return;
+	}
+
+	size_t pos = 0;
+	while (pos < line.size()) {
+		char current = line[pos];
+
+		if (IsSpace(current)) {
+			pos++;
+			continue;
+		}
+
+		if (current == '#') {
+			TokenizeImmediate(pos, context);
+			continue;
+		}
 
-	std::vector<Token> tokens;
-	while (std::getline(file, line)) {
-		TokenizeLine(line, tokens);
+		if (current == '0' && pos + 1 < line.size() && (line[pos + 1] == 'X' || line[pos + 1] == 'x')) {
+			TokenizeHex(pos, context);
+			continue;
+		}
+
+		if (IsDigit(current)) {
+			TokenizeNumber(pos, context);
+			continue;
+		}
+
+		if (current == '"') {
+			TokenizeString(pos, context);
+			continue;
+		}
+
+		if (IsAlpha(current) || current == '_' || current == '.') {
+			TokenizeWord(pos, context);
+			continue;
+		}
+
+		if ((current == '<' || current == '>') && pos + 1 < line.size() && line[pos + 1] == current) {
+			context.Push(current == '<' ? SHIFTLEFT : SHIFTRIGHT, pos, pos + 2);
+			pos += 2;
+			continue;
+		}
+
+		TokenType type = UNKNOWN;
+		switch (current) {
+		case ',': type = COMMA; break;
+		case '(': type = LPAREN; break;
+		case ')': type = RPAREN; break;
+		case '[': type = LBRACE; break;
+		case ']': type = RBRACE; break;
+		case '{': type = LCURLYBRACE; break;
+		case '}': type = RCURLYBRACE; break;
+		case '+': type = PLUS; break;
+		case '-': type = MINUS; break;
+		case '*': type = STAR; break;
+		case '/': type = SLASH; break;
+		case '%': type = PERCENT; break;
+		case '&': type = AMPERSAND; break;
+		case '|': type = PIPE; break;
+		case '^': type = CARET; break;
+		case '~': type = TILDE; break;
+		default: break;
+		}
+		context.Push(type != UNKNOWN ? type : INVALID, pos, pos + 1);
+		pos++;
 	}
+}
+
+static void LexChunk(std::string_view source, size_t begin, size_t end, TokenStream &tokens) {
+	size_t pos = begin;
+	while (pos < end) {
+		const char *line = source.data() + pos;
+		const char *newline = static_cast<const char *>(std::memchr(line, '\n', end - pos));
+		size_t length = newline ? static_cast<size_t>(newline - line) : end - pos;
+
+		TokenizeLine(std::string_view(line, length), static_cast<uint32_t>(pos), tokens);
+
+		pos += length + 1;
+	}
+}
+
+static std::vector<size_t> SplitChunks(std::string_view source, size_t jobs) {
+	static constexpr size_t MinChunkSize = 1024 * 1024;
 
-	for (Token tok : tokens) {
-		INFO("{0} -> {1}", TokenTypeToString(tok.type), tok.value);
+	std::vector<size_t> boundaries { 0 };
+	size_t target = std::max(MinChunkSize, source.size() / (jobs * 4));
+	if (jobs <= 1 || source.size() <= target) {
+		boundaries.push_back(source.size());
+		return boundaries;
 	}
 
+	size_t pos = 0;
+	while (pos < source.size()) {
+		size_t end = std::min(pos + target, source.size());
+		if (end < source.size()) {
+			const char *newline = static_cast<const char *>(std::memchr(source.data() + end, '\n', source.size() - end));
+			end = newline ? static_cast<size_t>(newline - source.data()) + 1 : source.size();
+		}
+
+		boundaries.push_back(end);
+		pos = end;
+	}
+
+	return boundaries;
+}
+
+TokenStream Lexer::Lex(std::string_view source, SymbolTable &symbols, Arena &arena, size_t jobs)
+{
+	jobs = ThreadPool::ResolveThreadCount(jobs);
+	std::vector<size_t> boundaries = SplitChunks(source, jobs);
+	size_t chunkCount = boundaries.size() - 1;
+
+	TokenStream tokens(source, arena);
+	if (chunkCount == 1) {
+		LexChunk(source, 0, source.size(), tokens);
+	} else {
+		// Arenas are single-threaded, so each chunk fills its own and the
+		// pages are handed over afterwards.
+		std::vector<std::unique_ptr<Arena>> chunkArenas;
+		std::vector<TokenStream> chunkTokens;
+		chunkArenas.reserve(chunkCount);
+		chunkTokens.reserve(chunkCount);
+		for (size_t i = 0; i < chunkCount; i++) {
+			chunkArenas.push_back(std::make_unique<Arena>());
+			chunkTokens.emplace_back(source, *chunkArenas.back());
+		}
+
+		{
+			ThreadPool pool(std::min(jobs, chunkCount));
+			for (size_t i = 0; i < chunkCount; i++) {
+				pool.Submit([&, i]() { LexChunk(source, boundaries[i], boundaries[i + 1], chunkTokens[i]); });
+			}
+			pool.Wait();
+		}
+
+		for (size_t i = 0; i < chunkCount; i++) {
+			arena.Adopt(*chunkArenas[i]);
+			tokens.Append(chunkTokens[i]);
+		}
+	}
+
+	ResolveSymbols(tokens, symbols);
+
 	return tokens;
 }
 
+// Label definitions are interned first so that references anywhere in the
+// file, forward or backward, classify as LABEL.
+void Lexer::ResolveSymbols(TokenStream &tokens, SymbolTable &symbols) {
+	for (TokenStream::Cursor cursor = tokens.Begin(); !cursor.AtEnd(); cursor.Advance()) {
+		if (cursor.Type() == LABEL) cursor.SetPayload(symbols.Intern(tokens.Text(cursor)));
+	}
+
+	for (TokenStream::Cursor cursor = tokens.Begin(); !cursor.AtEnd(); cursor.Advance()) {
+		if (cursor.Type() != UNKNOWN) continue;
+
+		SymbolID symbol = symbols.Find(tokens.Text(cursor));
+		if (symbol != InvalidSymbol) {
+			cursor.SetType(LABEL);
+			cursor.SetPayload(symbol);
+		}
+	}
+}
+
 }
\ No newline at end of file
@@ -1,14 +1,21 @@
 #pragma once
 
-#include <vector>
+#include <string_view>
 
-#include "Token.h"
+#include "Arena.h"
+#include "SymbolTable.h"
+#include "TokenStream.h"
 
 namespace REASM {
-	
+
 class Lexer {
 public:
-	static std::vector<Token> LexFile(std::string path);
+	// Tokens reference source directly; keep it alive while they are in use.
+	// Sources larger than a chunk are split at line boundaries and lexed on
+	// up to jobs threads.
+	static TokenStream Lex(std::string_view source, SymbolTable &symbols, Arena &arena, size_t jobs = 1);
+private:
+	static void ResolveSymbols(TokenStream &tokens, SymbolTable &symbols);
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "Linker.h"
+
+#include <cstring>
+
+#include "SymbolTable.h"
+
+namespace REASM {
+
+[[noreturn]] static void Fail(std::string message) {
+	throw DiagnosticError(Diagnostic { .line = 0, .column = 0, .message = std::move(message) });
+}
+
+LinkResult Link(const std::vector<LinkInput> &inputs) {
+	LinkResult result;
+	SymbolTable symbols;
+
+	try {
+		size_t size = 0;
+		for (const LinkInput &input : inputs) {
+			for (const ObjectSection &section : input.object.sections) size += section.bytes.size();
+		}
+		std::vector<uint8_t> &bytes = result.image.bytes;
+		std::vector<ImageSegment> &segments = result.image.segments;
+		bytes.resize(size);
+
+		// Section placement
+		std::vector<std::vector<uint32_t>> imageOffsets(inputs.size());
+		std::vector<std::vector<uint16_t>> addresses(inputs.size());
+		std::vector<size_t> segmentInputs;
+		uint16_t address = 0x0000;
+		size_t offset = 0;
+		bool startSegment = true;
+		for (size_t i = 0; i < inputs.size(); i++) {
+			for (const ObjectSection &section : inputs[i].object.sections) {
+				if (section.absolute) {
+					address = section.origin;
+					startSegment = true;
+				}
+
+				imageOffsets[i].push_back(static_cast<uint32_t>(offset));
+				addresses[i].push_back(address);
+				if (section.bytes.empty()) continue;
+
+				if (startSegment) {
+					segments.push_back(ImageSegment { .origin = address, .offset = static_cast<uint32_t>(offset), .size = 0 });
+					segmentInputs.push_back(i);
+					startSegment = false;
+				}
+				if (address + section.bytes.size() > 0x10000) Fail("Section exceeds address space in " + inputs[i].name);
+				std::memcpy(bytes.data() + offset, section.bytes.data(), section.bytes.size());
+				segments.back().size += static_cast<uint32_t>(section.bytes.size());
+				offset += section.bytes.size();
+				address = static_cast<uint16_t>(address + section.bytes.size());
+			}
+		}
+		size_t overlap = FindOverlap(segments);
+		if (overlap != segments.size()) Fail("Sections overlap in " + inputs[segmentInputs[overlap]].name);
+
+		// Symbol definitions
+		std::vector<std::vector<SymbolID>> ids(inputs.size());
+		std::vector<size_t> definedBy;
+		for (size_t i = 0; i < inputs.size(); i++) {
+			for (const ObjectSymbol &object : inputs[i].object.symbols) {
+				SymbolID id = symbols.Intern(object.name);
+				ids[i].push_back(id);
+				if (object.section == NoSection) continue;
+
+				Symbol &symbol = symbols.Get(id);
+				if (symbol.defined) {
+					Fail("Duplicate symbol: " + object.name + " in " + inputs[definedBy[id]].name + " and " + inputs[i].name);
+				}
+				symbol.value = static_cast<uint16_t>(addresses[i][object.section] + object.offset);
+				symbol.defined = true;
+
+				if (definedBy.size() <= id) definedBy.resize(id + 1);
+				definedBy[id] = i;
+			}
+		}
+
+		// Relocations
+		for (size_t i = 0; i < inputs.size(); i++) {
+			for (const Relocation &relocation : inputs[i].object.relocations) {
+				const Symbol &symbol = symbols.Get(ids[i][relocation.symbol]);
+				if (!symbol.defined) {
+					Fail("Undefined symbol: " + std::string(symbol.name) + " referenced from " + inputs[i].name);
+				}
+
+				uint16_t value = static_cast<uint16_t>(symbol.value + relocation.addend);
+				uint8_t *field = bytes.data() + imageOffsets[i][relocation.section] + relocation.offset;
+				field[0] = value & 0xFF;
+				field[1] = (value >> 8) & 0xFF;
+			}
+		}
+	} catch (const DiagnosticError &error) {
+		result.image = SegmentedImage {};
+		result.diagnostics.push_back(error.GetDiagnostic());
+		return result;
+	}
+
+	for (SymbolID id = 0; id < symbols.Size(); id++) {
+		const Symbol &symbol = symbols.Get(id);
+		if (symbol.defined) result.symbols.push_back(AssembledSymbol { .name = std::string(symbol.name), .value = symbol.value });
+	}
+	result.success = true;
+	return result;
+}
+
+}
\ No newline at end of file
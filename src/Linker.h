@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Assemble.h"
+#include "Diagnostic.h"
+#include "Image.h"
+#include "Object.h"
+
+namespace REASM {
+
+struct LinkInput {
+	std::string name;	// only used in diagnostics
+	ObjectFile object;
+};
+
+struct LinkResult {
+	bool success = false;
+	SegmentedImage image;
+	std::vector<AssembledSymbol> symbols;
+	std::vector<Diagnostic> diagnostics;
+};
+
+// Places every section in input order, the way a flat build places the code
+// between ORGs: an absolute section starts a segment at its origin, and any
+// other continues the one before it. Then patches each relocation once. Like
+// Assemble, it never touches the filesystem or exits.
+LinkResult Link(const std::vector<LinkInput> &inputs);
+
+}
\ No newline at end of file
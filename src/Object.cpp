@@ -0,0 +1,118 @@
+#include "Object.h"
+
+#include <cstring>
+
+#include "ByteStream.h"
+
+namespace REASM {
+
+// Layout, all integers little-endian:
+//   "ROBJ" u16 version, u16 reserved, u32 sections, u32 symbols, u32 relocations
+//   section:    u8 absolute, u8 reserved, u16 origin, u32 size, bytes
+//   symbol:     u32 section, u32 offset, u16 name length, name
+//   relocation: u32 section, u32 offset, u32 symbol, i32 addend
+static constexpr char Magic[4] = { 'R', 'O', 'B', 'J' };
+static constexpr uint16_t Version = 1;
+
+std::vector<uint8_t> ObjectFile::Serialize() const {
+	std::vector<uint8_t> out;
+	ByteWriter writer(out);
+
+	writer.Bytes(Magic, sizeof(Magic));
+	writer.U16(Version);
+	writer.U16(0);
+	writer.U32(static_cast<uint32_t>(sections.size()));
+	writer.U32(static_cast<uint32_t>(symbols.size()));
+	writer.U32(static_cast<uint32_t>(relocations.size()));
+
+	for (const ObjectSection &section : sections) {
+		writer.U8(section.absolute ? 1 : 0);
+		writer.U8(0);
+		writer.U16(section.origin);
+		writer.U32(static_cast<uint32_t>(section.bytes.size()));
+		writer.Bytes(section.bytes.data(), section.bytes.size());
+	}
+
+	for (const ObjectSymbol &symbol : symbols) {
+		writer.U32(symbol.section);
+		writer.U32(symbol.offset);
+		writer.U16(static_cast<uint16_t>(symbol.name.size()));
+		writer.Bytes(symbol.name.data(), symbol.name.size());
+	}
+
+	for (const Relocation &relocation : relocations) {
+		writer.U32(relocation.section);
+		writer.U32(relocation.offset);
+		writer.U32(relocation.symbol);
+		writer.U32(static_cast<uint32_t>(relocation.addend));
+	}
+
+	return out;
+}
+
+bool ObjectFile::Deserialize(std::string_view data, ObjectFile &object, std::string &error) {
+	ByteReader reader(data);
+	object = ObjectFile {};
+
+	std::string_view magic;
+	uint16_t version, reserved;
+	uint32_t sectionCount, symbolCount, relocationCount;
+	if (!reader.Bytes(magic, sizeof(Magic)) || std::memcmp(magic.data(), Magic, sizeof(Magic)) != 0) {
+		error = "Not an object file";
+		return false;
+	}
+	if (!reader.U16(version) || !reader.U16(reserved) || version != Version) {
+		error = "Unsupported object version";
+		return false;
+	}
+	if (!reader.U32(sectionCount) || !reader.U32(symbolCount) || !reader.U32(relocationCount)) {
+		error = "Truncated object header";
+		return false;
+	}
+
+	for (uint32_t i = 0; i < sectionCount; i++) {
+		uint8_t absolute, pad;
+		uint16_t origin;
+		uint32_t size;
+		std::string_view bytes;
+		if (!reader.U8(absolute) || !reader.U8(pad) || !reader.U16(origin) || !reader.U32(size) || !reader.Bytes(bytes, size)) {
+			error = "Truncated section";
+			return false;
+		}
+		object.sections.push_back(ObjectSection { .absolute = absolute != 0, .origin = origin,
+			.bytes = std::vector<uint8_t>(bytes.begin(), bytes.end()) });
+	}
+
+	for (uint32_t i = 0; i < symbolCount; i++) {
+		uint32_t section, offset;
+		uint16_t length;
+		std::string_view name;
+		if (!reader.U32(section) || !reader.U32(offset) || !reader.U16(length) || !reader.Bytes(name, length)) {
+			error = "Truncated symbol";
+			return false;
+		}
+		if (section != NoSection && (section >= sectionCount || offset > object.sections[section].bytes.size())) {
+			error = "Symbol outside its section: " + std::string(name);
+			return false;
+		}
+		object.symbols.push_back(ObjectSymbol { .name = std::string(name), .section = section, .offset = offset });
+	}
+
+	for (uint32_t i = 0; i < relocationCount; i++) {
+		uint32_t section, offset, symbol, addend;
+		if (!reader.U32(section) || !reader.U32(offset) || !reader.U32(symbol) || !reader.U32(addend)) {
+			error = "Truncated relocation";
+			return false;
+		}
+		if (section >= sectionCount || symbol >= symbolCount || static_cast<size_t>(offset) + 2 > object.sections[section].bytes.size()) {
+			error = "Relocation out of range";
+			return false;
+		}
+		object.relocations.push_back(Relocation { .section = section, .offset = offset, .symbol = symbol,
+			.addend = static_cast<int32_t>(addend) });
+	}
+
+	return true;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace REASM {
+
+constexpr uint32_t NoSection = UINT32_MAX;
+
+// A run of code between ORG directives. The first section of a module has no
+// origin and continues from wherever the linker has got to; every ORG starts
+// an absolute section. As with a flat build, a section's address is its
+// origin if it has one, or else where the section before it ended.
+struct ObjectSection {
+	bool absolute;
+	uint16_t origin;
+	std::vector<uint8_t> bytes;
+};
+
+struct ObjectSymbol {
+	std::string name;
+	uint32_t section;	// NoSection for an external reference
+	uint32_t offset;	// from the start of section
+};
+
+// A 16-bit little-endian absolute address: the field at offset in section
+// receives the address of symbol plus addend.
+struct Relocation {
+	uint32_t section;
+	uint32_t offset;
+	uint32_t symbol;
+	int32_t addend;
+};
+
+struct ObjectFile {
+	std::vector<ObjectSection> sections;
+	std::vector<ObjectSymbol> symbols;
+	std::vector<Relocation> relocations;
+
+	std::vector<uint8_t> Serialize() const;
+	// Returns false and sets error when data is not a well-formed object.
+	static bool Deserialize(std::string_view data, ObjectFile &object, std::string &error);
+};
+
+}
\ No newline at end of file
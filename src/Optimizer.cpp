@@ -0,0 +1,390 @@
+#include "Optimizer.h"
+
+#include <algorithm>
+#include <bit>
+
+namespace REASM {
+
+// How far ahead to look for the next flag write before assuming the flags
+// are still needed.
+static constexpr size_t FlagLookahead = 32;
+
+enum class Action {
+	Keep,
+	Replace,
+	Remove,
+};
+
+static Instruction Make(Byte opcode, const Instruction &from, uint32_t a, uint32_t b = 0, uint32_t c = 0) {
+	uint8_t index = ISA::OpcodeTable[opcode];
+	const InstructionDesc &desc = ISA::Instructions[index];
+	return Instruction { .kind = IRKind::Instruction, .desc = index,
+		.operands = { desc.operands[0], desc.operands[1], desc.operands[2] }, .values = { a, b, c }, .offset = from.offset };
+}
+
+static Byte Opcode(const Instruction &instruction) {
+	return instruction.GetDesc().opcode;
+}
+
+// Labels don't change which instruction runs next, so the flags flow
+// straight through them. Past an ORG, whatever happens to be placed after
+// the segment runs next, and data runs as whatever its bytes decode to.
+static bool FlagsDeadAfter(const std::vector<Instruction> &records, size_t index) {
+	size_t end = std::min(records.size(), index + 1 + FlagLookahead);
+	for (size_t i = index + 1; i < end; i++) {
+		if (records[i].kind == IRKind::Org || records[i].IsData()) return false;
+		if (records[i].kind != IRKind::Instruction) continue;
+
+		uint8_t effects = records[i].GetDesc().effects;
+		if (effects & (ReadsFlags | Branches | SkipsNext)) return false;
+		if (effects & (WritesFlags | Stops)) return true;
+	}
+	return false;
+}
+
+// A compare skips exactly one instruction, so whatever follows one must stay
+// a single instruction.
+static bool FollowsSkip(const std::vector<Instruction> &records, size_t end) {
+	for (size_t i = end; i-- > 0;) {
+		if (records[i].IsData()) return false;
+		if (records[i].kind == IRKind::Instruction) return records[i].GetDesc().effects & SkipsNext;
+	}
+	return false;
+}
+
+static bool Fold(Byte opcode, uint16_t a, uint16_t b, uint16_t &result) {
+	switch (opcode) {
+	case ADD_I: result = static_cast<uint16_t>(a + b); return true;
+	case SUB_I: result = static_cast<uint16_t>(a - b); return true;
+	case MUL_I: result = static_cast<uint16_t>(a * b); return true;
+	case DIV_I: if (b == 0) return false; result = a / b; return true;
+	case AND_I: result = a & b; return true;
+	case OR_I: result = a | b; return true;
+	case XOR_I: result = a ^ b; return true;
+	case SHL_I: result = b < 16 ? static_cast<uint16_t>(a << b) : 0; return true;
+	case SHR_I: result = b < 16 ? static_cast<uint16_t>(a >> b) : 0; return true;
+	default: return false;
+	}
+}
+
+static Action Move(const Instruction &in, uint32_t dest, uint32_t source, Instruction &out) {
+	if (dest == source) return Action::Remove;
+	out = Make(MOV_R, in, dest, source);
+	return Action::Replace;
+}
+
+// The commutative operations with the immediate first, as their register-
+// immediate twin.
+static Byte Commuted(Byte opcode) {
+	switch (opcode) {
+	case ADD_IR: return ADD_RI;
+	case MUL_IR: return MUL_RI;
+	case AND_IR: return AND_RI;
+	case OR_IR: return OR_RI;
+	case XOR_IR: return XOR_RI;
+	default: return opcode;
+	}
+}
+
+static Action Simplify(const Instruction &in, bool flagsDead, Instruction &out) {
+	Byte opcode = Opcode(in);
+	if (opcode == MOV_R && in.values[0] == in.values[1]) return Action::Remove;
+	if (!flagsDead) return Action::Keep;
+
+	// A label address isn't known until Layout.
+	const InstructionDesc &desc = in.GetDesc();
+	for (uint8_t i = 0; i < desc.operandCount; i++) {
+		if (desc.operands[i] == OperandKind::Imm && in.operands[i] != OperandKind::Imm) return Action::Keep;
+	}
+
+	uint16_t folded;
+	if (Fold(opcode, static_cast<uint16_t>(in.values[1]), static_cast<uint16_t>(in.values[2]), folded)) {
+		out = Make(MOV_IM, in, in.values[0], folded);
+		return Action::Replace;
+	}
+
+	uint32_t dest = in.values[0], source = in.values[1];
+	uint16_t immediate = static_cast<uint16_t>(in.values[2]);
+	Byte commuted = Commuted(opcode);
+	if (commuted != opcode) {
+		opcode = commuted;
+		source = in.values[2];
+		immediate = static_cast<uint16_t>(in.values[1]);
+	}
+
+	bool power = std::has_single_bit(immediate);
+	switch (opcode) {
+	case ADD_RI:
+		if (immediate == 1 && dest == source) { out = Make(INC_R, in, dest); return Action::Replace; }
+		[[fallthrough]];
+	case OR_RI:
+	case XOR_RI:
+	case SHL_RI:
+	case SHR_RI:
+		if (immediate == 0) return Move(in, dest, source, out);
+		break;
+	case SUB_RI:
+		if (immediate == 1 && dest == source) { out = Make(DEC_R, in, dest); return Action::Replace; }
+		if (immediate == 0) return Move(in, dest, source, out);
+		break;
+	case MUL_RI:
+		if (immediate == 0) { out = Make(MOV_IM, in, dest, 0); return Action::Replace; }
+		if (immediate == 1) return Move(in, dest, source, out);
+		if (power) { out = Make(SHL_RI, in, dest, source, std::countr_zero(immediate)); return Action::Replace; }
+		break;
+	case DIV_RI:
+		if (immediate == 1) return Move(in, dest, source, out);
+		if (power) { out = Make(SHR_RI, in, dest, source, std::countr_zero(immediate)); return Action::Replace; }
+		break;
+	case AND_RI:
+		if (immediate == 0) { out = Make(MOV_IM, in, dest, 0); return Action::Replace; }
+		if (immediate == 0xFFFF) return Move(in, dest, source, out);
+		break;
+	default: break;
+	}
+	return Action::Keep;
+}
+
+// Neither pattern touches the flags.
+static Action SimplifyPair(const Instruction &first, const Instruction &second, Instruction &out) {
+	Byte a = Opcode(first), b = Opcode(second);
+	if (a == PUSH_R && b == POP_R) return Move(first, second.values[0], first.values[0], out);
+
+	// A move overwritten straight away by one that doesn't read it.
+	bool overwrites = b == MOV_IM || (b == MOV_R && second.values[1] != second.values[0]);
+	if ((a == MOV_IM || a == MOV_R) && overwrites && first.values[0] == second.values[0]) {
+		out = second;
+		return Action::Replace;
+	}
+	return Action::Keep;
+}
+
+std::string FormatInstruction(const Instruction &instruction, const SymbolTable &symbols, const ExpressionPool &expressions) {
+	const InstructionDesc &desc = instruction.GetDesc();
+	std::string text(desc.mnemonic);
+	for (uint8_t operand = 0; operand < desc.operandCount; operand++) {
+		text += operand == 0 ? " " : ", ";
+		switch (instruction.operands[operand]) {
+		case OperandKind::Reg: text += "R" + std::to_string(instruction.values[operand]); break;
+		case OperandKind::Imm: text += "#" + std::to_string(static_cast<uint16_t>(instruction.values[operand])); break;
+		case OperandKind::Addr: text += symbols.Get(instruction.values[operand]).name; break;
+		case OperandKind::Expr: text += FormatExpression(expressions.Nodes(instruction.values[operand]), symbols); break;
+		default: break;
+		}
+	}
+	return text;
+}
+
+static void Report(std::vector<Rewrite> &rewrites, RewriteKind kind, const SymbolTable &symbols, const ExpressionPool &expressions,
+		const TokenStream &tokens, const Instruction &first, const Instruction *second, const Instruction *after) {
+	SourceLocation location = tokens.Locate(first.offset);
+	Rewrite rewrite { .kind = kind, .line = location.line, .column = location.column, .before = FormatInstruction(first, symbols, expressions) };
+	int32_t before = first.GetSize() + (second ? second->GetSize() : 0);
+	if (second) rewrite.before += "; " + FormatInstruction(*second, symbols, expressions);
+	if (after) rewrite.after = FormatInstruction(*after, symbols, expressions);
+	rewrite.bytesSaved = before - (after ? after->GetSize() : 0);
+	rewrites.push_back(std::move(rewrite));
+}
+
+// Follows chains through at most this many jumps, which also ends cycles.
+static constexpr int MaxJumpChain = 16;
+static constexpr size_t NoRecord = SIZE_MAX;
+
+// Where control goes around the records: labels resolved to the instruction
+// they stand in front of.
+class ControlFlow {
+public:
+	ControlFlow(const std::vector<Instruction> &records, size_t symbolCount)
+		: m_Records(records), m_Labels(symbolCount, NoRecord) {
+		for (size_t i = records.size(); i-- > 0;) {
+			if (records[i].kind == IRKind::Label) m_Labels[records[i].values[0]] = i;
+		}
+	}
+
+	// The first instruction at or after index. The code after an ORG is in
+	// another segment, but every ORG is also an entry point, so reachability
+	// can look across one; pass stopAtOrg to only accept an instruction at
+	// the same address. Data in between means there is no telling what runs
+	// next.
+	size_t NextInstruction(size_t index, bool stopAtOrg = false) const {
+		for (size_t i = index; i < m_Records.size(); i++) {
+			if (m_Records[i].kind == IRKind::Instruction) return i;
+			if (m_Records[i].IsData()) return NoRecord;
+			if (stopAtOrg && m_Records[i].kind == IRKind::Org) return NoRecord;
+		}
+		return NoRecord;
+	}
+
+	// NoRecord for a label defined in another module.
+	size_t Target(SymbolID label, bool stopAtOrg = false) const {
+		size_t index = m_Labels[label];
+		return index == NoRecord ? NoRecord : NextInstruction(index, stopAtOrg);
+	}
+
+private:
+	const std::vector<Instruction> &m_Records;
+	std::vector<size_t> m_Labels;
+};
+
+// Only a jump straight to a label; one to a computed address is left alone.
+static bool IsJump(const Instruction &instruction) {
+	return instruction.kind == IRKind::Instruction && (instruction.GetDesc().effects & Branches)
+		&& instruction.operands[0] == OperandKind::Addr;
+}
+
+static bool ThreadJumps(std::vector<Instruction> &records, const SymbolTable &symbols, const ExpressionPool &expressions,
+		const TokenStream &tokens, std::vector<Rewrite> &rewrites) {
+	ControlFlow flow(records, symbols.Size());
+	bool changed = false;
+	for (Instruction &instruction : records) {
+		if (!IsJump(instruction)) continue;
+
+		SymbolID target = instruction.values[0];
+		for (int hop = 0; hop < MaxJumpChain; hop++) {
+			size_t at = flow.Target(target, true);
+			if (at == NoRecord || Opcode(records[at]) != JMP || !IsJump(records[at]) || records[at].values[0] == target) break;
+			target = records[at].values[0];
+		}
+		if (target == instruction.values[0]) continue;
+
+		Instruction threaded = instruction;
+		threaded.values[0] = target;
+		Report(rewrites, RewriteKind::Jump, symbols, expressions, tokens, instruction, nullptr, &threaded);
+		instruction = threaded;
+		changed = true;
+	}
+	return changed;
+}
+
+static bool RemoveUnreachable(std::vector<Instruction> &records, const SymbolTable &symbols, const ExpressionPool &expressions,
+		const TokenStream &tokens, bool relocatable, std::vector<Rewrite> &rewrites) {
+	ControlFlow flow(records, symbols.Size());
+	std::vector<uint8_t> reachable(records.size(), 0);
+	std::vector<size_t> pending;
+	auto reach = [&](size_t index) {
+		if (index != NoRecord && !reachable[index]) {
+			reachable[index] = 1;
+			pending.push_back(index);
+		}
+	};
+
+	// A jump to a computed address could land anywhere.
+	for (const Instruction &instruction : records) {
+		if (instruction.kind == IRKind::Instruction && (instruction.GetDesc().effects & Branches) && !IsJump(instruction)) return false;
+	}
+
+	reach(flow.NextInstruction(0));
+	for (size_t i = 0; i < records.size(); i++) {
+		if (records[i].kind == IRKind::Org) reach(flow.NextInstruction(i));
+		// Code right after data may be entered by running through it.
+		if (records[i].IsData()) reach(flow.NextInstruction(i + 1));
+		if (relocatable && records[i].kind == IRKind::Label) reach(flow.NextInstruction(i));
+	}
+
+	while (!pending.empty()) {
+		size_t index = pending.back();
+		pending.pop_back();
+
+		const Instruction &instruction = records[index];
+		uint8_t effects = instruction.GetDesc().effects;
+		size_t next = flow.NextInstruction(index + 1);
+		if (effects & Branches) reach(flow.Target(instruction.values[0]));
+		if (effects & SkipsNext && next != NoRecord) reach(flow.NextInstruction(next + 1));
+		if (!(effects & Stops) && Opcode(instruction) != JMP) reach(next);
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < records.size(); i++) {
+		if (records[i].kind == IRKind::Instruction && !reachable[i]) {
+			Report(rewrites, RewriteKind::DeadCode, symbols, expressions, tokens, records[i], nullptr, nullptr);
+			continue;
+		}
+		records[kept++] = records[i];
+	}
+	bool changed = kept != records.size();
+	records.resize(kept);
+	return changed;
+}
+
+static bool RemoveJumpsToNext(std::vector<Instruction> &records, const SymbolTable &symbols, const ExpressionPool &expressions,
+		const TokenStream &tokens, std::vector<Rewrite> &rewrites) {
+	ControlFlow flow(records, symbols.Size());
+	std::vector<uint8_t> redundant(records.size(), 0);
+	for (size_t i = 0; i < records.size(); i++) {
+		if (!IsJump(records[i]) || FollowsSkip(records, i)) continue;
+
+		size_t target = flow.Target(records[i].values[0], true);
+		redundant[i] = target != NoRecord && target == flow.NextInstruction(i + 1, true);
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < records.size(); i++) {
+		if (redundant[i]) {
+			Report(rewrites, RewriteKind::Jump, symbols, expressions, tokens, records[i], nullptr, nullptr);
+			continue;
+		}
+		records[kept++] = records[i];
+	}
+	bool changed = kept != records.size();
+	records.resize(kept);
+	return changed;
+}
+
+static void Peephole(std::vector<Instruction> &records, const SymbolTable &symbols, const ExpressionPool &expressions,
+		const TokenStream &tokens, std::vector<Rewrite> &rewrites) {
+	// Records are compacted in place; [0, kept) is the output so far, so a
+	// rewritten instruction can pair up again with the one before it.
+	size_t kept = 0;
+	for (size_t i = 0; i < records.size(); i++) {
+		Instruction instruction = records[i];
+		if (instruction.kind != IRKind::Instruction) {
+			records[kept++] = instruction;
+			continue;
+		}
+
+		Instruction out;
+		bool skipped = FollowsSkip(records, kept);
+		Action action = Simplify(instruction, FlagsDeadAfter(records, i), out);
+		if (action == Action::Remove && skipped) action = Action::Keep;
+		if (action != Action::Keep) {
+			Report(rewrites, RewriteKind::Peephole, symbols, expressions, tokens, instruction, nullptr, action == Action::Replace ? &out : nullptr);
+			if (action == Action::Remove) continue;
+			instruction = out;
+		}
+
+		if (kept > 0 && records[kept - 1].kind == IRKind::Instruction && !FollowsSkip(records, kept - 1)) {
+			Instruction &previous = records[kept - 1];
+			Instruction pair;
+			action = SimplifyPair(previous, instruction, pair);
+			if (action != Action::Keep) {
+				Report(rewrites, RewriteKind::Peephole, symbols, expressions, tokens, previous, &instruction, action == Action::Replace ? &pair : nullptr);
+				kept--;
+				if (action == Action::Remove) continue;
+				instruction = pair;
+			}
+		}
+
+		records[kept++] = instruction;
+	}
+	records.resize(kept);
+}
+
+void Optimize(std::vector<Instruction> &records, const SymbolTable &symbols, const ExpressionPool &expressions,
+		const TokenStream &tokens, bool relocatable, std::vector<Rewrite> &rewrites) {
+	// Each step can expose work for the others: threading leaves jumps
+	// that are no longer targeted, and dropping dead code leaves jumps to
+	// the next instruction.
+	bool changed = true;
+	for (int round = 0; changed && round < 4; round++) {
+		changed = ThreadJumps(records, symbols, expressions, tokens, rewrites);
+		changed |= RemoveUnreachable(records, symbols, expressions, tokens, relocatable, rewrites);
+		changed |= RemoveJumpsToNext(records, symbols, expressions, tokens, rewrites);
+	}
+	Peephole(records, symbols, expressions, tokens, rewrites);
+
+	std::stable_sort(rewrites.begin(), rewrites.end(), [](const Rewrite &a, const Rewrite &b) {
+		return a.line != b.line ? a.line < b.line : a.column < b.column;
+	});
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "Expression.h"
+#include "IR.h"
+#include "SymbolTable.h"
+#include "TokenStream.h"
+
+namespace REASM {
+
+enum class RewriteKind : uint8_t {
+	Peephole,
+	Jump,		// retargeted past a chain of jumps, or removed as a jump to the next instruction
+	DeadCode,
+};
+
+struct Rewrite {
+	RewriteKind kind;
+	uint32_t line;
+	uint32_t column;
+	std::string before;		// statements joined with "; "
+	std::string after;		// empty when they were removed
+	int32_t bytesSaved;
+};
+
+// Runs over parsed records before Layout, so labels land on the rewritten
+// code. First the control flow pass: jumps to jumps are retargeted to the
+// end of the chain, instructions no path reaches are dropped and so are
+// jumps to the next instruction. Then the peephole pass: each instruction,
+// and each pair of adjacent instructions with no label between them, is
+// matched against patterns with a cheaper equivalent. Rewrites that would
+// change the flags only apply where the flags are overwritten before
+// anything reads them. Every change is appended to rewrites in source order.
+//
+// Execution can start at the first instruction of each section and, when
+// relocatable, at any label, since another module may jump to it.
+void Optimize(std::vector<Instruction> &records, const SymbolTable &symbols, const ExpressionPool &expressions,
+	const TokenStream &tokens, bool relocatable, std::vector<Rewrite> &rewrites);
+
+std::string FormatInstruction(const Instruction &instruction, const SymbolTable &symbols, const ExpressionPool &expressions);
+
+}
\ No newline at end of file
@@ -0,0 +1,302 @@
+#include "Server.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+
+#include "ByteStream.h"
+#include "ThreadPool.h"
+
+namespace REASM {
+
+#ifndef _WIN32
+
+static constexpr uint8_t ProtocolVersion = 5;
+static constexpr uint8_t RelocatableFlag = 1;
+static constexpr uint8_t OptimizeFlag = 2;
+static constexpr uint8_t SourceMapFlag = 4;
+static constexpr uint32_t MaxMessageSize = 1u << 30;
+
+static std::vector<uint8_t> EncodeResponse(const AssembleResult &result, bool relocatable) {
+	std::vector<uint8_t> message;
+	ByteWriter writer(message);
+
+	std::vector<uint8_t> bytes;
+	if (result.success) bytes = relocatable ? result.object.Serialize() : result.image.Serialize();
+	writer.U8(result.success ? 1 : 0);
+	writer.U32(static_cast<uint32_t>(bytes.size()));
+	writer.Bytes(bytes.data(), bytes.size());
+
+	writer.U32(static_cast<uint32_t>(result.symbols.size()));
+	for (const AssembledSymbol &symbol : result.symbols) {
+		writer.U16(static_cast<uint16_t>(symbol.name.size()));
+		writer.Bytes(symbol.name.data(), symbol.name.size());
+		writer.U16(symbol.value);
+	}
+
+	writer.U32(static_cast<uint32_t>(result.diagnostics.size()));
+	for (const Diagnostic &diagnostic : result.diagnostics) {
+		writer.U32(diagnostic.line);
+		writer.U32(diagnostic.column);
+		writer.U32(static_cast<uint32_t>(diagnostic.message.size()));
+		writer.Bytes(diagnostic.message.data(), diagnostic.message.size());
+	}
+
+	writer.U32(static_cast<uint32_t>(result.rewrites.size()));
+	for (const Rewrite &rewrite : result.rewrites) {
+		writer.U8(static_cast<uint8_t>(rewrite.kind));
+		writer.U32(rewrite.line);
+		writer.U32(rewrite.column);
+		writer.U32(static_cast<uint32_t>(rewrite.bytesSaved));
+		writer.U32(static_cast<uint32_t>(rewrite.before.size()));
+		writer.Bytes(rewrite.before.data(), rewrite.before.size());
+		writer.U32(static_cast<uint32_t>(rewrite.after.size()));
+		writer.Bytes(rewrite.after.data(), rewrite.after.size());
+	}
+
+	std::string map = result.map.labels.empty() && result.map.lines.empty() ? std::string() : result.map.Serialize();
+	writer.U32(static_cast<uint32_t>(map.size()));
+	writer.Bytes(map.data(), map.size());
+
+	return message;
+}
+
+static bool DecodeResponse(std::string_view message, bool relocatable, AssembleResult &result) {
+	ByteReader reader(message);
+	uint8_t success;
+	uint32_t size, symbolCount, diagnosticCount, rewriteCount;
+	std::string_view bytes;
+	if (!reader.U8(success) || !reader.U32(size) || !reader.Bytes(bytes, size) || !reader.U32(symbolCount)) return false;
+
+	for (uint32_t i = 0; i < symbolCount; i++) {
+		uint16_t length, value;
+		std::string_view name;
+		if (!reader.U16(length) || !reader.Bytes(name, length) || !reader.U16(value)) return false;
+		result.symbols.push_back(AssembledSymbol { .name = std::string(name), .value = value });
+	}
+
+	if (!reader.U32(diagnosticCount)) return false;
+	for (uint32_t i = 0; i < diagnosticCount; i++) {
+		uint32_t line, column, length;
+		std::string_view text;
+		if (!reader.U32(line) || !reader.U32(column) || !reader.U32(length) || !reader.Bytes(text, length)) return false;
+		result.diagnostics.push_back(Diagnostic { .line = line, .column = column, .message = std::string(text) });
+	}
+
+	if (!reader.U32(rewriteCount)) return false;
+	for (uint32_t i = 0; i < rewriteCount; i++) {
+		uint8_t kind;
+		uint32_t line, column, saved, beforeLength, afterLength;
+		std::string_view before, after;
+		if (!reader.U8(kind) || kind > static_cast<uint8_t>(RewriteKind::DeadCode) || !reader.U32(line) || !reader.U32(column) || !reader.U32(saved) || !reader.U32(beforeLength) ||
+			!reader.Bytes(before, beforeLength) || !reader.U32(afterLength) || !reader.Bytes(after, afterLength)) return false;
+		result.rewrites.push_back(Rewrite { .kind = static_cast<RewriteKind>(kind), .line = line, .column = column, .before = std::string(before),
+			.after = std::string(after), .bytesSaved = static_cast<int32_t>(saved) });
+	}
+
+	uint32_t mapSize;
+	std::string_view map;
+	std::string error;
+	if (!reader.U32(mapSize) || !reader.Bytes(map, mapSize)) return false;
+	if (!map.empty() && !SourceMap::Deserialize(map, result.map, error)) return false;
+
+	result.success = success != 0;
+	if (!result.success) return true;
+
+	if (!relocatable) return SegmentedImage::Deserialize(bytes, result.image, error);
+	return ObjectFile::Deserialize(bytes, result.object, error);
+}
+
+static bool WriteAll(int fd, const void *data, size_t size) {
+	const char *bytes = static_cast<const char *>(data);
+	while (size > 0) {
+		ssize_t written = send(fd, bytes, size, MSG_NOSIGNAL);
+		if (written < 0 && errno == EINTR) continue;
+		if (written <= 0) return false;
+
+		bytes += written;
+		size -= static_cast<size_t>(written);
+	}
+	return true;
+}
+
+static bool ReadAll(int fd, void *data, size_t size) {
+	char *bytes = static_cast<char *>(data);
+	while (size > 0) {
+		ssize_t count = recv(fd, bytes, size, 0);
+		if (count < 0 && errno == EINTR) continue;
+		if (count <= 0) return false;
+
+		bytes += count;
+		size -= static_cast<size_t>(count);
+	}
+	return true;
+}
+
+static bool WriteMessage(int fd, const void *data, size_t size) {
+	uint8_t header[4];
+	for (int i = 0; i < 4; i++) header[i] = static_cast<uint8_t>(size >> (i * 8));
+	return WriteAll(fd, header, sizeof(header)) && WriteAll(fd, data, size);
+}
+
+static bool ReadMessage(int fd, std::string &message) {
+	uint8_t header[4];
+	if (!ReadAll(fd, header, sizeof(header))) return false;
+
+	uint32_t size = header[0] | (header[1] << 8) | (header[2] << 16) | (static_cast<uint32_t>(header[3]) << 24);
+	if (size > MaxMessageSize) return false;
+
+	message.resize(size);
+	return ReadAll(fd, message.data(), size);
+}
+
+static bool MakeAddress(const std::string &path, sockaddr_un &address) {
+	if (path.size() >= sizeof(address.sun_path)) return false;
+
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+	return true;
+}
+
+AssemblerServer::AssemblerServer(std::string socketPath, size_t jobs)
+	: m_SocketPath(std::move(socketPath)), m_Jobs(jobs) {}
+
+bool AssemblerServer::Run(std::string &error) {
+	sockaddr_un address;
+	if (!MakeAddress(m_SocketPath, address)) {
+		error = "Socket path too long: " + m_SocketPath;
+		return false;
+	}
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0) {
+		error = "Unable to create socket";
+		return false;
+	}
+
+	unlink(m_SocketPath.c_str());
+	if (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+		error = "Unable to listen on: " + m_SocketPath;
+		close(listener);
+		return false;
+	}
+
+	ThreadPool pool(m_Jobs);
+	while (true) {
+		int connection = accept(listener, nullptr, nullptr);
+		if (connection < 0) continue;
+
+		pool.Submit([connection]() { Serve(connection); });
+	}
+}
+
+void AssemblerServer::Serve(int connection) {
+	thread_local Assembler assembler;
+
+	std::string request;
+	while (ReadMessage(connection, request)) {
+		if (request.size() < 2 || static_cast<uint8_t>(request[0]) != ProtocolVersion) break;
+
+		AssembleOptions options;
+		options.relocatable = (static_cast<uint8_t>(request[1]) & RelocatableFlag) != 0;
+		options.optimize = (static_cast<uint8_t>(request[1]) & OptimizeFlag) != 0;
+		options.sourceMap = (static_cast<uint8_t>(request[1]) & SourceMapFlag) != 0;
+		assembler.SetOptions(options);
+
+		AssembleResult result = assembler.Assemble(std::string_view(request).substr(2));
+		std::vector<uint8_t> response = EncodeResponse(result, options.relocatable);
+		if (!WriteMessage(connection, response.data(), response.size())) break;
+	}
+
+	close(connection);
+}
+
+RemoteAssembler::RemoteAssembler(std::string socketPath, const AssembleOptions &options)
+	: m_SocketPath(std::move(socketPath)), m_Options(options) {}
+
+RemoteAssembler::~RemoteAssembler() {
+	Disconnect();
+}
+
+bool RemoteAssembler::Connect() {
+	sockaddr_un address;
+	if (!MakeAddress(m_SocketPath, address)) return false;
+
+	m_Socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_Socket < 0) return false;
+	if (connect(m_Socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+		Disconnect();
+		return false;
+	}
+	return true;
+}
+
+void RemoteAssembler::Disconnect() {
+	if (m_Socket >= 0) close(m_Socket);
+	m_Socket = -1;
+}
+
+AssembleResult RemoteAssembler::Assemble(std::string_view source) {
+	std::vector<uint8_t> request;
+	request.reserve(source.size() + 2);
+	request.push_back(ProtocolVersion);
+	request.push_back((m_Options.relocatable ? RelocatableFlag : 0) | (m_Options.optimize ? OptimizeFlag : 0) |
+		(m_Options.sourceMap ? SourceMapFlag : 0));
+	request.insert(request.end(), source.begin(), source.end());
+
+	// A kept connection may have gone stale if the server restarted.
+	for (int attempt = 0; attempt < 2; attempt++) {
+		if (m_Socket < 0 && !Connect()) break;
+
+		std::string response;
+		if (WriteMessage(m_Socket, request.data(), request.size()) && ReadMessage(m_Socket, response)) {
+			AssembleResult result;
+			if (DecodeResponse(response, m_Options.relocatable, result)) return result;
+
+			result = AssembleResult {};
+			result.diagnostics.push_back(Diagnostic { .line = 0, .column = 0, .message = "Malformed response from server: " + m_SocketPath });
+			return result;
+		}
+		Disconnect();
+	}
+
+	AssembleResult result;
+	result.diagnostics.push_back(Diagnostic { .line = 0, .column = 0, .message = "Unable to reach server: " + m_SocketPath });
+	return result;
+}
+
+#else
+
+AssemblerServer::AssemblerServer(std::string socketPath, size_t jobs)
+	: m_SocketPath(std::move(socketPath)), m_Jobs(jobs) {}
+
+bool AssemblerServer::Run(std::string &error) {
+	error = "serve is not supported on this platform";
+	return false;
+}
+
+void AssemblerServer::Serve(int connection) {}
+
+RemoteAssembler::RemoteAssembler(std::string socketPath, const AssembleOptions &options)
+	: m_SocketPath(std::move(socketPath)), m_Options(options) {}
+
+RemoteAssembler::~RemoteAssembler() {}
+
+bool RemoteAssembler::Connect() { return false; }
+void RemoteAssembler::Disconnect() {}
+
+AssembleResult RemoteAssembler::Assemble(std::string_view source) {
+	AssembleResult result;
+	result.diagnostics.push_back(Diagnostic { .line = 0, .column = 0, .message = "--server is not supported on this platform" });
+	return result;
+}
+
+#endif
+
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Assemble.h"
+
+namespace REASM {
+
+// Keeps a warm process that assembles sources sent over a Unix socket.
+// Every message is a little-endian u32 length followed by that many bytes:
+//   request:  u8 version, u8 flags (1 = relocatable, 2 = optimize), source
+//   response: u8 success, u32 size, image or serialized object,
+//             u32 symbols, per symbol u16 name length, name, u16 value,
+//             u32 diagnostics, per diagnostic u32 line, u32 column,
+//             u32 message length, message,
+//             u32 rewrites, per rewrite u8 kind, u32 line, u32 column,
+//             i32 bytes saved, u32 length, before, u32 length, after
+// A connection may carry any number of requests. Connections are served on a
+// thread pool, each worker reusing one Assembler and so its arena and
+// symbol table.
+class AssemblerServer {
+public:
+	AssemblerServer(std::string socketPath, size_t jobs);
+
+	// Only returns on failure to set up the socket.
+	bool Run(std::string &error);
+private:
+	static void Serve(int connection);
+private:
+	std::string m_SocketPath;
+	size_t m_Jobs;
+};
+
+// Drop-in for Assembler that forwards to a running AssemblerServer over one
+// persistent connection.
+class RemoteAssembler {
+public:
+	RemoteAssembler(std::string socketPath, const AssembleOptions &options = {});
+	~RemoteAssembler();
+
+	RemoteAssembler(const RemoteAssembler &) = delete;
+	RemoteAssembler &operator=(const RemoteAssembler &) = delete;
+
+	AssembleResult Assemble(std::string_view source);
+	// The server has no file access, so readFile is not passed on and INCBIN
+	// fails there.
+	void SetOptions(const AssembleOptions &options) { m_Options = options; }
+private:
+	bool Connect();
+	void Disconnect();
+private:
+	std::string m_SocketPath;
+	AssembleOptions m_Options;
+	int m_Socket = -1;
+};
+
+}
\ No newline at end of file
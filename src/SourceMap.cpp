@@ -0,0 +1,114 @@
+#include "SourceMap.h"
+
+#include <algorithm>
+#include <charconv>
+
+namespace REASM {
+
+// Text, one record per line after the header:
+//   label <address> <name>
+//   line <address> <line>
+// with addresses in hex, so the map can be read and diffed by hand.
+static constexpr std::string_view Header = "REASM map 1";
+
+std::string SourceMap::Serialize() const {
+	std::string out(Header);
+	out += '\n';
+
+	char buffer[16];
+	auto hex = [&](uint16_t value) {
+		std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value, 16);
+		out.append(4 - std::min<size_t>(4, result.ptr - buffer), '0');
+		out.append(buffer, result.ptr);
+	};
+
+	for (const SourceLabel &label : labels) {
+		out += "label ";
+		hex(label.address);
+		out += ' ';
+		out += label.name;
+		out += '\n';
+	}
+	for (const SourceLine &line : lines) {
+		out += "line ";
+		hex(line.address);
+		out += ' ';
+		out += std::to_string(line.line);
+		out += '\n';
+	}
+	return out;
+}
+
+static std::string_view NextField(std::string_view &text) {
+	size_t end = std::min(text.find(' '), text.size());
+	std::string_view field = text.substr(0, end);
+	text.remove_prefix(std::min(end + 1, text.size()));
+	return field;
+}
+
+template<typename T>
+static bool ParseNumber(std::string_view field, T &value, int base) {
+	std::from_chars_result result = std::from_chars(field.data(), field.data() + field.size(), value, base);
+	return !field.empty() && result.ec == std::errc() && result.ptr == field.data() + field.size();
+}
+
+bool SourceMap::Deserialize(std::string_view text, SourceMap &map, std::string &error) {
+	map = SourceMap {};
+
+	size_t number = 0;
+	while (!text.empty()) {
+		size_t end = std::min(text.find('\n'), text.size());
+		std::string_view record = text.substr(0, end);
+		text.remove_prefix(std::min(end + 1, text.size()));
+		if (!record.empty() && record.back() == '\r') record.remove_suffix(1);
+		number++;
+
+		if (number == 1) {
+			if (record != Header) {
+				error = "Not a source map";
+				return false;
+			}
+			continue;
+		}
+		if (record.empty()) continue;
+
+		std::string_view kind = NextField(record);
+		uint16_t address;
+		bool valid = ParseNumber(NextField(record), address, 16);
+		if (valid && kind == "label" && !record.empty()) {
+			map.labels.push_back(SourceLabel { .name = std::string(record), .address = address });
+		} else if (uint32_t line; valid && kind == "line" && ParseNumber(record, line, 10)) {
+			map.lines.push_back(SourceLine { .address = address, .line = line });
+		} else {
+			error = "Malformed record on line " + std::to_string(number);
+			return false;
+		}
+	}
+
+	if (number == 0) {
+		error = "Not a source map";
+		return false;
+	}
+
+	map.Sort();
+	return true;
+}
+
+void SourceMap::Sort() {
+	std::stable_sort(labels.begin(), labels.end(), [](const SourceLabel &a, const SourceLabel &b) { return a.address < b.address; });
+	std::stable_sort(lines.begin(), lines.end(), [](const SourceLine &a, const SourceLine &b) { return a.address < b.address; });
+}
+
+const SourceLabel *SourceMap::FindLabel(uint16_t address) const {
+	auto after = std::upper_bound(labels.begin(), labels.end(), address,
+		[](uint16_t address, const SourceLabel &label) { return address < label.address; });
+	return after == labels.begin() ? nullptr : &*(after - 1);
+}
+
+uint32_t SourceMap::FindLine(uint16_t address) const {
+	auto found = std::lower_bound(lines.begin(), lines.end(), address,
+		[](const SourceLine &line, uint16_t address) { return line.address < address; });
+	return found != lines.end() && found->address == address ? found->line : 0;
+}
+
+}
\ No newline at end of file
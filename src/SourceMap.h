@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace REASM {
+
+struct SourceLabel {
+	std::string name;
+	uint16_t address;
+};
+
+struct SourceLine {
+	uint16_t address;
+	uint32_t line;
+};
+
+// Where the labels and instructions of a flat image came from, so tools that
+// only see the image, like the profiler, can name what they report.
+struct SourceMap {
+	std::vector<SourceLabel> labels;
+	std::vector<SourceLine> lines;		// one per instruction
+
+	std::string Serialize() const;
+	// Returns false and sets error when text is not a well-formed map. The
+	// result is sorted for the lookups below.
+	static bool Deserialize(std::string_view text, SourceMap &map, std::string &error);
+
+	void Sort();
+	// The last label at or before address, or null.
+	const SourceLabel *FindLabel(uint16_t address) const;
+	// The line of the instruction at address, or 0.
+	uint32_t FindLine(uint16_t address) const;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string_view>
+
+namespace REASM {
+
+constexpr char ToUpperASCII(char c) {
+	return (c >= 'a' && c <= 'z') ? static_cast<char>(c - ('a' - 'A')) : c;
+}
+
+constexpr bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+	if (a.size() != b.size()) return false;
+	for (size_t i = 0; i < a.size(); i++) {
+		if (ToUpperASCII(a[i]) != ToUpperASCII(b[i])) return false;
+	}
+	return true;
+}
+
+}
\ No newline at end of file
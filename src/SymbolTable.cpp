@@ -0,0 +1,81 @@
+#include "SymbolTable.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "StringUtils.h"
+
+namespace REASM {
+
+SymbolTable::SymbolTable() {
+	m_Slots.assign(1024, EmptySlot);
+}
+
+uint32_t SymbolTable::Hash(std::string_view name) {
+	uint32_t hash = 2166136261u;
+	for (char c : name) {
+		hash ^= static_cast<uint8_t>(ToUpperASCII(c));
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+size_t SymbolTable::Probe(std::string_view name, uint32_t hash) const {
+	size_t mask = m_Slots.size() - 1;
+	size_t slot = hash & mask;
+	while (m_Slots[slot] != EmptySlot) {
+		uint32_t id = m_Slots[slot];
+		if (m_Hashes[id] == hash && EqualsIgnoreCase(m_Symbols[id].name, name))
+			break;
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+SymbolID SymbolTable::Find(std::string_view name) const {
+	return m_Slots[Probe(name, Hash(name))];
+}
+
+SymbolID SymbolTable::Intern(std::string_view name) {
+	uint32_t hash = Hash(name);
+	size_t slot = Probe(name, hash);
+	if (m_Slots[slot] != EmptySlot)
+		return m_Slots[slot];
+
+	SymbolID id = static_cast<SymbolID>(m_Symbols.size());
+	m_Symbols.push_back(Symbol { .name = Store(name), .value = 0, .defined = false });
+	m_Hashes.push_back(hash);
+	m_Slots[slot] = id;
+
+	if (m_Symbols.size() * 2 > m_Slots.size())
+		Grow();
+
+	return id;
+}
+
+void SymbolTable::Clear() {
+	m_Symbols.clear();
+	m_Hashes.clear();
+	std::fill(m_Slots.begin(), m_Slots.end(), EmptySlot);
+	m_Names.Reset();
+}
+
+std::string_view SymbolTable::Store(std::string_view name) {
+	char *dest = static_cast<char *>(m_Names.Allocate(name.size(), 1));
+	std::memcpy(dest, name.data(), name.size());
+
+	return std::string_view(dest, name.size());
+}
+
+void SymbolTable::Grow() {
+	m_Slots.assign(m_Slots.size() * 2, EmptySlot);
+
+	size_t mask = m_Slots.size() - 1;
+	for (SymbolID id = 0; id < m_Symbols.size(); id++) {
+		size_t slot = m_Hashes[id] & mask;
+		while (m_Slots[slot] != EmptySlot) slot = (slot + 1) & mask;
+		m_Slots[slot] = id;
+	}
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <string_view>
+#include <vector>
+
+#include "Arena.h"
+
+namespace REASM {
+
+using SymbolID = uint32_t;
+constexpr SymbolID InvalidSymbol = UINT32_MAX;
+
+struct Symbol {
+	std::string_view name;
+	uint16_t value;
+	bool defined;
+};
+
+// Interns names case-insensitively behind an open-addressing hash. IDs are
+// dense and stable for the lifetime of the table, and so are the name copies
+// kept in its arena.
+class SymbolTable {
+public:
+	SymbolTable();
+
+	SymbolID Intern(std::string_view name);
+	SymbolID Find(std::string_view name) const;
+	// Forgets every symbol but keeps the allocations for the next source.
+	void Clear();
+
+	Symbol &Get(SymbolID id) { return m_Symbols[id]; }
+	const Symbol &Get(SymbolID id) const { return m_Symbols[id]; }
+	size_t Size() const { return m_Symbols.size(); }
+private:
+	static uint32_t Hash(std::string_view name);
+
+	size_t Probe(std::string_view name, uint32_t hash) const;
+	std::string_view Store(std::string_view name);
+	void Grow();
+private:
+	static constexpr uint32_t EmptySlot = UINT32_MAX;
+
+	std::vector<Symbol> m_Symbols;
+	std::vector<uint32_t> m_Hashes;
+	std::vector<uint32_t> m_Slots;
+
+	Arena m_Names { 64 * 1024 };
+};
+
+}
\ No newline at end of file
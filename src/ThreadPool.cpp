@@ -0,0 +1,68 @@
+#include "ThreadPool.h"
+
+namespace REASM {
+
+ThreadPool::ThreadPool(size_t threads) {
+	threads = ResolveThreadCount(threads);
+	m_Threads.reserve(threads);
+	for (size_t i = 0; i < threads; i++) {
+		m_Threads.emplace_back([this]() { Worker(); });
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+	}
+	m_JobAvailable.notify_all();
+
+	for (std::thread &thread : m_Threads) {
+		thread.join();
+	}
+}
+
+size_t ThreadPool::ResolveThreadCount(size_t requested) {
+	if (requested > 0) return requested;
+
+	size_t hardware = std::thread::hardware_concurrency();
+	return hardware > 0 ? hardware : 1;
+}
+
+void ThreadPool::Submit(std::function<void()> job) {
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Jobs.push(std::move(job));
+	}
+	m_JobAvailable.notify_one();
+}
+
+void ThreadPool::Wait() {
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_Idle.wait(lock, [this]() { return m_Jobs.empty() && m_Active == 0; });
+}
+
+void ThreadPool::Worker() {
+	while (true) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_JobAvailable.wait(lock, [this]() { return m_Stopping || !m_Jobs.empty(); });
+			if (m_Jobs.empty()) return;
+
+			job = std::move(m_Jobs.front());
+			m_Jobs.pop();
+			m_Active++;
+		}
+
+		job();
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Active--;
+			if (m_Jobs.empty() && m_Active == 0) m_Idle.notify_all();
+		}
+	}
+}
+
+}
\ No newline at end of file
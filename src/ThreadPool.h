@@ -0,0 +1,40 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace REASM {
+
+class ThreadPool {
+public:
+	ThreadPool(size_t threads);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	void Submit(std::function<void()> job);
+	void Wait();
+
+	size_t GetThreadCount() const { return m_Threads.size(); }
+
+	// 0 means one thread per hardware thread.
+	static size_t ResolveThreadCount(size_t requested);
+private:
+	void Worker();
+private:
+	std::vector<std::thread> m_Threads;
+	std::queue<std::function<void()>> m_Jobs;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_JobAvailable;
+	std::condition_variable m_Idle;
+	size_t m_Active = 0;
+	bool m_Stopping = false;
+};
+
+}
\ No newline at end of file
@@ -1,21 +1,26 @@
 #pragma once
 
-#include <vector>
+#include <stdint.h>
 #include <string>
 #include <unordered_map>
 
-#include "Log/Log.h"
-
 namespace REASM {
 
 enum TokenType {
 	OPCODE,
 
 	ORG,
+	EQU,
+	DB,
+	DW,
+	DS,
+	INCBIN,
 
 	IMMEDIATE,
 	HEX,
+	NUMBER,
 	REG,
+	STRING,
 
 	LABEL,
 
@@ -29,21 +34,41 @@ enum TokenType {
 	SEMICOLON,
 	COMMA,
 
+	PLUS,
+	MINUS,
+	STAR,
+	SLASH,
+	PERCENT,
+	SHIFTLEFT,
+	SHIFTRIGHT,
+	AMPERSAND,
+	PIPE,
+	CARET,
+	TILDE,
+
+	INVALID,	// a number that doesn't parse or fit 32 bits, or a stray character
 	UNKNOWN,
 };
 
-struct Token {
-	TokenType type;
-	std::string value;
+struct SourceLocation {
+	uint32_t line;
+	uint32_t column;
 };
 
 inline std::string TokenTypeToString(TokenType type) {
 	std::unordered_map<TokenType, std::string> tokenTypeToString = {
 		{ TokenType::OPCODE, "opcode" },
 		{ TokenType::ORG, "org" },
+		{ TokenType::EQU, "equ" },
+		{ TokenType::DB, "db" },
+		{ TokenType::DW, "dw" },
+		{ TokenType::DS, "ds" },
+		{ TokenType::INCBIN, "incbin" },
 		{ TokenType::IMMEDIATE, "immediate" },
 		{ TokenType::HEX, "hex" },
+		{ TokenType::NUMBER, "number" },
 		{ TokenType::REG, "reg" },
+		{ TokenType::STRING, "string" },
 		{ TokenType::LABEL, "label" },
 		{ TokenType::LPAREN, "lparen" },
 		{ TokenType::RPAREN, "rparen" },
@@ -54,24 +79,22 @@ inline std::string TokenTypeToString(TokenType type) {
 		{ TokenType::COLON, "colon" },
 		{ TokenType::SEMICOLON, "semicolon" },
 		{ TokenType::COMMA, "comma" },
+		{ TokenType::PLUS, "plus" },
+		{ TokenType::MINUS, "minus" },
+		{ TokenType::STAR, "star" },
+		{ TokenType::SLASH, "slash" },
+		{ TokenType::PERCENT, "percent" },
+		{ TokenType::SHIFTLEFT, "shiftleft" },
+		{ TokenType::SHIFTRIGHT, "shiftright" },
+		{ TokenType::AMPERSAND, "ampersand" },
+		{ TokenType::PIPE, "pipe" },
+		{ TokenType::CARET, "caret" },
+		{ TokenType::TILDE, "tilde" },
+		{ TokenType::INVALID, "invalid token" },
 		{ TokenType::UNKNOWN, "unknown" },
 	};
 
 	return tokenTypeToString[type];
 }
 
-static Token FetchToken(std::vector<Token> &tokens, int &pos) {
-	Token result = tokens[pos];
-	pos++;
-	return result;
-}
-
-static Token ExpectToken(std::vector<Token> &tokens, TokenType expect, int &pos) {
-	Token token = FetchToken(tokens, pos);
-	if (token.type == expect) { ERROR("Unexpected token, expected: {0} got: {1}",
-		TokenTypeToString(expect), TokenTypeToString(token.type)); exit(1); }
-
-	return token;
-}
-
 }
\ No newline at end of file
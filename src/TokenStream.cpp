@@ -0,0 +1,65 @@
+#include "TokenStream.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace REASM {
+
+TokenStream::TokenStream(std::string_view source, Arena &arena)
+	: m_Source(source), m_Arena(&arena) {}
+
+void TokenStream::Push(TokenType type, uint32_t offset, uint32_t length, uint32_t payload) {
+	if (!m_Tail || m_Tail->count == PageSize) {
+		Page *page = m_Arena->Allocate<Page>(1);
+		page->count = 0;
+		page->next = nullptr;
+
+		if (m_Tail) m_Tail->next = page;
+		else m_Head = page;
+		m_Tail = page;
+	}
+
+	uint32_t slot = m_Tail->count++;
+	m_Tail->types[slot] = static_cast<uint8_t>(type);
+	m_Tail->offsets[slot] = offset;
+	m_Tail->lengths[slot] = length;
+	m_Tail->payloads[slot] = payload;
+
+	m_Size++;
+	if (type == ORG || type == LABEL || type == OPCODE || (type >= DB && type <= INCBIN)) m_Statements++;
+}
+
+void TokenStream::Append(TokenStream &other) {
+	if (!other.m_Head) return;
+
+	if (m_Tail) m_Tail->next = other.m_Head;
+	else m_Head = other.m_Head;
+	m_Tail = other.m_Tail;
+	m_Size += other.m_Size;
+	m_Statements += other.m_Statements;
+
+	other.m_Head = nullptr;
+	other.m_Tail = nullptr;
+	other.m_Size = 0;
+	other.m_Statements = 0;
+}
+
+SourceLocation TokenStream::Locate(uint32_t offset) const {
+	if (m_LineStarts.empty()) {
+		m_LineStarts.push_back(0);
+		const char *data = m_Source.data();
+		const char *end = data + m_Source.size();
+		while (const char *newline = static_cast<const char *>(std::memchr(data, '\n', end - data))) {
+			data = newline + 1;
+			m_LineStarts.push_back(static_cast<uint32_t>(data - m_Source.data()));
+		}
+	}
+
+	auto line = std::upper_bound(m_LineStarts.begin(), m_LineStarts.end(), offset) - 1;
+	return SourceLocation {
+		.line = static_cast<uint32_t>(line - m_LineStarts.begin() + 1),
+		.column = offset - *line + 1,
+	};
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <string_view>
+#include <vector>
+
+#include "Arena.h"
+#include "Token.h"
+
+namespace REASM {
+
+// Tokens stored as parallel arrays in fixed-size pages carved from an arena.
+// A token is its type, the (offset, length) of its text in the source and a
+// payload whose meaning depends on the type:
+//   OPCODE          mnemonic index into ISA::Mnemonics, ImmediateWidth
+//                   from WidthShift up
+//   REG             register index
+//   IMMEDIATE, HEX,
+//   NUMBER          parsed value
+//   LABEL, UNKNOWN  SymbolID, or InvalidSymbol if unresolved
+class TokenStream {
+public:
+	static constexpr uint32_t PageSize = 8 * 1024;
+
+	struct Page {
+		uint8_t types[PageSize];
+		uint32_t offsets[PageSize];
+		uint32_t lengths[PageSize];
+		uint32_t payloads[PageSize];
+		uint32_t count;
+		Page *next;
+	};
+
+	class Cursor {
+	public:
+		Cursor(Page *page)
+			: m_Page(page) {}
+
+		bool AtEnd() const { return m_Page == nullptr; }
+		void Advance() {
+			if (++m_Slot == m_Page->count) {
+				m_Page = m_Page->next;
+				m_Slot = 0;
+			}
+		}
+
+		TokenType Type() const { return static_cast<TokenType>(m_Page->types[m_Slot]); }
+		uint32_t Offset() const { return m_Page->offsets[m_Slot]; }
+		uint32_t Length() const { return m_Page->lengths[m_Slot]; }
+		uint32_t Payload() const { return m_Page->payloads[m_Slot]; }
+
+		void SetType(TokenType type) { m_Page->types[m_Slot] = static_cast<uint8_t>(type); }
+		void SetPayload(uint32_t payload) { m_Page->payloads[m_Slot] = payload; }
+	private:
+		Page *m_Page;
+		uint32_t m_Slot = 0;
+	};
+public:
+	TokenStream(std::string_view source, Arena &arena);
+
+	void Push(TokenType type, uint32_t offset, uint32_t length, uint32_t payload);
+	// Moves other's pages onto the end of this stream without copying.
+	void Append(TokenStream &other);
+
+	Cursor Begin() const { return Cursor(m_Head); }
+	size_t Size() const { return m_Size; }
+	// ORG, LABEL, OPCODE and data directive tokens, one per statement; what
+	// to reserve for the IR, though DB and DW make a record per value.
+	size_t GetStatementCount() const { return m_Statements; }
+
+	std::string_view GetSource() const { return m_Source; }
+	std::string_view Text(const Cursor &cursor) const { return m_Source.substr(cursor.Offset(), cursor.Length()); }
+	SourceLocation Locate(uint32_t offset) const;
+private:
+	std::string_view m_Source;
+	Arena *m_Arena;
+
+	Page *m_Head = nullptr;
+	Page *m_Tail = nullptr;
+	size_t m_Size = 0;
+	size_t m_Statements = 0;
+
+	// Built on the first Locate call; only diagnostics need it.
+	mutable std::vector<uint32_t> m_LineStarts;
+};
+
+}
\ No newline at end of file
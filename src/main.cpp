@@ -1,8 +1,26 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <set>
+#include <span>
 #include <string>
+#include <vector>
 
 #include "Log/Log.h"
 #include "Assemble.h"
+#include "Batch.h"
+#include "BuildCache.h"
+#include "Disassembler.h"
+#include "Emulator.h"
+#include "File.h"
+#include "FileWatcher.h"
+#include "JIT.h"
+#include "Linker.h"
+#include "Server.h"
+#include "ThreadPool.h"
 
 char *Shift(int &argc, char ***argv) {
 	char *result = **argv;
@@ -11,6 +29,847 @@ char *Shift(int &argc, char ***argv) {
 	return result;
 }
 
+// How a build writes its image: flat, with the gaps between ORG regions
+// left as holes; Intel HEX; or the compact segmented binary.
+enum class ImageFormat {
+	Flat,
+	IntelHex,
+	Segmented,
+};
+
+struct BuildUnit {
+	std::string input;
+	std::string output;
+	std::string map;	// where to write the source map, if one was asked for
+	ImageFormat format = ImageFormat::Flat;
+
+	bool success = false;
+	bool cached = false;
+	size_t bytes = 0;
+	std::vector<REASM::Diagnostic> diagnostics;
+	std::vector<REASM::Rewrite> rewrites;
+};
+
+static bool WriteOutput(const std::string &path, std::span<const uint8_t> bytes) {
+	std::ofstream file(path, std::ios::binary);
+	if (!file) return false;
+
+	file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+	return static_cast<bool>(file);
+}
+
+static bool WriteOutput(const std::string &path, std::string_view text) {
+	return WriteOutput(path, std::span(reinterpret_cast<const uint8_t *>(text.data()), text.size()));
+}
+
+// The gaps between segments are seeked over rather than written, which
+// leaves holes in the file where the filesystem supports them.
+static bool WriteFlatImage(const std::string &path, const REASM::SegmentedImage &image) {
+	std::ofstream file(path, std::ios::binary);
+	if (!file) return false;
+
+	uint16_t base = image.Base();
+	for (const REASM::ImageSegment &segment : image.segments) {
+		file.seekp(segment.origin - base);
+		file.write(reinterpret_cast<const char *>(image.bytes.data() + segment.offset), segment.size);
+	}
+	return static_cast<bool>(file);
+}
+
+static bool WriteImage(const std::string &path, const REASM::SegmentedImage &image, ImageFormat format) {
+	switch (format) {
+	case ImageFormat::IntelHex: return WriteOutput(path, image.ToIntelHex());
+	case ImageFormat::Segmented: return WriteOutput(path, image.Serialize());
+	default: return WriteFlatImage(path, image);
+	}
+}
+
+static const char *ImageExtension(ImageFormat format) {
+	switch (format) {
+	case ImageFormat::IntelHex: return ".hex";
+	case ImageFormat::Segmented: return ".seg";
+	default: return ".bin";
+	}
+}
+
+static ImageFormat ParseImageFormat(const std::string &name) {
+	if (name == "flat") return ImageFormat::Flat;
+	if (name == "hex") return ImageFormat::IntelHex;
+	if (name == "seg") return ImageFormat::Segmented;
+	ERROR("Invalid format: {0} (expected flat, hex or seg)", name);
+	exit(1);
+}
+
+static bool IsSegmentedImage(const std::string &path) {
+	return std::filesystem::path(path).extension() == ImageExtension(ImageFormat::Segmented);
+}
+
+static REASM::SegmentedImage ReadSegmentedImage(const std::string &path, std::string_view contents) {
+	REASM::SegmentedImage image;
+	std::string error;
+	if (!REASM::SegmentedImage::Deserialize(contents, image, error)) {
+		ERROR("{0}: {1}", path, error);
+		exit(1);
+	}
+	return image;
+}
+
+// The image run and batch load. A .seg image records where its segments go,
+// so it is flattened into flat from its lowest origin, with the gaps zeroed,
+// and origin is set to that; anything else is a flat image for origin.
+static std::span<const uint8_t> PlaceImage(const std::string &path, std::string_view contents, uint16_t &origin,
+		std::vector<uint8_t> &flat) {
+	if (!IsSegmentedImage(path)) return std::span<const uint8_t>(reinterpret_cast<const uint8_t *>(contents.data()), contents.size());
+
+	REASM::SegmentedImage image = ReadSegmentedImage(path, contents);
+	flat = image.Flatten();
+	origin = image.Base();
+	return flat;
+}
+
+// A response file lists inputs separated by whitespace.
+static void ReadResponseFile(const std::string &path, std::vector<std::string> &inputs) {
+	REASM::MappedFile file(path);
+	if (!file.IsValid()) {
+		ERROR("{0}", file.GetError());
+		exit(1);
+	}
+
+	std::string_view contents = file.GetContents();
+	size_t pos = 0;
+	while (pos < contents.size()) {
+		size_t start = contents.find_first_not_of(" \t\r\n", pos);
+		if (start == std::string_view::npos) break;
+		size_t end = std::min(contents.find_first_of(" \t\r\n", start), contents.size());
+
+		inputs.emplace_back(contents.substr(start, end - start));
+		pos = end;
+	}
+}
+
+// Assembler is either REASM::Assembler or REASM::RemoteAssembler.
+template<typename Assembler>
+static void BuildOne(BuildUnit &unit, Assembler &assembler, const REASM::AssembleOptions &options, REASM::BuildCache *cache) {
+	REASM::MappedFile source(unit.input);
+	if (!source.IsValid()) {
+		unit.diagnostics.push_back(REASM::Diagnostic { .line = 0, .column = 0, .message = source.GetError() });
+		return;
+	}
+
+	uint64_t key = 0;
+	REASM::CacheEntry entry;
+	if (cache) {
+		key = REASM::BuildCache::Key(source.GetContents(), options);
+		unit.cached = cache->Lookup(key, entry);
+	}
+
+	// Images are cached as segmented binaries and written in the unit's
+	// format. The key only covers the source, so output that INCBIN pulled
+	// files into isn't cached.
+	REASM::SegmentedImage image;
+	if (!unit.cached) {
+		REASM::IncludedFiles included(unit.input);
+		REASM::AssembleOptions unitOptions = options;
+		unitOptions.readFile = [&included](std::string_view path, std::string_view &contents, std::string &error) {
+			return included.Read(path, contents, error);
+		};
+		assembler.SetOptions(unitOptions);
+		REASM::AssembleResult result = assembler.Assemble(source.GetContents());
+		assembler.SetOptions(options);
+		unit.diagnostics = std::move(result.diagnostics);
+		unit.rewrites = std::move(result.rewrites);
+		if (!result.success) return;
+
+		if (options.relocatable) entry.output = result.object.Serialize();
+		else image = std::move(result.image);
+		entry.symbols = std::move(result.symbols);
+		if (options.sourceMap) entry.map = result.map.Serialize();
+		if (cache && result.included.empty()) {
+			if (!options.relocatable) entry.output = image.Serialize();
+			cache->Store(key, entry);
+		}
+	} else if (!options.relocatable) {
+		std::string error;
+		std::string_view output(reinterpret_cast<const char *>(entry.output.data()), entry.output.size());
+		if (!REASM::SegmentedImage::Deserialize(output, image, error)) {
+			unit.diagnostics.push_back(REASM::Diagnostic { .line = 0, .column = 0, .message = "Cached image: " + error });
+			return;
+		}
+	}
+
+	bool written = options.relocatable ? WriteOutput(unit.output, entry.output) : WriteImage(unit.output, image, unit.format);
+	if (!written) {
+		unit.diagnostics.push_back(REASM::Diagnostic { .line = 0, .column = 0, .message = "Unable to open file for write: " + unit.output });
+		return;
+	}
+	if (!unit.map.empty() && !WriteOutput(unit.map, entry.map)) {
+		unit.diagnostics.push_back(REASM::Diagnostic { .line = 0, .column = 0, .message = "Unable to open file for write: " + unit.map });
+		return;
+	}
+
+	unit.bytes = options.relocatable ? entry.output.size() : image.bytes.size();
+	unit.success = true;
+}
+
+static void ReportDiagnostics(const BuildUnit &unit, bool batch) {
+	for (const REASM::Diagnostic &diagnostic : unit.diagnostics) {
+		if (diagnostic.line == 0) ERROR("{0}", diagnostic.message);
+		else if (batch) ERROR("{0}:{1}:{2}: {3}", unit.input, diagnostic.line, diagnostic.column, diagnostic.message);
+		else ERROR("{0}:{1}: {2}", diagnostic.line, diagnostic.column, diagnostic.message);
+	}
+}
+
+// Lists what -O changed; cached units were optimized by an earlier build and
+// have nothing to report.
+static void ReportRewrites(const std::vector<BuildUnit> &units) {
+	size_t counts[3] = {};
+	int64_t saved[3] = {};
+	for (const BuildUnit &unit : units) {
+		for (const REASM::Rewrite &rewrite : unit.rewrites) {
+			INFO("{0}:{1}:{2}: {3} -> {4}", unit.input, rewrite.line, rewrite.column, rewrite.before,
+				rewrite.after.empty() ? "(removed)" : rewrite.after);
+			counts[static_cast<size_t>(rewrite.kind)]++;
+			saved[static_cast<size_t>(rewrite.kind)] += rewrite.bytesSaved;
+		}
+	}
+	INFO("Optimized: {0} bytes saved; {1} jumps threaded or removed ({2} bytes), {3} unreachable instructions removed ({4} bytes), "
+		"{5} peephole rewrites ({6} bytes)", saved[0] + saved[1] + saved[2], counts[1], saved[1], counts[2], saved[2], counts[0], saved[0]);
+}
+
+// A single input keeps the original behaviour: -j splits the file itself
+// and the image goes to output.bin.
+static bool BuildSingle(const std::string &input, const REASM::AssembleOptions &options, ImageFormat format, REASM::BuildCache *cache,
+		const std::string &server) {
+	BuildUnit unit { .input = input, .output = std::string("output") + ImageExtension(format), .map = options.sourceMap ? "output.map" : "",
+		.format = format };
+	if (server.empty()) {
+		REASM::Assembler assembler(options);
+		BuildOne(unit, assembler, options, cache);
+	} else {
+		REASM::RemoteAssembler assembler(server, options);
+		BuildOne(unit, assembler, options, cache);
+	}
+
+	ReportDiagnostics(unit, false);
+	if (options.optimize && unit.success) ReportRewrites({ unit });
+	return unit.success;
+}
+
+// Translation units are independent, so the pool runs one file per job and
+// each file is assembled single-threaded by a per-worker Assembler.
+static bool BuildBatch(std::vector<std::string> &inputs, const REASM::AssembleOptions &options, ImageFormat format, REASM::BuildCache *cache,
+		const std::string &server) {
+	REASM::AssembleOptions unitOptions = options;
+	unitOptions.jobs = 1;
+
+	std::vector<BuildUnit> units(inputs.size());
+	std::set<std::string> outputs;
+	for (size_t i = 0; i < inputs.size(); i++) {
+		units[i].input = inputs[i];
+		units[i].output = std::filesystem::path(inputs[i]).replace_extension(options.relocatable ? ".o" : ImageExtension(format)).string();
+		units[i].format = format;
+		if (options.sourceMap) units[i].map = std::filesystem::path(inputs[i]).replace_extension(".map").string();
+		bool mapCollides = options.sourceMap && (units[i].map == units[i].input || !outputs.insert(units[i].map).second);
+		if (units[i].output == units[i].input || !outputs.insert(units[i].output).second || mapCollides) {
+			ERROR("Output path collides for input: {0}", units[i].input);
+			exit(1);
+		}
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	size_t threads = std::min(REASM::ThreadPool::ResolveThreadCount(options.jobs), units.size());
+	{
+		REASM::ThreadPool pool(threads);
+		for (BuildUnit &unit : units) {
+			pool.Submit([&unit, &unitOptions, cache, &server]() {
+				if (server.empty()) {
+					thread_local REASM::Assembler assembler(unitOptions);
+					BuildOne(unit, assembler, unitOptions, cache);
+				} else {
+					thread_local REASM::RemoteAssembler assembler(server, unitOptions);
+					BuildOne(unit, assembler, unitOptions, cache);
+				}
+			});
+		}
+		pool.Wait();
+	}
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+	size_t built = 0;
+	size_t cached = 0;
+	size_t bytes = 0;
+	for (const BuildUnit &unit : units) {
+		ReportDiagnostics(unit, true);
+		if (!unit.success) continue;
+
+		built++;
+		cached += unit.cached;
+		bytes += unit.bytes;
+	}
+
+	if (options.optimize) ReportRewrites(units);
+	INFO("Built {0}/{1} files ({2} cached), {3} bytes in {4} ms on {5} threads", built, units.size(), cached, bytes, elapsed.count(), threads);
+	return built == units.size();
+}
+
+static void LinkObjects(const std::vector<std::string> &inputs, const std::string &output, ImageFormat format) {
+	std::vector<REASM::LinkInput> objects(inputs.size());
+	for (size_t i = 0; i < inputs.size(); i++) {
+		REASM::MappedFile file(inputs[i]);
+		if (!file.IsValid()) {
+			ERROR("{0}", file.GetError());
+			exit(1);
+		}
+
+		std::string error;
+		objects[i].name = inputs[i];
+		if (!REASM::ObjectFile::Deserialize(file.GetContents(), objects[i].object, error)) {
+			ERROR("{0}: {1}", inputs[i], error);
+			exit(1);
+		}
+	}
+
+	REASM::LinkResult result = REASM::Link(objects);
+	for (const REASM::Diagnostic &diagnostic : result.diagnostics) ERROR("{0}", diagnostic.message);
+	if (!result.success) exit(1);
+
+	if (!WriteImage(output, result.image, format)) {
+		ERROR("Unable to open file for write: {0}", output);
+		exit(1);
+	}
+}
+
+static const char *StopReasonToString(REASM::StopReason reason) {
+	switch (reason) {
+	case REASM::StopReason::Halted: return "Halted";
+	case REASM::StopReason::InvalidInstruction: return "Invalid instruction";
+	case REASM::StopReason::DivideByZero: return "Division by zero";
+	case REASM::StopReason::Limit: return "Instruction limit reached";
+	}
+	return "Stopped";
+}
+
+struct ProfileOptions {
+	bool enabled = false;
+	std::string map;		// from build --map; without one, spots are named by address
+	std::string folded;		// folded stacks for flamegraph.pl
+	size_t top = 20;
+};
+
+struct HotSpot {
+	std::string name;
+	std::string frame;		// the enclosing label, for folded stacks
+	uint64_t executions = 0;
+	uint64_t taken = 0;
+};
+
+static void ReportHotSpots(const char *title, std::vector<HotSpot> &spots, uint64_t total, size_t top) {
+	std::stable_sort(spots.begin(), spots.end(), [](const HotSpot &a, const HotSpot &b) { return a.executions > b.executions; });
+	INFO("{0}:", title);
+	for (size_t i = 0; i < std::min(top, spots.size()); i++) {
+		const HotSpot &spot = spots[i];
+		INFO("  {0:6.2f}% {1:>12} {2:>10} taken  {3}", total ? 100.0 * spot.executions / total : 0.0, spot.executions, spot.taken, spot.name);
+	}
+}
+
+// Rolls the per-address counts up to source lines and to the label each line
+// falls under. The ISA has no calls, so a stack is just label and line.
+static void LoadSourceMap(const std::string &path, REASM::SourceMap &map) {
+	REASM::MappedFile file(path);
+	std::string error;
+	if (!file.IsValid()) {
+		ERROR("{0}", file.GetError());
+		exit(1);
+	}
+	if (!REASM::SourceMap::Deserialize(file.GetContents(), map, error)) {
+		ERROR("{0}: {1}", path, error);
+		exit(1);
+	}
+}
+
+static void ReportProfile(const REASM::Profile &profile, const ProfileOptions &options) {
+	REASM::SourceMap map;
+	if (!options.map.empty()) LoadSourceMap(options.map, map);
+
+	std::vector<HotSpot> lines;
+	std::vector<HotSpot> labels(map.labels.size() + 1);
+	labels.back().name = labels.back().frame = "(no label)";
+	for (size_t i = 0; i < map.labels.size(); i++) labels[i].name = labels[i].frame = map.labels[i].name;
+
+	uint64_t total = 0, taken = 0;
+	uint32_t lastLine = 0;
+	const REASM::SourceLabel *lastLabel = nullptr;
+	for (size_t address = 0; address < REASM::MemorySize; address++) {
+		uint64_t executions = profile.executions[address];
+		if (executions == 0) continue;
+		total += executions;
+		taken += profile.taken[address];
+
+		const REASM::SourceLabel *label = map.FindLabel(static_cast<uint16_t>(address));
+		HotSpot &bucket = labels[label ? label - map.labels.data() : map.labels.size()];
+		bucket.executions += executions;
+		bucket.taken += profile.taken[address];
+
+		// Consecutive addresses from one line, as every instruction is,
+		// share an entry.
+		uint32_t line = map.FindLine(static_cast<uint16_t>(address));
+		if (line == 0 || line != lastLine || label != lastLabel) {
+			lines.push_back(HotSpot { .name = line ? fmt::format("line {0} (0x{1:04X})", line, address) : fmt::format("0x{0:04X}", address),
+				.frame = bucket.frame });
+		}
+		lines.back().executions += executions;
+		lines.back().taken += profile.taken[address];
+		lastLine = line;
+		lastLabel = label;
+	}
+
+	INFO("Profile: {0} instructions, {1} taken branches", total, taken);
+	if (!map.labels.empty()) {
+		std::erase_if(labels, [](const HotSpot &spot) { return spot.executions == 0; });
+		ReportHotSpots("Hot labels", labels, total, options.top);
+	}
+	ReportHotSpots(map.lines.empty() ? "Hot addresses" : "Hot lines", lines, total, options.top);
+
+	if (!options.folded.empty()) {
+		std::string folded;
+		for (const HotSpot &line : lines) {
+			std::string leaf = line.name.substr(0, line.name.find(" ("));
+			folded += map.labels.empty() ? fmt::format("{0} {1}\n", leaf, line.executions) : fmt::format("{0};{1} {2}\n", line.frame, leaf, line.executions);
+		}
+		if (!WriteOutput(options.folded, folded)) {
+			ERROR("Unable to open file for write: {0}", options.folded);
+			exit(1);
+		}
+	}
+}
+
+enum class RunMode {
+	Interpret,
+	Translate,		// --jit
+	Differential,	// --differential: translated and interpreted side by side
+};
+
+static void ReportState(const REASM::MachineState &state) {
+	std::string registers;
+	for (size_t i = 0; i < REASM::RegisterCount; i++) registers += fmt::format("{0}R{1}=0x{2:04X}", i ? " " : "", i, state.registers[i]);
+	INFO("{0}", registers);
+	INFO("PC=0x{0:04X} SP=0x{1:04X} Z={2} S={3} C={4}", state.pc, state.sp, state.Zero() ? 1 : 0, state.Sign() ? 1 : 0, state.Carry() ? 1 : 0);
+}
+
+static void RunDifferential(std::span<const uint8_t> image, uint16_t origin, uint64_t limit) {
+	REASM::RunResult result;
+	REASM::Divergence divergence;
+	if (!REASM::RunDifferential(image, origin, limit, result, divergence)) {
+		if (divergence.memory) {
+			ERROR("Memory differs after {0} instructions, though the machines agree", divergence.instructions);
+		} else {
+			ERROR("Translated block at 0x{0:04X} diverged after {1} instructions", divergence.pc, divergence.instructions);
+			if (divergence.expected.reason != divergence.actual.reason || divergence.expected.instructions != divergence.actual.instructions) {
+				ERROR("Interpreter: {0} after {1} more; translated: {2} after {3} more", StopReasonToString(divergence.expected.reason),
+					divergence.expected.instructions, StopReasonToString(divergence.actual.reason), divergence.actual.instructions);
+			}
+		}
+		INFO("Interpreter:");
+		ReportState(divergence.expectedState);
+		INFO("Translated:");
+		ReportState(divergence.actualState);
+		exit(1);
+	}
+
+	INFO("{0} after {1} instructions; translated and interpreted runs agree", StopReasonToString(result.reason), result.instructions);
+	if (result.reason != REASM::StopReason::Halted) exit(1);
+}
+
+// Loads an image at origin, or a .seg image at its own origins, and runs it
+// until HLT, a fault or limit instructions. Exits with failure unless the
+// program halted.
+static void RunImage(const std::string &input, uint16_t origin, uint64_t limit, RunMode mode, const ProfileOptions &profiling) {
+	REASM::MappedFile file(input);
+	if (!file.IsValid()) {
+		ERROR("{0}", file.GetError());
+		exit(1);
+	}
+
+	std::vector<uint8_t> flat;
+	std::span<const uint8_t> image = PlaceImage(input, file.GetContents(), origin, flat);
+	REASM::Emulator emulator;
+	if (!emulator.Load(image, origin)) {
+		ERROR("{0}: {1} bytes don't fit in memory at 0x{2:04X}", input, image.size(), origin);
+		exit(1);
+	}
+	if (mode == RunMode::Differential) {
+		RunDifferential(image, origin, limit);
+		return;
+	}
+
+	std::unique_ptr<REASM::JIT> jit = mode == RunMode::Translate ? std::make_unique<REASM::JIT>(emulator) : nullptr;
+	if (jit && !jit->IsAvailable()) WARN("No native code generation here; interpreting");
+	std::unique_ptr<REASM::Profile> profile = profiling.enabled ? std::make_unique<REASM::Profile>() : nullptr;
+	auto start = std::chrono::steady_clock::now();
+	REASM::RunResult result = jit ? jit->Run(limit) : profile ? emulator.Run(limit, *profile) : emulator.Run(limit);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	const REASM::MachineState &state = emulator.GetState();
+	double mips = elapsed.count() > 0 ? result.instructions / elapsed.count() / 1e6 : 0.0;
+	INFO("{0} at 0x{1:04X} after {2} instructions in {3:.3f} s ({4:.1f} MIPS)", StopReasonToString(result.reason), state.pc,
+		result.instructions, elapsed.count(), mips);
+	ReportState(state);
+	if (jit) {
+		const REASM::JITStats &stats = jit->GetStats();
+		INFO("JIT: {0} blocks, {1} exits chained, {2} invalidated, {3} flushes; {4} instructions interpreted", stats.blocks, stats.chained,
+			stats.invalidated, stats.flushes, stats.interpreted);
+	}
+	if (profile) ReportProfile(*profile, profiling);
+	if (result.reason != REASM::StopReason::Halted) exit(1);
+}
+
+// An inputs file gives one instance per line: up to RegisterCount starting
+// register values, R0 first, separated by spaces or commas. Missing ones are
+// zero; # starts a comment and blank lines are skipped.
+static void ReadInstances(const std::string &path, std::vector<REASM::RegisterFile> &instances) {
+	REASM::MappedFile file(path);
+	if (!file.IsValid()) {
+		ERROR("{0}", file.GetError());
+		exit(1);
+	}
+
+	std::string_view contents = file.GetContents();
+	size_t line = 0;
+	while (!contents.empty()) {
+		line++;
+		size_t end = std::min(contents.find('\n'), contents.size());
+		std::string text(contents.substr(0, std::min(end, contents.find('#'))));
+		contents.remove_prefix(std::min(end + 1, contents.size()));
+
+		REASM::RegisterFile registers {};
+		size_t count = 0;
+		const char *cursor = text.c_str();
+		while (true) {
+			cursor += std::strspn(cursor, " \t\r,");
+			if (*cursor == '\0') break;
+
+			char *next;
+			unsigned long value = std::strtoul(cursor, &next, 0);
+			if (next == cursor || value > UINT16_MAX || !std::strchr(" \t\r,", *next)) {
+				ERROR("{0}:{1}: Invalid register value: {2}", path, line, cursor);
+				exit(1);
+			}
+			if (count == REASM::RegisterCount) {
+				ERROR("{0}:{1}: More than {2} register values", path, line, REASM::RegisterCount);
+				exit(1);
+			}
+			registers[count++] = static_cast<uint16_t>(value);
+			cursor = next;
+		}
+		if (count > 0) instances.push_back(registers);
+	}
+}
+
+// The same instances on an Emulator each, for --compare.
+static std::vector<REASM::BatchOutcome> RunEach(std::span<const uint8_t> image, uint16_t origin, std::span<const REASM::RegisterFile> instances,
+		uint64_t limit, size_t jobs) {
+	std::vector<REASM::BatchOutcome> outcomes(instances.size());
+	size_t threads = std::min(REASM::ThreadPool::ResolveThreadCount(jobs), instances.size());
+	REASM::ThreadPool pool(threads);
+	for (size_t thread = 0; thread < threads; thread++) {
+		size_t begin = instances.size() * thread / threads;
+		size_t end = instances.size() * (thread + 1) / threads;
+		pool.Submit([&, begin, end]() {
+			REASM::Emulator emulator;
+			for (size_t i = begin; i < end; i++) {
+				emulator.Load(image, origin);
+				emulator.GetState().registers = instances[i];
+				outcomes[i].result = emulator.Run(limit);
+				outcomes[i].state = emulator.GetState();
+			}
+		});
+	}
+	pool.Wait();
+	return outcomes;
+}
+
+struct BatchOptions {
+	uint16_t origin = 0;	// where a flat image loads; a .seg image records its own
+	uint64_t limit = UINT64_MAX;
+	size_t jobs = 1;
+	std::string inputs;
+	std::string output;		// per-instance results, if asked for
+	bool compare = false;	// --compare: also run every instance alone and check they agree
+};
+
+static uint64_t CountInstructions(std::span<const REASM::BatchOutcome> outcomes) {
+	uint64_t instructions = 0;
+	for (const REASM::BatchOutcome &outcome : outcomes) instructions += outcome.result.instructions;
+	return instructions;
+}
+
+// Runs input once per line of the inputs file on a BatchEmulator, placed as
+// RunImage places it. Exits with failure unless every instance halted, or
+// when --compare finds a difference.
+static void RunBatch(const std::string &input, const BatchOptions &options) {
+	REASM::MappedFile file(input);
+	if (!file.IsValid()) {
+		ERROR("{0}", file.GetError());
+		exit(1);
+	}
+	std::vector<REASM::RegisterFile> instances;
+	ReadInstances(options.inputs, instances);
+
+	uint16_t origin = options.origin;
+	std::vector<uint8_t> flat;
+	std::span<const uint8_t> image = PlaceImage(input, file.GetContents(), origin, flat);
+	REASM::BatchEmulator batch;
+	if (!batch.Load(image, origin)) {
+		ERROR("{0}: {1} bytes don't fit in memory at 0x{2:04X}", input, image.size(), origin);
+		exit(1);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<REASM::BatchOutcome> outcomes = batch.Run(instances, options.limit, options.jobs);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	uint64_t instructions = CountInstructions(outcomes);
+	size_t halted = 0;
+	for (const REASM::BatchOutcome &outcome : outcomes) halted += outcome.result.reason == REASM::StopReason::Halted ? 1 : 0;
+	const REASM::BatchStats &stats = batch.GetStats();
+	double rate = elapsed.count() > 0 ? instructions / elapsed.count() / 1e6 : 0.0;
+	double busy = stats.steps > 0 ? 100.0 * stats.issued / (stats.steps * REASM::BatchEmulator::LaneCount) : 0.0;
+	INFO("{0} instances, {1} halted, {2} instructions in {3:.3f} s ({4:.1f} M instance instructions/s)", outcomes.size(), halted,
+		instructions, elapsed.count(), rate);
+	INFO("{0} warp steps, {1:.1f}% of lanes busy, {2} instances detached", stats.steps, busy, stats.detached);
+
+	if (!options.output.empty()) {
+		std::string results = "# instance reason instructions pc sp flags R0-R11\n";
+		for (size_t i = 0; i < outcomes.size(); i++) {
+			const REASM::MachineState &state = outcomes[i].state;
+			results += fmt::format("{0} {1} {2} 0x{3:04X} 0x{4:04X} 0x{5:05X}", i, StopReasonToString(outcomes[i].result.reason),
+				outcomes[i].result.instructions, state.pc, state.sp, state.flags);
+			for (uint16_t value : state.registers) results += fmt::format(" 0x{0:04X}", value);
+			results += '\n';
+		}
+		if (!WriteOutput(options.output, results)) {
+			ERROR("Unable to open file for write: {0}", options.output);
+			exit(1);
+		}
+	}
+
+	if (options.compare) {
+		start = std::chrono::steady_clock::now();
+		std::vector<REASM::BatchOutcome> expected = RunEach(image, origin, instances, options.limit, options.jobs);
+		elapsed = std::chrono::steady_clock::now() - start;
+		double scalarRate = elapsed.count() > 0 ? CountInstructions(expected) / elapsed.count() / 1e6 : 0.0;
+		// How the per-instance run compares with the batch, as a factor of at least 1.
+		double ratio = rate > 0 && scalarRate > 0 ? rate / scalarRate : 1.0;
+		INFO("One Emulator per instance: {0:.3f} s ({1:.1f} M instance instructions/s, {2:.1f}x {3})", elapsed.count(), scalarRate,
+			ratio >= 1.0 ? ratio : 1.0 / ratio, ratio >= 1.0 ? "slower" : "faster");
+
+		size_t mismatches = 0;
+		for (size_t i = 0; i < outcomes.size(); i++) {
+			const REASM::BatchOutcome &a = outcomes[i], &b = expected[i];
+			if (a.result.reason == b.result.reason && a.result.instructions == b.result.instructions && a.state == b.state) continue;
+			if (mismatches++ < 10) {
+				ERROR("Instance {0}: batch {1} after {2} instructions; alone {3} after {4}", i, StopReasonToString(a.result.reason),
+					a.result.instructions, StopReasonToString(b.result.reason), b.result.instructions);
+				INFO("Batch:");
+				ReportState(a.state);
+				INFO("Alone:");
+				ReportState(b.state);
+			}
+		}
+		if (mismatches > 0) {
+			ERROR("{0} of {1} instances differ", mismatches, outcomes.size());
+			exit(1);
+		}
+		INFO("Every instance matches");
+	}
+	if (halted != outcomes.size()) exit(1);
+}
+
+struct DisasmOptions {
+	uint16_t origin = 0;	// as for BatchOptions
+	size_t jobs = 1;
+	std::string map;
+	std::string output = "output.asm";
+	bool verify = false;	// --verify: assemble the listing again and compare it with the image
+};
+
+// The map labels that belong in each segment's listing: the ones inside it,
+// or at its end when no segment starts there. The rest go with the first
+// segment, to become EQUs.
+static std::vector<REASM::SourceMap> SplitSourceMap(const REASM::SourceMap &map, std::span<const REASM::ImageSegment> segments) {
+	std::vector<REASM::SourceMap> maps(segments.size());
+	if (segments.empty()) return maps;
+	for (const REASM::SourceLabel &label : map.labels) {
+		auto find = [&](uint32_t slack) {
+			for (size_t i = 0; i < segments.size(); i++) {
+				if (label.address >= segments[i].origin && label.address < segments[i].origin + segments[i].size + slack) return i;
+			}
+			return segments.size();
+		};
+		size_t segment = find(0);
+		if (segment == segments.size()) segment = find(1);
+		maps[segment == segments.size() ? 0 : segment].labels.push_back(label);
+	}
+	return maps;
+}
+
+// Writes input back out as source, a .seg image as one ORG per segment.
+// Exits with failure when --verify finds the listing doesn't assemble to the
+// same bytes.
+static void Disassemble(const std::string &input, const DisasmOptions &options) {
+	REASM::MappedFile file(input);
+	if (!file.IsValid()) {
+		ERROR("{0}", file.GetError());
+		exit(1);
+	}
+	REASM::SourceMap map;
+	if (!options.map.empty()) LoadSourceMap(options.map, map);
+
+	std::string_view contents = file.GetContents();
+	bool isSegmented = IsSegmentedImage(input);
+	REASM::SegmentedImage segmented;
+	std::span<const uint8_t> image(reinterpret_cast<const uint8_t *>(contents.data()), contents.size());
+	if (isSegmented) {
+		segmented = ReadSegmentedImage(input, contents);
+		image = segmented.bytes;
+	}
+	std::vector<REASM::SourceMap> maps = SplitSourceMap(map, segmented.segments);
+
+	auto start = std::chrono::steady_clock::now();
+	REASM::Disassembly listing;
+	if (!isSegmented) {
+		listing = REASM::Disassemble(image, REASM::DisassembleOptions {
+			.origin = options.origin, .map = options.map.empty() ? nullptr : &map, .jobs = options.jobs });
+	}
+	for (size_t i = 0; i < segmented.segments.size(); i++) {
+		const REASM::ImageSegment &segment = segmented.segments[i];
+		REASM::Disassembly part = REASM::Disassemble(image.subspan(segment.offset, segment.size), REASM::DisassembleOptions {
+			.origin = segment.origin, .map = options.map.empty() ? nullptr : &maps[i], .jobs = options.jobs });
+		if (i > 0) listing.text += '\n';
+		listing.text += part.text;
+		listing.instructions += part.instructions;
+		listing.labels += part.labels;
+		if (part.undecoded > 0 && listing.undecoded == 0) listing.firstUndecoded = segment.offset + part.firstUndecoded;
+		listing.undecoded += part.undecoded;
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	double rate = elapsed.count() > 0 ? image.size() / elapsed.count() / (1024 * 1024) : 0.0;
+	INFO("{0} instructions, {1} labels from {2} bytes in {3:.3f} s ({4:.1f} MB/s)", listing.instructions, listing.labels,
+		image.size(), elapsed.count(), rate);
+	if (listing.undecoded > 0) {
+		WARN("{0} bytes aren't instructions and are listed as data, the first at offset 0x{1:X}", listing.undecoded, listing.firstUndecoded);
+	}
+	if (!WriteOutput(options.output, listing.text)) {
+		ERROR("Unable to open file for write: {0}", options.output);
+		exit(1);
+	}
+
+	if (options.verify) {
+		REASM::AssembleResult result = REASM::Assemble(listing.text, REASM::AssembleOptions { .jobs = options.jobs });
+		if (!result.success) {
+			for (const REASM::Diagnostic &diagnostic : result.diagnostics) {
+				ERROR("{0}:{1}:{2}: {3}", options.output, diagnostic.line, diagnostic.column, diagnostic.message);
+			}
+			exit(1);
+		}
+		// Segments are listed in order, so the packed bytes line up; a flat
+		// image is a single segment.
+		const std::vector<uint8_t> &bytes = result.image.bytes;
+		auto [a, b] = std::mismatch(image.begin(), image.end(), bytes.begin(), bytes.end());
+		if (a != image.end() || b != bytes.end()) {
+			ERROR("Listing assembles to {0} bytes, differing from the image from offset 0x{1:X}", bytes.size(),
+				a - image.begin());
+			exit(1);
+		}
+		auto sameSegment = [](const REASM::ImageSegment &x, const REASM::ImageSegment &y) { return x.origin == y.origin && x.size == y.size; };
+		if (isSegmented && !std::equal(segmented.segments.begin(), segmented.segments.end(),
+				result.image.segments.begin(), result.image.segments.end(), sameSegment)) {
+			ERROR("Listing assembles to the same bytes, but placed differently");
+			exit(1);
+		}
+		INFO("Listing assembles to the same {0} bytes", image.size());
+	}
+}
+
+// Rebuilds input every time it is saved. The Assembler is kept across saves,
+// so only the lines that changed are lexed and parsed again.
+static void Watch(const std::string &input, const std::string &output, ImageFormat format) {
+	REASM::FileWatcher watcher(input);
+	if (!watcher.IsValid()) {
+		ERROR("{0}", watcher.GetError());
+		exit(1);
+	}
+
+	REASM::Assembler assembler;
+	while (true) {
+		BuildUnit unit { .input = input, .output = output };
+		auto start = std::chrono::steady_clock::now();
+		{
+			// The files INCBIN read are watched along with the source once a
+			// build succeeds; a failed one keeps watching the previous set.
+			REASM::IncludedFiles included(input);
+			REASM::AssembleOptions options;
+			options.readFile = [&included](std::string_view path, std::string_view &contents, std::string &error) {
+				return included.Read(path, contents, error);
+			};
+			assembler.SetOptions(options);
+			REASM::MappedFile source(input);
+			if (!source.IsValid()) {
+				unit.diagnostics.push_back(REASM::Diagnostic { .line = 0, .column = 0, .message = source.GetError() });
+			} else {
+				REASM::AssembleResult result = assembler.Update(source.GetContents());
+				unit.diagnostics = std::move(result.diagnostics);
+				unit.success = result.success;
+				unit.bytes = result.image.bytes.size();
+				if (unit.success && !WriteImage(output, result.image, format)) {
+					unit.diagnostics.push_back(REASM::Diagnostic { .line = 0, .column = 0, .message = "Unable to open file for write: " + output });
+					unit.success = false;
+				}
+				if (result.success) {
+					std::vector<std::string> paths { input };
+					for (const std::string &path : result.included) paths.push_back(included.Resolve(path));
+					watcher.SetPaths(paths);
+				}
+			}
+		}
+		auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+		ReportDiagnostics(unit, true);
+		if (unit.success) {
+			const REASM::UpdateStats &stats = assembler.GetUpdateStats();
+			INFO("Built {0}: {1} bytes in {2} ms ({3}, {4} lines relexed{5})", input, unit.bytes, elapsed.count() / 1000.0,
+				stats.incremental ? "incremental" : "full", stats.linesRelexed, stats.relaidOut ? ", relaid out" : "");
+		}
+
+		if (!watcher.IsValid() || !watcher.Wait()) {
+			ERROR("{0}", watcher.GetError());
+			exit(1);
+		}
+	}
+}
+
+// Consumes the remaining arguments as inputs, expanding @response files.
+// Returns true if they form a batch: several files or any response file.
+static bool CollectInputs(int &argc, char **&argv, std::vector<std::string> &inputs) {
+	bool response = false;
+	while (argc > 0) {
+		std::string input = Shift(argc, &argv);
+		if (input[0] == '@') {
+			ReadResponseFile(input.substr(1), inputs);
+			response = true;
+		} else {
+			inputs.push_back(input);
+		}
+	}
+
+	if (inputs.empty()) {
+		ERROR("No inputs!");
+		exit(1);
+	}
+	return response || inputs.size() > 1;
+}
+
 int main(int argc, char **argv) {
 	REASM::Log::Init();
 	char *program = Shift(argc, &argv);
@@ -26,8 +885,253 @@ int main(int argc, char **argv) {
 			ERROR("Invalid Subargs!");
 			exit(1);
 		}
-		char *input = Shift(argc, &argv);
-		REASM::Assemble(std::string(input));
+		REASM::AssembleOptions options;
+		std::string cacheDirectory;
+		uint64_t cacheMegabytes = 256;
+		bool cacheStats = false;
+		std::string server;
+		std::string formatName;
+		while (argc > 0 && argv[0][0] == '-') {
+			std::string flag = Shift(argc, &argv);
+			if (flag == "-j") {
+				if (argc < 1) {
+					ERROR("Missing value for -j!");
+					exit(1);
+				}
+				options.jobs = std::strtoul(Shift(argc, &argv), nullptr, 10);
+			} else if (flag == "-c") {
+				options.relocatable = true;
+			} else if (flag == "-O") {
+				options.optimize = true;
+			} else if (flag == "--map") {
+				options.sourceMap = true;
+			} else if (flag == "--cache-dir" || flag == "--cache-size" || flag == "--server" || flag == "--format") {
+				if (argc < 1) {
+					ERROR("Missing value for {0}!", flag);
+					exit(1);
+				}
+				if (flag == "--cache-dir") cacheDirectory = Shift(argc, &argv);
+				else if (flag == "--server") server = Shift(argc, &argv);
+				else if (flag == "--format") formatName = Shift(argc, &argv);
+				else cacheMegabytes = std::strtoull(Shift(argc, &argv), nullptr, 10);
+			} else if (flag == "--cache-stats") {
+				cacheStats = true;
+			} else {
+				ERROR("Invalid flag: {0}", flag);
+				exit(1);
+			}
+		}
+		if (argc < 1) {
+			ERROR("Invalid Subargs!");
+			exit(1);
+		}
+
+		if (options.sourceMap && options.relocatable) {
+			ERROR("--map needs a flat image, not -c!");
+			exit(1);
+		}
+		if (!formatName.empty() && options.relocatable) {
+			ERROR("--format picks how an image is written, not -c objects!");
+			exit(1);
+		}
+		ImageFormat format = formatName.empty() ? ImageFormat::Flat : ParseImageFormat(formatName);
+
+		std::vector<std::string> inputs;
+		bool batch = CollectInputs(argc, argv, inputs) || options.relocatable;
+
+		if (cacheDirectory.empty() && std::getenv("REASM_CACHE_DIR")) cacheDirectory = std::getenv("REASM_CACHE_DIR");
+		if (cacheStats && cacheDirectory.empty()) {
+			ERROR("--cache-stats needs --cache-dir or REASM_CACHE_DIR!");
+			exit(1);
+		}
+		std::unique_ptr<REASM::BuildCache> cache;
+		if (!cacheDirectory.empty()) cache = std::make_unique<REASM::BuildCache>(cacheDirectory, cacheMegabytes * 1024 * 1024);
+
+		// Objects are always named after their input, so -c implies a batch.
+		bool success = batch ? BuildBatch(inputs, options, format, cache.get(), server)
+			: BuildSingle(inputs[0], options, format, cache.get(), server);
+
+		if (cache) {
+			cache->Trim();
+			if (cacheStats) {
+				REASM::CacheStats stats = cache->GetStats();
+				INFO("Cache: {0} hits, {1} misses, {2} stored, {3} evicted; {4} entries, {5} bytes", stats.hits, stats.misses,
+					stats.stores, stats.evictions, stats.entries, stats.bytes);
+			}
+		}
+		if (!success) exit(1);
+	} else if (std::string(subcommand) == "serve") {
+		std::string socketPath;
+		size_t jobs = 0;
+		while (argc > 0) {
+			std::string flag = Shift(argc, &argv);
+			if ((flag == "--socket" || flag == "-j") && argc < 1) {
+				ERROR("Missing value for {0}!", flag);
+				exit(1);
+			}
+			if (flag == "--socket") {
+				socketPath = Shift(argc, &argv);
+			} else if (flag == "-j") {
+				jobs = std::strtoul(Shift(argc, &argv), nullptr, 10);
+			} else {
+				ERROR("Invalid flag: {0}", flag);
+				exit(1);
+			}
+		}
+		if (socketPath.empty()) {
+			ERROR("serve needs --socket <path>!");
+			exit(1);
+		}
+
+		INFO("Serving on {0} with {1} threads", socketPath, REASM::ThreadPool::ResolveThreadCount(jobs));
+		std::string error;
+		REASM::AssemblerServer server(socketPath, jobs);
+		if (!server.Run(error)) {
+			ERROR("{0}", error);
+			exit(1);
+		}
+	} else if (std::string(subcommand) == "link") {
+		std::string output;
+		ImageFormat format = ImageFormat::Flat;
+		while (argc > 0 && argv[0][0] == '-') {
+			std::string flag = Shift(argc, &argv);
+			if (flag == "-o" || flag == "--format") {
+				if (argc < 1) {
+					ERROR("Missing value for {0}!", flag);
+					exit(1);
+				}
+				if (flag == "-o") output = Shift(argc, &argv);
+				else format = ParseImageFormat(Shift(argc, &argv));
+			} else {
+				ERROR("Invalid flag: {0}", flag);
+				exit(1);
+			}
+		}
+
+		if (output.empty()) output = std::string("output") + ImageExtension(format);
+
+		std::vector<std::string> inputs;
+		CollectInputs(argc, argv, inputs);
+		LinkObjects(inputs, output, format);
+	} else if (std::string(subcommand) == "watch") {
+		std::string output;
+		ImageFormat format = ImageFormat::Flat;
+		while (argc > 0 && argv[0][0] == '-') {
+			std::string flag = Shift(argc, &argv);
+			if (flag == "-o" || flag == "--format") {
+				if (argc < 1) {
+					ERROR("Missing value for {0}!", flag);
+					exit(1);
+				}
+				if (flag == "-o") output = Shift(argc, &argv);
+				else format = ParseImageFormat(Shift(argc, &argv));
+			} else {
+				ERROR("Invalid flag: {0}", flag);
+				exit(1);
+			}
+		}
+		if (argc != 1) {
+			ERROR("watch takes exactly one input!");
+			exit(1);
+		}
+		if (output.empty()) output = std::string("output") + ImageExtension(format);
+
+		Watch(Shift(argc, &argv), output, format);
+	} else if (std::string(subcommand) == "run") {
+		uint16_t origin = 0;
+		uint64_t limit = UINT64_MAX;
+		ProfileOptions profiling;
+		RunMode mode = RunMode::Interpret;
+		while (argc > 0 && argv[0][0] == '-') {
+			std::string flag = Shift(argc, &argv);
+			if (flag == "--org" || flag == "--limit" || flag == "--map" || flag == "--folded" || flag == "--top") {
+				if (argc < 1) {
+					ERROR("Missing value for {0}!", flag);
+					exit(1);
+				}
+				if (flag == "--org") origin = static_cast<uint16_t>(std::strtoul(Shift(argc, &argv), nullptr, 0));
+				else if (flag == "--limit") limit = std::strtoull(Shift(argc, &argv), nullptr, 10);
+				else if (flag == "--map") profiling.map = Shift(argc, &argv);
+				else if (flag == "--folded") profiling.folded = Shift(argc, &argv);
+				else profiling.top = std::strtoul(Shift(argc, &argv), nullptr, 10);
+			} else if (flag == "--profile") {
+				profiling.enabled = true;
+			} else if (flag == "--jit") {
+				mode = RunMode::Translate;
+			} else if (flag == "--differential") {
+				mode = RunMode::Differential;
+			} else {
+				ERROR("Invalid flag: {0}", flag);
+				exit(1);
+			}
+		}
+		if (argc != 1) {
+			ERROR("run takes exactly one input!");
+			exit(1);
+		}
+
+		// Asking for any of the report's outputs implies --profile.
+		profiling.enabled |= !profiling.map.empty() || !profiling.folded.empty();
+		if (profiling.enabled && mode != RunMode::Interpret) {
+			ERROR("--profile runs on the interpreter; drop --jit or --differential!");
+			exit(1);
+		}
+		RunImage(Shift(argc, &argv), origin, limit, mode, profiling);
+	} else if (std::string(subcommand) == "batch") {
+		BatchOptions options;
+		while (argc > 0 && argv[0][0] == '-') {
+			std::string flag = Shift(argc, &argv);
+			if (flag == "--org" || flag == "--limit" || flag == "-j" || flag == "-o" || flag == "--inputs") {
+				if (argc < 1) {
+					ERROR("Missing value for {0}!", flag);
+					exit(1);
+				}
+				if (flag == "--org") options.origin = static_cast<uint16_t>(std::strtoul(Shift(argc, &argv), nullptr, 0));
+				else if (flag == "--limit") options.limit = std::strtoull(Shift(argc, &argv), nullptr, 10);
+				else if (flag == "-j") options.jobs = std::strtoul(Shift(argc, &argv), nullptr, 10);
+				else if (flag == "-o") options.output = Shift(argc, &argv);
+				else options.inputs = Shift(argc, &argv);
+			} else if (flag == "--compare") {
+				options.compare = true;
+			} else {
+				ERROR("Invalid flag: {0}", flag);
+				exit(1);
+			}
+		}
+		if (argc != 1) {
+			ERROR("batch takes exactly one input!");
+			exit(1);
+		}
+		if (options.inputs.empty()) {
+			ERROR("batch needs --inputs!");
+			exit(1);
+		}
+		RunBatch(Shift(argc, &argv), options);
+	} else if (std::string(subcommand) == "disasm") {
+		DisasmOptions options;
+		while (argc > 0 && argv[0][0] == '-') {
+			std::string flag = Shift(argc, &argv);
+			if (flag == "--org" || flag == "--map" || flag == "-j" || flag == "-o") {
+				if (argc < 1) {
+					ERROR("Missing value for {0}!", flag);
+					exit(1);
+				}
+				if (flag == "--org") options.origin = static_cast<uint16_t>(std::strtoul(Shift(argc, &argv), nullptr, 0));
+				else if (flag == "--map") options.map = Shift(argc, &argv);
+				else if (flag == "-j") options.jobs = std::strtoul(Shift(argc, &argv), nullptr, 10);
+				else options.output = Shift(argc, &argv);
+			} else if (flag == "--verify") {
+				options.verify = true;
+			} else {
+				ERROR("Invalid flag: {0}", flag);
+				exit(1);
+			}
+		}
+		if (argc != 1) {
+			ERROR("disasm takes exactly one input!");
+			exit(1);
+		}
+		Disassemble(Shift(argc, &argv), options);
 	} else {
 		ERROR("Invalid subcommand: {0}", subcommand);
 		exit(1);